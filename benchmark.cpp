@@ -0,0 +1,328 @@
+// benchmark.cpp: generated benchmark scenes and camera flythrough harness
+
+#include "benchmark.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+
+#define OBJECT_SPACING 1.5f
+#define BENCHMARK_SEED 20230518u
+
+bool loadCameraPath(const char *fileName, CameraPath *path) {
+  FILE *file = fopen(fileName, "r");
+  if (!file) {
+    fprintf(stderr, "ERROR: could not open camera path %s\n", fileName);
+    return false;
+  }
+
+  path->keys.clear();
+  char line[256];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+
+    CameraKey key;
+    int fields = sscanf(line, "%lf %f %f %f %f %f %f", &key.time,
+                        &key.position.x, &key.position.y, &key.position.z,
+                        &key.target.x, &key.target.y, &key.target.z);
+    if (fields <= 0)
+      continue;
+    if (fields != 7) {
+      fprintf(stderr, "ERROR: %s:%d: expected time, position and target\n", fileName, lineNumber);
+      fclose(file);
+      return false;
+    }
+    path->keys.push_back(key);
+  }
+  fclose(file);
+
+  if (path->keys.size() < 2) {
+    fprintf(stderr, "ERROR: camera path %s needs at least two keyframes\n", fileName);
+    return false;
+  }
+
+  std::stable_sort(path->keys.begin(), path->keys.end(),
+                   [](const CameraKey &a, const CameraKey &b) { return a.time < b.time; });
+  return true;
+}
+
+void defaultCameraPath(float sceneRadius, double duration, CameraPath *path) {
+  const int keyCount = 9;
+  path->keys.clear();
+
+  for (int k = 0; k < keyCount; k++) {
+    float angle = 2.0f * 3.14159265f * (float) k / (float) (keyCount - 1);
+    // Alternate wide shots and passes through the scene
+    float radius = sceneRadius * ((k % 2) ? 0.5f : 1.6f) + 2.0f;
+    float height = sceneRadius * 0.4f * sinf(angle * 2.0f) + 1.0f;
+
+    CameraKey key;
+    key.time = duration * (double) k / (double) (keyCount - 1);
+    key.position = glm::vec3(radius * cosf(angle), height, radius * sinf(angle));
+    key.target = glm::vec3(0.3f * sceneRadius * cosf(angle + 1.5f), 0.0f,
+                           0.3f * sceneRadius * sinf(angle + 1.5f));
+    path->keys.push_back(key);
+  }
+}
+
+static glm::vec3 catmullRom(const glm::vec3 &p0, const glm::vec3 &p1,
+                            const glm::vec3 &p2, const glm::vec3 &p3, float t) {
+  float t2 = t * t, t3 = t2 * t;
+  return 0.5f * ((2.0f * p1) + (p2 - p0) * t +
+                 (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                 (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+void sampleCameraPath(const CameraPath &path, double time,
+                      glm::vec3 *position, glm::vec3 *target) {
+  const std::vector<CameraKey> &keys = path.keys;
+  size_t last = keys.size() - 1;
+
+  if (time <= keys[0].time) {
+    *position = keys[0].position;
+    *target = keys[0].target;
+    return;
+  }
+  if (time >= keys[last].time) {
+    *position = keys[last].position;
+    *target = keys[last].target;
+    return;
+  }
+
+  size_t i = 0;
+  while (keys[i + 1].time <= time)
+    i++;
+
+  size_t i0 = i > 0 ? i - 1 : i;
+  size_t i3 = i + 2 <= last ? i + 2 : last;
+  double span = keys[i + 1].time - keys[i].time;
+  float t = span > 0.0 ? (float) ((time - keys[i].time) / span) : 0.0f;
+
+  *position = catmullRom(keys[i0].position, keys[i].position,
+                         keys[i + 1].position, keys[i3].position, t);
+  *target = catmullRom(keys[i0].target, keys[i].target,
+                       keys[i + 1].target, keys[i3].target, t);
+}
+
+float generateBenchmarkScene(const BenchmarkConfig &config, int meshCount,
+                             const unsigned int *diffuseMaps, int mapCount,
+                             unsigned int specularMap, std::vector<SceneObject> *objects) {
+  std::mt19937 rng(BENCHMARK_SEED);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  // Jittered grid, centred on the origin
+  int side = (int) ceil(cbrt((double) config.objects));
+  float half = 0.5f * (float) (side - 1) * OBJECT_SPACING;
+
+  objects->clear();
+  objects->reserve(config.objects);
+  for (int i = 0; i < config.objects; i++) {
+    int x = i % side, y = (i / side) % side, z = i / (side * side);
+
+    SceneObject object;
+    object.mesh = (int) (rng() % (unsigned int) meshCount);
+    object.diffuseMap = diffuseMaps[i % mapCount];
+    object.specularMap = specularMap;
+    object.position = glm::vec3(x * OBJECT_SPACING - half, y * OBJECT_SPACING - half,
+                                z * OBJECT_SPACING - half) +
+                      (glm::vec3(unit(rng), unit(rng), unit(rng)) - 0.5f) * (0.5f * OBJECT_SPACING);
+    object.scale = 0.3f + 0.4f * unit(rng);
+
+    // A quarter of the objects never move (shadow cache, static layers)
+    object.isStatic = (rng() % 4) == 0;
+    object.spin = object.isStatic ? glm::vec2(0.0f)
+                                  : glm::vec2(60.0f * unit(rng) - 30.0f, 90.0f * unit(rng) - 45.0f);
+
+    // objectModelMatrix rotates before translating, so everything orbits
+    // the origin: slow the far objects down to keep the scene in shape
+    object.spin = object.spin * (1.0f / (1.0f + glm::length(object.position)));
+
+    objects->push_back(object);
+  }
+
+  return half * 1.7320508f + OBJECT_SPACING;
+}
+
+unsigned char *generateBenchmarkTexture(int index, int size) {
+  unsigned char *data = (unsigned char *) malloc((size_t) size * size * 3);
+  if (!data)
+    return NULL;
+
+  std::mt19937 rng(BENCHMARK_SEED + (unsigned int) index);
+  unsigned char tint[2][3];
+  for (int c = 0; c < 3; c++) {
+    tint[0][c] = (unsigned char) (64 + rng() % 192);
+    tint[1][c] = (unsigned char) (rng() % 128);
+  }
+  int cells = 2 << (index % 4);   // 2, 4, 8 or 16 checks per side
+
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      int check = ((x * cells / size) + (y * cells / size)) & 1;
+      unsigned char *texel = &data[(y * size + x) * 3];
+      for (int c = 0; c < 3; c++)
+        texel[c] = tint[check][c];
+    }
+  }
+  return data;
+}
+
+bool createBenchmark(Benchmark *bench, const BenchmarkConfig &config, float sceneRadius) {
+  bench->config = config;
+
+  if (config.cameraPathFile) {
+    if (!loadCameraPath(config.cameraPathFile, &bench->path))
+      return false;
+  } else {
+    defaultCameraPath(sceneRadius, config.duration, &bench->path);
+  }
+  bench->duration = bench->path.keys.back().time;
+
+  glGenQueries(BENCHMARK_TIMER_QUERIES, bench->timerQueries);
+  for (int i = 0; i < BENCHMARK_TIMER_QUERIES; i++)
+    bench->timerFrame[i] = -1;
+
+  size_t expected = (size_t) (bench->duration * 120.0) + 16;
+  bench->cpuMs.reserve(expected);
+  bench->gpuMs.reserve(expected);
+  return true;
+}
+
+void destroyBenchmark(Benchmark *bench) {
+  if (bench->timerQueries[0])
+    glDeleteQueries(BENCHMARK_TIMER_QUERIES, bench->timerQueries);
+  *bench = Benchmark();
+}
+
+// Result of the query slot, blocking only if wait is set
+static void collectTimer(Benchmark *bench, int slot, bool wait) {
+  if (bench->timerFrame[slot] < 0)
+    return;
+
+  GLint available = 0;
+  if (!wait) {
+    glGetQueryObjectiv(bench->timerQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      return;
+  }
+
+  GLuint64 elapsed = 0;
+  glGetQueryObjectui64v(bench->timerQueries[slot], GL_QUERY_RESULT, &elapsed);
+  // Same index as the frame's CPU sample
+  int frame = bench->timerFrame[slot] - bench->config.warmupFrames - 1;
+  if (frame >= 0) {
+    if ((size_t) frame >= bench->gpuMs.size())
+      bench->gpuMs.resize(frame + 1, 0.0);
+    bench->gpuMs[frame] = (double) elapsed / 1.0e6;
+  }
+  bench->timerFrame[slot] = -1;
+}
+
+void beginBenchmarkFrame(Benchmark *bench) {
+  int slot = bench->currentQuery;
+  // Oldest query of the ring: normally done by now, otherwise wait
+  collectTimer(bench, slot, true);
+
+  glBeginQuery(GL_TIME_ELAPSED, bench->timerQueries[slot]);
+  bench->timerFrame[slot] = bench->frames;
+}
+
+bool endBenchmarkFrame(Benchmark *bench, const FramePacket &frame) {
+  glEndQuery(GL_TIME_ELAPSED);
+  bench->currentQuery = (bench->currentQuery + 1) % BENCHMARK_TIMER_QUERIES;
+
+  for (int i = 0; i < BENCHMARK_TIMER_QUERIES; i++)
+    collectTimer(bench, i, false);
+
+  // CPU time: from the previous frame's end to this one
+  if (bench->lastWallTime >= 0.0 && bench->frames > bench->config.warmupFrames)
+    bench->cpuMs.push_back((frame.time - bench->lastWallTime) * 1000.0);
+  bench->lastWallTime = frame.time;
+  bench->frames++;
+
+  return frame.simTime >= bench->duration;
+}
+
+struct Distribution {
+  double min, avg, p50, p95, p99, max;
+};
+
+static Distribution distribution(std::vector<double> samples) {
+  Distribution d = { 0, 0, 0, 0, 0, 0 };
+  if (samples.empty())
+    return d;
+
+  std::sort(samples.begin(), samples.end());
+  size_t n = samples.size();
+  double sum = 0.0;
+  for (size_t i = 0; i < n; i++)
+    sum += samples[i];
+
+  d.min = samples[0];
+  d.max = samples[n - 1];
+  d.avg = sum / (double) n;
+  d.p50 = samples[(n - 1) * 50 / 100];
+  d.p95 = samples[(n - 1) * 95 / 100];
+  d.p99 = samples[(n - 1) * 99 / 100];
+  return d;
+}
+
+static void printDistribution(const char *name, const std::vector<double> &samples) {
+  Distribution d = distribution(samples);
+  printf("%s frame time (ms): min %.3f  avg %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n",
+         name, d.min, d.avg, d.p50, d.p95, d.p99, d.max);
+
+  // Histogram between min and p99, everything slower in the last bucket
+  const int buckets = 10;
+  double width = (d.p99 - d.min) / buckets;
+  if (samples.empty() || width <= 0.0)
+    return;
+
+  int counts[buckets] = {};
+  for (size_t i = 0; i < samples.size(); i++) {
+    int b = (int) ((samples[i] - d.min) / width);
+    counts[b < buckets ? b : buckets - 1]++;
+  }
+  for (int b = 0; b < buckets; b++) {
+    int bar = (int) (50.0 * counts[b] / (double) samples.size());
+    printf("  %8.3f-%-8.3f %6d %.*s\n", d.min + b * width, d.min + (b + 1) * width,
+           counts[b], bar, "##################################################");
+  }
+}
+
+void reportBenchmark(Benchmark *bench) {
+  // Results still in flight
+  for (int i = 0; i < BENCHMARK_TIMER_QUERIES; i++)
+    collectTimer(bench, i, true);
+  if (bench->gpuMs.size() > bench->cpuMs.size())
+    bench->gpuMs.resize(bench->cpuMs.size());
+
+  printf("Benchmark: %d objects, %d textures, %.1f s camera path, %zu frames (%d warm-up frames skipped)\n",
+         bench->config.objects, bench->config.textures, bench->duration,
+         bench->cpuMs.size(), bench->config.warmupFrames);
+  printDistribution("CPU", bench->cpuMs);
+  printDistribution("GPU", bench->gpuMs);
+
+  if (!bench->config.csvFile)
+    return;
+
+  FILE *csv = fopen(bench->config.csvFile, "w");
+  if (!csv) {
+    fprintf(stderr, "ERROR: could not write %s\n", bench->config.csvFile);
+    return;
+  }
+  fprintf(csv, "frame,cpu_ms,gpu_ms\n");
+  for (size_t i = 0; i < bench->cpuMs.size(); i++)
+    fprintf(csv, "%zu,%.4f,%.4f\n", i, bench->cpuMs[i],
+            i < bench->gpuMs.size() ? bench->gpuMs[i] : 0.0);
+  fclose(csv);
+  printf("Per-frame times written to %s\n", bench->config.csvFile);
+}
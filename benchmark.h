@@ -0,0 +1,89 @@
+// benchmark.h: generated benchmark scenes and camera flythrough harness
+//
+// --bench-objects N replaces the scene with N procedurally placed cubes and
+// tetrahedra using --bench-textures T generated textures, forces the
+// deterministic clock and flies the camera along a path (a text file of
+// keyframes or a built-in orbit sized to the scene). Every frame's CPU time
+// (frame to frame) and GPU time (GL_TIME_ELAPSED) is recorded, and when the
+// path ends the distributions are printed (and optionally written as CSV)
+// and the program exits. Same arguments, same frames: runs of different
+// features can be compared directly.
+//
+// Camera path files, one keyframe per line, '#' starts a comment:
+//   time  pos.x pos.y pos.z  target.x target.y target.z
+//////////////////////////////////////////////////////////////////////
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+
+struct CameraKey {
+  double time;
+  glm::vec3 position;
+  glm::vec3 target;
+};
+
+struct CameraPath {
+  std::vector<CameraKey> keys;   // sorted by time
+};
+
+bool loadCameraPath(const char *fileName, CameraPath *path);
+// Orbit that dives in and out of a scene of the given radius
+void defaultCameraPath(float sceneRadius, double duration, CameraPath *path);
+// Catmull-Rom through the keyframes, clamped at both ends
+void sampleCameraPath(const CameraPath &path, double time,
+                      glm::vec3 *position, glm::vec3 *target);
+
+struct BenchmarkConfig {
+  int objects = 0;               // 0: no benchmark
+  int textures = 4;
+  int warmupFrames = 30;         // not included in the statistics
+  double duration = 20.0;        // built-in path only
+  const char *cameraPathFile = NULL;
+  const char *csvFile = NULL;
+};
+
+// Fills objects (meshes [0, meshCount)) with maps[i % mapCount] as diffuse
+// maps and a shared specular map; returns the scene radius
+float generateBenchmarkScene(const BenchmarkConfig &config, int meshCount,
+                             const unsigned int *diffuseMaps, int mapCount,
+                             unsigned int specularMap, std::vector<SceneObject> *objects);
+
+// size x size RGB texture (malloc'd), different pattern and tint per index
+unsigned char *generateBenchmarkTexture(int index, int size);
+
+#define BENCHMARK_TIMER_QUERIES 4
+
+struct Benchmark {
+  BenchmarkConfig config;
+  CameraPath path;
+  double duration = 0.0;
+
+  std::vector<double> cpuMs, gpuMs;
+  double lastWallTime = -1.0;
+  int frames = 0;
+
+  GLuint timerQueries[BENCHMARK_TIMER_QUERIES] = {};
+  int timerFrame[BENCHMARK_TIMER_QUERIES];   // frame measured, -1 none
+  int currentQuery = 0;
+};
+
+// Camera path and timer queries; false if the path cannot be loaded
+bool createBenchmark(Benchmark *bench, const BenchmarkConfig &config, float sceneRadius);
+void destroyBenchmark(Benchmark *bench);
+
+// Bracket the GL work of one frame (render thread)
+void beginBenchmarkFrame(Benchmark *bench);
+// Records the frame; true once the camera path is over
+bool endBenchmarkFrame(Benchmark *bench, const FramePacket &frame);
+
+// Prints min / avg / percentiles / max and a histogram, writes the CSV
+void reportBenchmark(Benchmark *bench);
+
+#endif
@@ -0,0 +1,63 @@
+// camera.cpp: look-at cameras that only rebuild their matrices on change
+
+#include "camera.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+void initCamera(Camera *camera, const glm::vec3 &position, const glm::vec3 &target,
+                float fovy, float zNear, float zFar) {
+  camera->position = position;
+  camera->target = target;
+  camera->up = glm::vec3(0.0f, 1.0f, 0.0f);
+  camera->fovy = fovy;
+  camera->aspect = 1.0f;
+  camera->zNear = zNear;
+  camera->zFar = zFar;
+  camera->dirty = CAMERA_VIEW_DIRTY | CAMERA_PROJ_DIRTY;
+}
+
+void setCameraLookAt(Camera *camera, const glm::vec3 &position, const glm::vec3 &target) {
+  if (position == camera->position && target == camera->target)
+    return;
+  camera->position = position;
+  camera->target = target;
+  camera->dirty |= CAMERA_VIEW_DIRTY;
+}
+
+void setCameraAspect(Camera *camera, float aspect) {
+  if (aspect == camera->aspect)
+    return;
+  camera->aspect = aspect;
+  camera->dirty |= CAMERA_PROJ_DIRTY;
+}
+
+void setCameraPerspective(Camera *camera, float fovy, float zNear, float zFar) {
+  if (fovy == camera->fovy && zNear == camera->zNear && zFar == camera->zFar)
+    return;
+  camera->fovy = fovy;
+  camera->zNear = zNear;
+  camera->zFar = zFar;
+  camera->dirty |= CAMERA_PROJ_DIRTY;
+}
+
+bool updateCamera(Camera *camera, CameraStats *stats) {
+  stats->updates++;
+  if (!camera->dirty)
+    return false;
+
+  if (camera->dirty & CAMERA_VIEW_DIRTY) {
+    camera->view = glm::lookAt(camera->position, camera->target, camera->up);
+    stats->views++;
+  }
+  if (camera->dirty & CAMERA_PROJ_DIRTY) {
+    camera->proj = glm::perspective(glm::radians(camera->fovy), camera->aspect,
+                                    camera->zNear, camera->zFar);
+    stats->projections++;
+  }
+  camera->viewProj = camera->proj * camera->view;
+  camera->frustum = extractFrustum(camera->viewProj);
+  stats->frustums++;
+
+  camera->dirty = 0;
+  return true;
+}
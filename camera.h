@@ -0,0 +1,53 @@
+// camera.h: look-at cameras that only rebuild their matrices on change
+//
+// A camera keeps its view, projection, view-projection and frustum planes.
+// Moving it (new position or target) marks the view dirty. A new aspect
+// ratio, field of view or clip range marks the projection dirty. The
+// setters compare against the current values, so calling them every frame
+// with the same ones is free. updateCamera() rebuilds what is dirty, and
+// viewProj and the frustum after either. A camera that doesn't move costs
+// nothing per frame until the window is resized.
+//
+// CameraStats counts the rebuilds, to check that.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+
+#include "scene.h"
+
+#define CAMERA_VIEW_DIRTY 1
+#define CAMERA_PROJ_DIRTY 2
+
+struct Camera {
+  glm::vec3 position, target, up;
+  float fovy;                     // degrees
+  float aspect, zNear, zFar;
+  unsigned int dirty;
+
+  glm::mat4 view, proj, viewProj;
+  Frustum frustum;
+};
+
+// Matrices rebuilt, accumulated until reset (may be read on another thread)
+struct CameraStats {
+  std::atomic<unsigned long long> updates{0};   // updateCamera() calls
+  std::atomic<unsigned long long> views{0}, projections{0}, frustums{0};
+};
+
+// Aspect ratio 1 until set; everything is dirty
+void initCamera(Camera *camera, const glm::vec3 &position, const glm::vec3 &target,
+                float fovy, float zNear, float zFar);
+
+void setCameraLookAt(Camera *camera, const glm::vec3 &position, const glm::vec3 &target);
+void setCameraAspect(Camera *camera, float aspect);
+void setCameraPerspective(Camera *camera, float fovy, float zNear, float zFar);
+
+// Rebuilds whatever is dirty; returns whether anything was
+bool updateCamera(Camera *camera, CameraStats *stats);
+
+#endif
@@ -0,0 +1,36 @@
+// capture.cpp: framebuffer captures for golden-frame regression checks
+
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gl_state.h"
+
+bool captureFramebuffer(const char *fileName, int width, int height) {
+  size_t rowSize = (size_t) width * 3;
+  unsigned char *pixels = (unsigned char *) malloc(rowSize * height);
+  if (!pixels)
+    return false;
+
+  glsBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+  glReadBuffer(GL_BACK);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+
+  FILE *file = fopen(fileName, "wb");
+  if (!file) {
+    fprintf(stderr, "ERROR: could not write capture %s\n", fileName);
+    free(pixels);
+    return false;
+  }
+
+  // GL rows go bottom-up, PPM rows top-down
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  for (int y = height - 1; y >= 0; y--)
+    fwrite(pixels + rowSize * y, 1, rowSize, file);
+
+  fclose(file);
+  free(pixels);
+  return true;
+}
@@ -0,0 +1,18 @@
+// capture.h: framebuffer captures for golden-frame regression checks
+//
+// --capture FILE renders with the deterministic clock until --capture-time T
+// (animation seconds), writes the back buffer of that frame as a binary PPM
+// and exits. The window is hidden and fixed at 640x480, so the same build and
+// driver always produce the same image; tools/imgdiff compares it against a
+// stored golden frame.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <GL/glew.h>
+
+// Reads the back buffer of the default framebuffer (GL thread), top row first
+bool captureFramebuffer(const char *fileName, int width, int height);
+
+#endif
@@ -0,0 +1,43 @@
+#version 130
+
+struct Material {
+  sampler2D diffuse;
+  sampler2D specular;
+  float shininess;
+};
+
+// G-buffer targets (see gbuffer.h)
+out vec4 g_position;
+out vec4 g_normal;
+out vec4 g_albedo;
+out vec4 g_specular;
+
+in vec3 frag_3Dpos;
+in vec3 vs_normal;
+in vec2 vs_tex_coord;
+
+uniform Material material;
+
+#ifdef MATERIAL_ARRAY
+// Multi-draw: maps from the material table (see spinningcube_withlight_fs.glsl)
+uniform sampler2DArray material_maps;
+flat in ivec2 vs_material_layers;
+flat in float vs_shininess;
+
+vec3 sampleMap(int layer) {
+  return layer < 0 ? vec3(0.0) : vec3(texture(material_maps, vec3(vs_tex_coord, float(layer))));
+}
+#endif
+
+void main() {
+  g_position = vec4(frag_3Dpos, 1.0);
+#ifdef MATERIAL_ARRAY
+  g_normal = vec4(vs_normal, vs_shininess);
+  g_albedo = vec4(sampleMap(vs_material_layers.x), 1.0);
+  g_specular = vec4(sampleMap(vs_material_layers.y), 1.0);
+#else
+  g_normal = vec4(vs_normal, material.shininess);
+  g_albedo = vec4(vec3(texture(material.diffuse, vs_tex_coord)), 1.0);
+  g_specular = vec4(vec3(texture(material.specular, vs_tex_coord)), 1.0);
+#endif
+}
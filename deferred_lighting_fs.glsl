@@ -0,0 +1,100 @@
+#version 130
+
+struct Light {
+  vec3 position;
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+out vec4 frag_col;
+
+// G-buffer targets (see gbuffer.h)
+uniform sampler2D g_position;
+uniform sampler2D g_normal;
+uniform sampler2D g_albedo;
+uniform sampler2D g_specular;
+
+// All lights, one row per light (position, ambient, diffuse, specular)
+uniform sampler2D light_data;
+uniform int light_count;
+uniform vec3 view_pos;
+
+Light fetchLight(int i) {
+  Light l;
+  l.position = texelFetch(light_data, ivec2(0, i), 0).rgb;
+  l.ambient = texelFetch(light_data, ivec2(1, i), 0).rgb;
+  l.diffuse = texelFetch(light_data, ivec2(2, i), 0).rgb;
+  l.specular = texelFetch(light_data, ivec2(3, i), 0).rgb;
+  return l;
+}
+
+// Omnidirectional shadows (shadow_atlas.h): a row of six cube face tiles per
+// shadowed light, storing distance to the light / that light's range
+#define SHADOW_MAX_LIGHTS 4
+uniform int shadow_light_count;
+uniform sampler2D shadow_atlas;
+uniform mat4 shadow_matrices[SHADOW_MAX_LIGHTS * 6];
+uniform float shadow_ranges[SHADOW_MAX_LIGHTS];
+uniform float shadow_tile_size;
+
+float shadowFactor(int i, vec3 pos, vec3 light_pos) {
+  if (i >= shadow_light_count)
+    return 1.0;
+
+  // Cube face from the major axis, same order as the atlas tiles
+  vec3 d = pos - light_pos;
+  vec3 a = abs(d);
+  int face;
+  if (a.x >= a.y && a.x >= a.z)
+    face = d.x > 0.0 ? 0 : 1;
+  else if (a.y >= a.z)
+    face = d.y > 0.0 ? 2 : 3;
+  else
+    face = d.z > 0.0 ? 4 : 5;
+
+  vec4 clip = shadow_matrices[i * 6 + face] * vec4(pos, 1.0);
+  float border = 0.5 / shadow_tile_size;
+  vec2 uv = clamp(clip.xy / clip.w * 0.5 + 0.5, border, 1.0 - border);
+  vec2 atlas_uv = (vec2(face, i) + uv) / vec2(6.0, shadow_light_count);
+
+  float closest = texture(shadow_atlas, atlas_uv).r;
+  float current = length(d) / shadow_ranges[i];
+  return current - 0.01 > closest ? 0.0 : 1.0;
+}
+
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+
+  // Nothing was drawn here: keep the clear colour
+  vec4 albedo = texelFetch(g_albedo, texel, 0);
+  if (albedo.a == 0.0)
+    discard;
+
+  vec3 frag_3Dpos = texelFetch(g_position, texel, 0).xyz;
+  vec4 normal_shininess = texelFetch(g_normal, texel, 0);
+  vec3 normal = normal_shininess.xyz;
+  float shininess = normal_shininess.w;
+  vec3 diffuse_col = albedo.rgb;
+  vec3 specular_col = texelFetch(g_specular, texel, 0).rgb;
+
+  vec3 view_dir = normalize(view_pos - frag_3Dpos);
+
+  // Same Phong model as spinningcube_withlight_fs.glsl, once per pixel
+  vec3 result = vec3(0.0);
+  for (int i = 0; i < light_count; i++) {
+    Light l = fetchLight(i);
+
+    vec3 light_dir = normalize(l.position - frag_3Dpos);
+    float diff = max(dot(normal, light_dir), 0.0);
+    vec3 reflect_dir = reflect(-light_dir, normal);
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), shininess);
+    float shadow = shadowFactor(i, frag_3Dpos, l.position);
+
+    result += l.ambient * diffuse_col +
+              shadow * (l.diffuse * diff * diffuse_col +
+                        l.specular * (spec * specular_col));
+  }
+
+  frag_col = vec4(result, 1.0);
+}
@@ -0,0 +1,8 @@
+#version 130
+
+// Full-screen triangle, no vertex buffer needed:
+// vertex 0 -> (-1,-1), 1 -> (3,-1), 2 -> (-1,3)
+void main() {
+  vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,5 @@
+#version 130
+
+// Depth only: colour writes are masked off during the prepass
+void main() {
+}
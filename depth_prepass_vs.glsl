@@ -0,0 +1,15 @@
+#version 130
+
+in vec3 v_pos;
+
+// Must match spinningcube_withlight_vs.glsl bit for bit so the shading
+// pass can depth test with GL_LEQUAL against this pass
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+  gl_Position = projection * view * model * vec4(v_pos, 1.0f);
+}
@@ -0,0 +1,100 @@
+// frame_arena.cpp: per-frame bump allocators for transient CPU render data
+
+#include "frame_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+static std::atomic<unsigned long long> heapAllocationCount(0);
+
+// Counting replacements of the global allocation functions; the array and
+// nothrow forms end up here too
+void *operator new(size_t size) {
+  heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+unsigned long long heapAllocations() {
+  return heapAllocationCount.load(std::memory_order_relaxed);
+}
+
+void *arenaAlloc(Arena *arena, size_t size, size_t alignment) {
+  uintptr_t base = (uintptr_t) arena->base;
+  size_t offset = ((base + arena->used + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base;
+
+  if (arena->base && offset + size <= arena->capacity) {
+    arena->used = offset + size;
+    if (arena->used > arena->peak)
+      arena->peak = arena->used;
+    return arena->base + offset;
+  }
+
+  // Full: this frame goes to the heap, the next reset grows the arena
+  arena->overflows++;
+  arena->peak += size + alignment;
+  void *block = ::operator new(size + alignment);
+  arena->overflow.push_back(block);
+  return (void *) (((uintptr_t) block + alignment - 1) & ~(uintptr_t) (alignment - 1));
+}
+
+void resetArena(Arena *arena) {
+  for (size_t i = 0; i < arena->overflow.size(); i++)
+    ::operator delete(arena->overflow[i]);
+  arena->overflow.clear();
+
+  if (arena->overflows > 0) {
+    size_t capacity = arena->capacity * 2;
+    if (capacity < arena->peak)
+      capacity = arena->peak;
+    free(arena->base);
+    arena->base = (unsigned char *) malloc(capacity);
+    arena->capacity = arena->base ? capacity : 0;
+    arena->overflows = 0;
+  }
+
+  arena->used = 0;
+  arena->peak = 0;
+}
+
+void destroyArena(Arena *arena) {
+  resetArena(arena);
+  free(arena->base);
+  arena->base = NULL;
+  arena->capacity = 0;
+}
+
+void initFrameArena(FrameArena *frameArena, size_t capacity) {
+  for (int i = 0; i < 2; i++) {
+    destroyArena(&frameArena->arenas[i]);
+    frameArena->arenas[i].base = (unsigned char *) malloc(capacity);
+    frameArena->arenas[i].capacity = frameArena->arenas[i].base ? capacity : 0;
+  }
+  frameArena->current = 0;
+}
+
+Arena *beginFrameArena(FrameArena *frameArena) {
+  frameArena->current ^= 1;
+  Arena *arena = &frameArena->arenas[frameArena->current];
+  if (arena->peak > frameArena->highWater)
+    frameArena->highWater = arena->peak;
+  resetArena(arena);
+  return arena;
+}
+
+void destroyFrameArena(FrameArena *frameArena) {
+  for (int i = 0; i < 2; i++)
+    destroyArena(&frameArena->arenas[i]);
+}
@@ -0,0 +1,86 @@
+// frame_arena.h: per-frame bump allocators for transient CPU render data
+//
+// Draw lists and scratch arrays of a frame are carved out of an arena that
+// is reset as a whole, so once the arenas have grown to the scene the frame
+// loop stops touching the heap. Two arenas alternate: what frame N
+// allocates stays valid through frame N+1 (for pipelined consumers) and is
+// recycled when frame N+2 begins.
+//
+// ArenaAllocator<T> puts STL containers in an arena (deallocate is a no-op,
+// memory comes back on reset); a default constructed one uses the heap.
+// heapAllocations() counts global operator new calls to check the claim.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <stddef.h>
+
+#include <new>
+#include <type_traits>
+#include <vector>
+
+struct Arena {
+  unsigned char *base = NULL;
+  size_t capacity = 0;
+  size_t used = 0;
+  size_t peak = 0;                  // including overflow, since the last reset
+  std::vector<void *> overflow;     // heap blocks taken while full
+  unsigned int overflows = 0;
+};
+
+// alignment: a power of two. Never fails: falls back to the heap when full
+void *arenaAlloc(Arena *arena, size_t size, size_t alignment);
+// Frees everything; an arena that overflowed grows to fit the next frame
+void resetArena(Arena *arena);
+void destroyArena(Arena *arena);
+
+struct FrameArena {
+  Arena arenas[2];
+  int current = 0;
+  size_t highWater = 0;             // largest frame so far, in bytes
+};
+
+void initFrameArena(FrameArena *frameArena, size_t capacity);
+// Switches to the other arena, resets it and returns it
+Arena *beginFrameArena(FrameArena *frameArena);
+void destroyFrameArena(FrameArena *frameArena);
+
+template <typename T>
+struct ArenaAllocator {
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  Arena *arena;
+
+  ArenaAllocator() : arena(NULL) {}
+  explicit ArenaAllocator(Arena *arena) : arena(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    if (!arena)
+      return (T *) ::operator new(n * sizeof(T));
+    return (T *) arenaAlloc(arena, n * sizeof(T), alignof(T));
+  }
+
+  void deallocate(T *p, size_t) {
+    if (!arena)
+      ::operator delete(p);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Global operator new calls so far, from every thread
+unsigned long long heapAllocations();
+
+#endif
@@ -0,0 +1,79 @@
+// frame_clock.cpp: fixed-timestep animation clock and frame pacing
+
+#include "frame_clock.h"
+
+#include <math.h>
+
+#include <chrono>
+#include <thread>
+
+// Longer gaps (debugger, window dragged) are not caught up with
+#define MAX_FRAME_ELAPSED 0.25
+
+double advanceClock(SimClock *clock, double wallTime) {
+  double elapsed = clock->lastWallTime < 0.0 ? 0.0 : wallTime - clock->lastWallTime;
+  clock->lastWallTime = wallTime;
+  if (elapsed > MAX_FRAME_ELAPSED)
+    elapsed = MAX_FRAME_ELAPSED;
+  if (elapsed < 0.0)
+    elapsed = 0.0;
+
+  if (clock->paused) {
+    // Single steps land on whole ticks; the pending fraction is dropped, so
+    // resuming doesn't replay it either
+    clock->ticks += (unsigned long long) clock->stepRequests.exchange(0);
+    clock->accumulator = 0.0;
+    clock->alpha = 0.0;
+  } else if (clock->deterministic) {
+    clock->ticks++;
+    clock->alpha = 0.0;
+  } else {
+    clock->accumulator += elapsed * clock->speed;
+    unsigned long long steps = (unsigned long long) floor(clock->accumulator / clock->step);
+    clock->accumulator -= (double) steps * clock->step;
+
+    if (steps > clock->maxSteps) {
+      clock->droppedSteps += steps - clock->maxSteps;
+      steps = clock->maxSteps;
+    }
+    clock->ticks += steps;
+    clock->alpha = clock->accumulator / clock->step;
+  }
+
+  return ((double) clock->ticks + clock->alpha) * clock->step;
+}
+
+static double seconds() {
+  using namespace std::chrono;
+  return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void paceFrame(FramePacer *pacer) {
+  if (pacer->interval <= 0.0)
+    return;
+
+  double now = seconds();
+  if (pacer->deadline <= 0.0)
+    pacer->deadline = now;
+  pacer->deadline += pacer->interval;
+
+  // Late frame: start counting from here rather than rushing the next ones
+  if (now >= pacer->deadline) {
+    pacer->lateFrames++;
+    pacer->deadline = now;
+    return;
+  }
+
+  double sleepTime = pacer->deadline - now - pacer->oversleep;
+  if (sleepTime > 0.0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(sleepTime));
+
+    double overshoot = seconds() - (now + sleepTime);
+    if (overshoot < 0.0)
+      overshoot = 0.0;
+    pacer->oversleep = 0.9 * pacer->oversleep + 0.1 * overshoot;
+  }
+
+  while (seconds() < pacer->deadline)
+    std::this_thread::yield();
+}
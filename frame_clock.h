@@ -0,0 +1,54 @@
+// frame_clock.h: fixed-timestep animation clock and frame pacing
+//
+// SimClock turns wall time into simulation time advanced in fixed steps:
+// the time a frame is rendered at is ticks * step plus the fraction of a
+// step still pending (alpha), i.e. the interpolation between the last two
+// steps. Scene motion is an analytic function of time, so evaluating it at
+// that interpolated time is exact.
+// Pause, single step and speed can be changed from any thread; the rest
+// belongs to the thread calling advanceClock (the simulation).
+// Deterministic mode ignores wall time altogether: every frame advances
+// exactly one step, so benchmarks and captures see the same frames.
+//
+// FramePacer caps the frame rate when vsync is off: it sleeps until just
+// before the deadline, learning how much the OS oversleeps, and only
+// yields for the last fraction of a millisecond instead of spinning.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_CLOCK_H
+#define FRAME_CLOCK_H
+
+#include <atomic>
+
+struct SimClock {
+  double step = 1.0 / 120.0;        // fixed simulation step, seconds
+  bool deterministic = false;       // one step per frame
+  unsigned int maxSteps = 8;        // per frame; slower frames drop time
+
+  // Controls, any thread
+  std::atomic<bool> paused{false};
+  std::atomic<int> stepRequests{0}; // steps to run while paused
+  std::atomic<double> speed{1.0};   // ignored in deterministic mode
+
+  // Simulation thread
+  double lastWallTime = -1.0;
+  double accumulator = 0.0;
+  unsigned long long ticks = 0;
+  double alpha = 0.0;               // pending fraction of a step, [0, 1)
+  std::atomic<unsigned long long> droppedSteps{0};   // read by the stats
+};
+
+// Advances the clock to wallTime, returns the simulation time to render
+double advanceClock(SimClock *clock, double wallTime);
+
+struct FramePacer {
+  double interval = 0.0;            // seconds per frame, 0: not paced
+  double deadline = 0.0;
+  double oversleep = 0.001;         // learned sleep overshoot, seconds
+  unsigned long long lateFrames = 0;
+};
+
+// Blocks until the next frame is due (call right before swapping)
+void paceFrame(FramePacer *pacer);
+
+#endif
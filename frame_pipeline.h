@@ -0,0 +1,70 @@
+// frame_pipeline.h: triple buffer to hand frame packets between threads
+//
+// The producer (simulation) always owns one slot and the consumer (GL
+// submission) another; publish() and acquire() only swap indices with the
+// third, "ready" slot, so packets are never copied and neither side ever
+// waits for the other to finish reading or writing a packet.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+template <typename T>
+class TripleBuffer {
+public:
+  // Producer side
+  T &writeBuffer() { return buffers[writeIndex]; }
+
+  void publish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::swap(writeIndex, readyIndex);
+    fresh = true;
+    changed.notify_all();
+  }
+
+  // Blocks until the last published packet was acquired, so the producer
+  // runs at most one frame ahead of the consumer. False when stopped
+  bool waitUntilConsumed(const std::atomic<bool> &running) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return !fresh || !running; });
+    return running;
+  }
+
+  // Consumer side: blocks until a new packet is ready. False when stopped
+  bool waitAndAcquire(const std::atomic<bool> &running) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return fresh || !running; });
+    if (!fresh)
+      return false;
+
+    std::swap(readIndex, readyIndex);
+    fresh = false;
+    changed.notify_all();
+    return true;
+  }
+
+  const T &readBuffer() const { return buffers[readIndex]; }
+
+  // Wakes both sides up after running was cleared
+  void wake() {
+    std::lock_guard<std::mutex> lock(mutex);
+    changed.notify_all();
+  }
+
+private:
+  T buffers[3];
+  int writeIndex = 0;
+  int readyIndex = 1;
+  int readIndex = 2;
+  bool fresh = false;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+};
+
+#endif
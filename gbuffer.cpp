@@ -0,0 +1,79 @@
+// gbuffer.cpp: G-buffer for the deferred shading path
+
+#include "gbuffer.h"
+#include "gl_state.h"
+
+#include <stdio.h>
+
+static GLuint createTarget(GLenum internalFormat, GLenum format, GLenum type,
+                           int width, int height) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glsBindTexture(0, GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+
+  // One texel per pixel: no filtering, no mipmaps
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  return texture;
+}
+
+bool createGBuffer(GBuffer *gbuffer, int width, int height) {
+  destroyGBuffer(gbuffer);
+
+  gbuffer->width = width;
+  gbuffer->height = height;
+
+  glGenFramebuffers(1, &gbuffer->fbo);
+  glsBindFramebuffer(GL_FRAMEBUFFER, gbuffer->fbo);
+
+  gbuffer->textures[GBUFFER_POSITION] = createTarget(GL_RGBA16F, GL_RGBA, GL_FLOAT, width, height);
+  gbuffer->textures[GBUFFER_NORMAL] = createTarget(GL_RGBA16F, GL_RGBA, GL_FLOAT, width, height);
+  gbuffer->textures[GBUFFER_ALBEDO] = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+  gbuffer->textures[GBUFFER_SPECULAR] = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+
+  GLenum drawBuffers[GBUFFER_TARGETS];
+  for (int i = 0; i < GBUFFER_TARGETS; i++) {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                           GL_TEXTURE_2D, gbuffer->textures[i], 0);
+    drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+  }
+  glDrawBuffers(GBUFFER_TARGETS, drawBuffers);
+
+  glGenRenderbuffers(1, &gbuffer->depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, gbuffer->depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gbuffer->depth);
+
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  glsBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glsBindTexture(0, GL_TEXTURE_2D, 0);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "ERROR: G-buffer framebuffer incomplete (0x%x)\n", status);
+    return false;
+  }
+
+  return true;
+}
+
+void destroyGBuffer(GBuffer *gbuffer) {
+  if (gbuffer->fbo)
+    glsDeleteFramebuffers(1, &gbuffer->fbo);
+  if (gbuffer->textures[0])
+    glsDeleteTextures(GBUFFER_TARGETS, gbuffer->textures);
+  if (gbuffer->depth)
+    glDeleteRenderbuffers(1, &gbuffer->depth);
+
+  *gbuffer = GBuffer();
+}
+
+void bindGBufferTextures(const GBuffer *gbuffer, int firstUnit) {
+  for (int i = 0; i < GBUFFER_TARGETS; i++) {
+    glsBindTexture(firstUnit + i, GL_TEXTURE_2D, gbuffer->textures[i]);
+  }
+}
@@ -0,0 +1,37 @@
+// gbuffer.h: G-buffer for the deferred shading path
+//
+// Geometry pass writes one texel per visible pixel into four colour
+// attachments, the lighting pass then evaluates Phong once per pixel:
+//   0: position  (RGBA16F) world space position
+//   1: normal    (RGBA16F) world space normal, w = material shininess
+//   2: albedo    (RGBA8)   diffuse map, a = 1 where geometry was drawn
+//   3: specular  (RGBA8)   specular map
+//////////////////////////////////////////////////////////////////////
+
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <GL/glew.h>
+
+#define GBUFFER_POSITION 0
+#define GBUFFER_NORMAL   1
+#define GBUFFER_ALBEDO   2
+#define GBUFFER_SPECULAR 3
+#define GBUFFER_TARGETS  4
+
+struct GBuffer {
+  GLuint fbo = 0;
+  GLuint textures[GBUFFER_TARGETS] = {};
+  GLuint depth = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// Creates (or recreates at a new size) the G-buffer; false if incomplete
+bool createGBuffer(GBuffer *gbuffer, int width, int height);
+void destroyGBuffer(GBuffer *gbuffer);
+
+// Binds the G-buffer textures to units [firstUnit, firstUnit + 4)
+void bindGBufferTextures(const GBuffer *gbuffer, int firstUnit);
+
+#endif
@@ -0,0 +1,320 @@
+// gl_state.cpp: cache of the GL binding and uniform state
+
+#include "gl_state.h"
+
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+#define GLS_MAX_TEXTURE_UNITS 32
+#define GLS_UNKNOWN 0xFFFFFFFFu
+
+enum { TARGET_2D, TARGET_2D_ARRAY, TARGET_CUBE_MAP, TARGET_BUFFER, TARGET_OTHER, TARGET_COUNT };
+enum { CAP_DEPTH_TEST, CAP_SCISSOR_TEST, CAP_CULL_FACE, CAP_BLEND, CAP_COUNT };
+
+// Last value uploaded to one uniform location, compared byte for byte
+struct UniformSlot {
+  std::vector<unsigned char> value;
+  bool known = false;
+};
+
+struct ProgramUniforms {
+  std::vector<UniformSlot> slots; // indexed by location
+};
+
+static struct {
+  GLuint program;
+  GLuint vao;
+  GLuint arrayBuffer;
+  GLuint drawFramebuffer, readFramebuffer;
+  GLuint activeUnit;
+  GLuint textures[GLS_MAX_TEXTURE_UNITS][TARGET_COUNT];
+  int caps[CAP_COUNT];        // -1 unknown, 0 disabled, 1 enabled
+  GLenum depthFunc;
+  int depthMask;
+  int colorMask;
+} state;
+
+static std::unordered_map<GLuint, ProgramUniforms> uniforms;
+static ProgramUniforms *currentUniforms = NULL;
+static GlStateStats stats;
+
+static int targetIndex(GLenum target) {
+  switch (target) {
+    case GL_TEXTURE_2D: return TARGET_2D;
+    case GL_TEXTURE_2D_ARRAY: return TARGET_2D_ARRAY;
+    case GL_TEXTURE_CUBE_MAP: return TARGET_CUBE_MAP;
+    case GL_TEXTURE_BUFFER: return TARGET_BUFFER;
+    default: return TARGET_OTHER;
+  }
+}
+
+static int capIndex(GLenum cap) {
+  switch (cap) {
+    case GL_DEPTH_TEST: return CAP_DEPTH_TEST;
+    case GL_SCISSOR_TEST: return CAP_SCISSOR_TEST;
+    case GL_CULL_FACE: return CAP_CULL_FACE;
+    case GL_BLEND: return CAP_BLEND;
+    default: return -1;
+  }
+}
+
+void glsInvalidate() {
+  state.program = GLS_UNKNOWN;
+  state.vao = GLS_UNKNOWN;
+  state.arrayBuffer = GLS_UNKNOWN;
+  state.drawFramebuffer = state.readFramebuffer = GLS_UNKNOWN;
+  state.activeUnit = GLS_UNKNOWN;
+  for (int u = 0; u < GLS_MAX_TEXTURE_UNITS; u++)
+    for (int t = 0; t < TARGET_COUNT; t++)
+      state.textures[u][t] = GLS_UNKNOWN;
+  for (int c = 0; c < CAP_COUNT; c++)
+    state.caps[c] = -1;
+  state.depthFunc = GLS_UNKNOWN;
+  state.depthMask = -1;
+  state.colorMask = -1;
+
+  uniforms.clear();
+  currentUniforms = NULL;
+}
+
+// Everything starts unknown
+static struct GlsInit { GlsInit() { glsInvalidate(); } } glsInit;
+
+void glsUseProgram(GLuint program) {
+  if (state.program == program) {
+    stats.bindHits++;
+    return;
+  }
+  glUseProgram(program);
+  state.program = program;
+  currentUniforms = &uniforms[program];
+  stats.bindMisses++;
+}
+
+void glsBindVertexArray(GLuint vao) {
+  if (state.vao == vao) {
+    stats.bindHits++;
+    return;
+  }
+  glBindVertexArray(vao);
+  state.vao = vao;
+  stats.bindMisses++;
+}
+
+void glsBindBuffer(GLenum target, GLuint buffer) {
+  // Only GL_ARRAY_BUFFER is context state; the element array buffer belongs
+  // to the VAO and other targets are rare enough to always go through
+  if (target == GL_ARRAY_BUFFER) {
+    if (state.arrayBuffer == buffer) {
+      stats.bindHits++;
+      return;
+    }
+    state.arrayBuffer = buffer;
+  }
+  glBindBuffer(target, buffer);
+  stats.bindMisses++;
+}
+
+void glsBindFramebuffer(GLenum target, GLuint fbo) {
+  bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+  bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+
+  if ((!draw || state.drawFramebuffer == fbo) && (!read || state.readFramebuffer == fbo)) {
+    stats.bindHits++;
+    return;
+  }
+  glBindFramebuffer(target, fbo);
+  if (draw)
+    state.drawFramebuffer = fbo;
+  if (read)
+    state.readFramebuffer = fbo;
+  stats.bindMisses++;
+}
+
+void glsBindTexture(GLuint unit, GLenum target, GLuint texture) {
+  int t = targetIndex(target);
+  bool tracked = unit < GLS_MAX_TEXTURE_UNITS && t != TARGET_OTHER;
+
+  if (tracked && state.textures[unit][t] == texture) {
+    stats.bindHits++;
+    return;
+  }
+
+  if (state.activeUnit != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    state.activeUnit = unit;
+  }
+  glBindTexture(target, texture);
+  if (tracked)
+    state.textures[unit][t] = texture;
+  stats.bindMisses++;
+}
+
+void glsDeleteProgram(GLuint program) {
+  if (program == 0)
+    return;
+  // Still in use until another program is, but its uniforms are gone
+  if (state.program == program) {
+    state.program = GLS_UNKNOWN;
+    currentUniforms = NULL;
+  }
+  uniforms.erase(program);
+  glDeleteProgram(program);
+}
+
+void glsDeleteVertexArrays(GLsizei n, const GLuint *vaos) {
+  for (GLsizei i = 0; i < n; i++)
+    if (vaos[i] != 0 && state.vao == vaos[i])
+      state.vao = 0;
+  glDeleteVertexArrays(n, vaos);
+}
+
+void glsDeleteBuffers(GLsizei n, const GLuint *buffers) {
+  for (GLsizei i = 0; i < n; i++)
+    if (buffers[i] != 0 && state.arrayBuffer == buffers[i])
+      state.arrayBuffer = 0;
+  glDeleteBuffers(n, buffers);
+}
+
+void glsDeleteFramebuffers(GLsizei n, const GLuint *fbos) {
+  for (GLsizei i = 0; i < n; i++) {
+    if (fbos[i] == 0)
+      continue;
+    if (state.drawFramebuffer == fbos[i])
+      state.drawFramebuffer = 0;
+    if (state.readFramebuffer == fbos[i])
+      state.readFramebuffer = 0;
+  }
+  glDeleteFramebuffers(n, fbos);
+}
+
+void glsDeleteTextures(GLsizei n, const GLuint *textures) {
+  for (GLsizei i = 0; i < n; i++) {
+    if (textures[i] == 0)
+      continue;
+    for (int u = 0; u < GLS_MAX_TEXTURE_UNITS; u++)
+      for (int t = 0; t < TARGET_COUNT; t++)
+        if (state.textures[u][t] == textures[i])
+          state.textures[u][t] = 0;
+  }
+  glDeleteTextures(n, textures);
+}
+
+static void setCap(GLenum cap, int enabled) {
+  int c = capIndex(cap);
+  if (c >= 0 && state.caps[c] == enabled) {
+    stats.stateHits++;
+    return;
+  }
+  if (enabled)
+    glEnable(cap);
+  else
+    glDisable(cap);
+  if (c >= 0)
+    state.caps[c] = enabled;
+  stats.stateMisses++;
+}
+
+void glsEnable(GLenum cap) { setCap(cap, 1); }
+void glsDisable(GLenum cap) { setCap(cap, 0); }
+
+void glsDepthFunc(GLenum func) {
+  if (state.depthFunc == func) {
+    stats.stateHits++;
+    return;
+  }
+  glDepthFunc(func);
+  state.depthFunc = func;
+  stats.stateMisses++;
+}
+
+void glsDepthMask(GLboolean flag) {
+  if (state.depthMask == (int) flag) {
+    stats.stateHits++;
+    return;
+  }
+  glDepthMask(flag);
+  state.depthMask = flag;
+  stats.stateMisses++;
+}
+
+void glsColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a) {
+  int mask = (r ? 1 : 0) | (g ? 2 : 0) | (b ? 4 : 0) | (a ? 8 : 0);
+  if (state.colorMask == mask) {
+    stats.stateHits++;
+    return;
+  }
+  glColorMask(r, g, b, a);
+  state.colorMask = mask;
+  stats.stateMisses++;
+}
+
+// True when the value differs from the last upload (and records it)
+static bool uniformChanged(GLint location, const void *value, size_t size) {
+  if (location < 0)
+    return false;
+  if (!currentUniforms) {
+    stats.uniformMisses++;
+    return true;
+  }
+
+  std::vector<UniformSlot> &slots = currentUniforms->slots;
+  if ((size_t) location >= slots.size())
+    slots.resize(location + 1);
+
+  UniformSlot &slot = slots[location];
+  if (slot.known && slot.value.size() == size && memcmp(slot.value.data(), value, size) == 0) {
+    stats.uniformHits++;
+    return false;
+  }
+
+  slot.value.assign((const unsigned char *) value, (const unsigned char *) value + size);
+  slot.known = true;
+  stats.uniformMisses++;
+  return true;
+}
+
+void glsUniform1i(GLint location, GLint value) {
+  if (uniformChanged(location, &value, sizeof(value)))
+    glUniform1i(location, value);
+}
+
+void glsUniform1f(GLint location, GLfloat value) {
+  if (uniformChanged(location, &value, sizeof(value)))
+    glUniform1f(location, value);
+}
+
+void glsUniform1fv(GLint location, GLsizei count, const GLfloat *value) {
+  if (uniformChanged(location, value, sizeof(GLfloat) * count))
+    glUniform1fv(location, count, value);
+}
+
+void glsUniform3fv(GLint location, GLsizei count, const GLfloat *value) {
+  if (uniformChanged(location, value, sizeof(GLfloat) * 3 * count))
+    glUniform3fv(location, count, value);
+}
+
+void glsUniform4fv(GLint location, GLsizei count, const GLfloat *value) {
+  if (uniformChanged(location, value, sizeof(GLfloat) * 4 * count))
+    glUniform4fv(location, count, value);
+}
+
+void glsUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (uniformChanged(location, value, sizeof(GLfloat) * 9 * count))
+    glUniformMatrix3fv(location, count, transpose, value);
+}
+
+void glsUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value) {
+  if (uniformChanged(location, value, sizeof(GLfloat) * 16 * count))
+    glUniformMatrix4fv(location, count, transpose, value);
+}
+
+const GlStateStats &glsStats() {
+  return stats;
+}
+
+void glsResetStats() {
+  memset(&stats, 0, sizeof(stats));
+}
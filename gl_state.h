@@ -0,0 +1,61 @@
+// gl_state.h: cache of the GL binding and uniform state
+//
+// Binds, render state changes and uniform uploads go through the gls*
+// functions, which skip the GL call when the value is the one already set
+// and count hits (skipped) and misses (issued). Code that changes state
+// behind the cache's back must call glsInvalidate() afterwards. Objects
+// are deleted through the glsDelete* functions, which forget every cached
+// binding of them: GL hands deleted names out again, and a new object under
+// a cached name would otherwise never be bound.
+//
+// GL state belongs to a context: only use from the thread owning it.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+
+struct GlStateStats {
+  unsigned long long bindHits, bindMisses;         // programs, VAOs, textures, FBOs, buffers
+  unsigned long long stateHits, stateMisses;       // depth/colour state, enables
+  unsigned long long uniformHits, uniformMisses;
+};
+
+// Forget everything: the next call of each kind always reaches GL
+void glsInvalidate();
+
+void glsUseProgram(GLuint program);
+void glsBindVertexArray(GLuint vao);
+void glsBindBuffer(GLenum target, GLuint buffer);
+void glsBindFramebuffer(GLenum target, GLuint fbo);
+
+// Selects unit with glActiveTexture only when the binding has to change
+void glsBindTexture(GLuint unit, GLenum target, GLuint texture);
+
+// Delete objects and drop them from the cache (GL unbinds them)
+void glsDeleteProgram(GLuint program);
+void glsDeleteVertexArrays(GLsizei n, const GLuint *vaos);
+void glsDeleteBuffers(GLsizei n, const GLuint *buffers);
+void glsDeleteFramebuffers(GLsizei n, const GLuint *fbos);
+void glsDeleteTextures(GLsizei n, const GLuint *textures);
+
+void glsEnable(GLenum cap);
+void glsDisable(GLenum cap);
+void glsDepthFunc(GLenum func);
+void glsDepthMask(GLboolean flag);
+void glsColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+
+// Uniforms of the current program (glsUseProgram)
+void glsUniform1i(GLint location, GLint value);
+void glsUniform1f(GLint location, GLfloat value);
+void glsUniform1fv(GLint location, GLsizei count, const GLfloat *value);
+void glsUniform3fv(GLint location, GLsizei count, const GLfloat *value);
+void glsUniform4fv(GLint location, GLsizei count, const GLfloat *value);
+void glsUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+void glsUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+
+const GlStateStats &glsStats();
+void glsResetStats();
+
+#endif
@@ -0,0 +1,285 @@
+// jobs.cpp: work-stealing job system for per-frame and startup CPU work
+
+#include "jobs.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+// Slot of the calling thread in the system it last used
+static thread_local const JobSystem *tlsSystem = NULL;
+static thread_local int tlsSlot = -1;
+
+// --- Chase-Lev deque ---------------------------------------------------
+
+void WorkStealingQueue::push(Job *job) {
+  long b = bottom.load(std::memory_order_relaxed);
+  jobs[b & (JOBS_QUEUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+  bottom.store(b + 1, std::memory_order_release); // publishes the job to thieves
+}
+
+Job *WorkStealingQueue::pop() {
+  long b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long t = top.load(std::memory_order_relaxed);
+
+  if (t > b) {
+    // Empty
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return NULL;
+  }
+
+  Job *job = jobs[b & (JOBS_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+  if (t == b) {
+    // Last job: race against thieves for it
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      job = NULL;
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+Job *WorkStealingQueue::steal() {
+  long t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long b = bottom.load(std::memory_order_acquire);
+
+  if (t >= b)
+    return NULL;
+
+  Job *job = jobs[t & (JOBS_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+  if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                   std::memory_order_relaxed))
+    return NULL; // lost against pop() or another thief
+  return job;
+}
+
+// --- Job system --------------------------------------------------------
+
+JobSystem::JobSystem(unsigned workerThreads) {
+  if (workerThreads == JOBS_AUTO_WORKERS) {
+    unsigned hw = std::thread::hardware_concurrency();
+    workerThreads = hw > 1 ? hw - 1 : 0;
+  }
+  workerCount = workerThreads;
+  slotCount = JOBS_EXTERNAL_THREADS + (int) workerCount;
+
+  slots = new ThreadSlot[slotCount];
+  for (int i = 0; i < slotCount; i++) {
+    slots[i].pool = new Job[JOBS_POOL_SIZE];
+    slots[i].poolIndex = 0;
+    slots[i].rng = 0x9E3779B9u * (unsigned) (i + 1);
+    slots[i].executed = 0;
+    slots[i].stolen = 0;
+  }
+
+  for (unsigned i = 0; i < workerCount; i++)
+    workers.emplace_back(&JobSystem::workerMain, this, JOBS_EXTERNAL_THREADS + (int) i);
+}
+
+JobSystem::~JobSystem() {
+  running = false;
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wakeUp.notify_all();
+  }
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  for (int i = 0; i < slotCount; i++)
+    delete[] slots[i].pool;
+  delete[] slots;
+
+  if (tlsSystem == this)
+    tlsSystem = NULL;
+}
+
+int JobSystem::currentSlot() {
+  if (tlsSystem == this)
+    return tlsSlot;
+
+  // Outside thread using the system for the first time
+  int slot = externalThreads.fetch_add(1);
+  if (slot >= JOBS_EXTERNAL_THREADS) {
+    fprintf(stderr, "ERROR: more than %d outside threads using the job system\n",
+            JOBS_EXTERNAL_THREADS);
+    abort();
+  }
+
+  tlsSystem = this;
+  tlsSlot = slot;
+  return slot;
+}
+
+Job *JobSystem::create(JobFunction fn, const void *data, size_t size, Job *parent) {
+  ThreadSlot &slot = slots[currentSlot()];
+  Job *job = &slot.pool[slot.poolIndex++ & (JOBS_POOL_SIZE - 1)];
+
+  job->function = fn;
+  job->parent = parent;
+  job->unfinished.store(1, std::memory_order_relaxed);
+  job->dependencies.store(1, std::memory_order_relaxed);
+  job->dependentCount = 0;
+  if (size > 0)
+    memcpy(job->data, data, size);
+
+  if (parent)
+    parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+
+  return job;
+}
+
+void JobSystem::addDependency(Job *job, Job *prerequisite) {
+  if (prerequisite->dependentCount == JOBS_MAX_DEPENDENTS) {
+    fprintf(stderr, "ERROR: more than %d dependents on one job\n", JOBS_MAX_DEPENDENTS);
+    abort();
+  }
+  job->dependencies.fetch_add(1, std::memory_order_relaxed);
+  prerequisite->dependents[prerequisite->dependentCount++] = job;
+}
+
+void JobSystem::run(Job *job) {
+  // Drops the "not submitted yet" reference; queued once nothing else holds it
+  if (job->dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    push(job);
+}
+
+void JobSystem::push(Job *job) {
+  slots[currentSlot()].queue.push(job);
+
+  if (sleeping.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    wakeUp.notify_one();
+  }
+}
+
+Job *JobSystem::getJob(int slot) {
+  ThreadSlot &self = slots[slot];
+  Job *job = self.queue.pop();
+  if (job)
+    return job;
+
+  // Steal from a random victim, then try everyone once
+  self.rng ^= self.rng << 13;
+  self.rng ^= self.rng >> 17;
+  self.rng ^= self.rng << 5;
+  int start = (int) (self.rng % (unsigned) slotCount);
+
+  for (int i = 0; i < slotCount; i++) {
+    int victim = (start + i) % slotCount;
+    if (victim == slot)
+      continue;
+
+    job = slots[victim].queue.steal();
+    if (job) {
+      self.stolen.fetch_add(1, std::memory_order_relaxed);
+      return job;
+    }
+  }
+  return NULL;
+}
+
+void JobSystem::execute(Job *job, int slot) {
+  {
+    TRACE_SCOPE("job");
+    job->function(job, job->data);
+  }
+  slots[slot].executed.fetch_add(1, std::memory_order_relaxed);
+  finish(job);
+}
+
+void JobSystem::finish(Job *job) {
+  // Read everything first: as soon as the counter hits zero a waiter may
+  // return and the slot may be handed out again
+  Job *parent = job->parent;
+  int dependentCount = job->dependentCount;
+  Job *dependents[JOBS_MAX_DEPENDENTS];
+  for (int i = 0; i < dependentCount; i++)
+    dependents[i] = job->dependents[i];
+
+  if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+
+  // Done with all its children: release dependents, then tell the parent
+  for (int i = 0; i < dependentCount; i++)
+    run(dependents[i]);
+
+  if (parent)
+    finish(parent);
+}
+
+void JobSystem::wait(const Job *job) {
+  int slot = currentSlot();
+
+  while (job->unfinished.load(std::memory_order_acquire) > 0) {
+    Job *next = getJob(slot);
+    if (next)
+      execute(next, slot);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void JobSystem::parallelForJob(Job *, const void *data) {
+  ParallelForData range = *static_cast<const ParallelForData *>(data);
+
+  // Keep the first half, hand the second half out to be stolen
+  while (range.end - range.begin > range.grain) {
+    size_t mid = range.begin + (range.end - range.begin) / 2;
+    ParallelForData half = range;
+    half.begin = mid;
+    range.system->run(range.system->create(&parallelForJob, &half, sizeof(half), range.root));
+    range.end = mid;
+  }
+
+  range.call(range.f, range.begin, range.end);
+}
+
+void JobSystem::workerMain(int slot) {
+  tlsSystem = this;
+  tlsSlot = slot;
+
+  char name[32];
+  snprintf(name, sizeof(name), "worker %d", slot);
+  traceThreadName(name);
+
+  int idleSpins = 0;
+  while (running.load(std::memory_order_relaxed)) {
+    Job *job = getJob(slot);
+    if (job) {
+      execute(job, slot);
+      idleSpins = 0;
+      continue;
+    }
+
+    // Spin briefly (frames come in bursts), then sleep until a push
+    if (++idleSpins < 64) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleeping.fetch_add(1);
+    wakeUp.wait_for(lock, std::chrono::milliseconds(1));
+    sleeping.fetch_sub(1);
+    idleSpins = 0;
+  }
+}
+
+void JobSystem::getStats(std::vector<JobStats> &stats) const {
+  stats.resize(slotCount);
+  for (int i = 0; i < slotCount; i++) {
+    stats[i].executed = slots[i].executed.load(std::memory_order_relaxed);
+    stats[i].stolen = slots[i].stolen.load(std::memory_order_relaxed);
+  }
+}
+
+void JobSystem::resetStats() {
+  for (int i = 0; i < slotCount; i++) {
+    slots[i].executed = 0;
+    slots[i].stolen = 0;
+  }
+}
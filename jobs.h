@@ -0,0 +1,167 @@
+// jobs.h: work-stealing job system for per-frame and startup CPU work
+//
+// Every thread taking part (workers plus up to JOBS_EXTERNAL_THREADS
+// outside threads such as main or the simulation thread, registered on
+// first use) owns a Chase-Lev deque: it pushes and pops jobs at the
+// bottom, idle threads steal from the top of someone else's.
+//
+// Jobs come from a per-thread ring of JOBS_POOL_SIZE preallocated jobs and
+// carry their lambda inline, so submitting never touches the heap. A job
+// slot is reused JOBS_POOL_SIZE jobs later, so a thread must not have more
+// than that many jobs in flight.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#define JOBS_POOL_SIZE 4096          // per thread, power of two
+#define JOBS_QUEUE_SIZE 4096         // per thread, power of two
+#define JOBS_DATA_SIZE 64
+#define JOBS_MAX_DEPENDENTS 6
+#define JOBS_EXTERNAL_THREADS 4
+#define JOBS_AUTO_WORKERS ((unsigned) -1)   // JobSystem(): one worker per hardware thread
+
+struct Job;
+typedef void (*JobFunction)(Job *job, const void *data);
+
+struct alignas(64) Job {
+  JobFunction function;
+  Job *parent;
+  std::atomic<int> unfinished;      // itself + unfinished children
+  std::atomic<int> dependencies;    // prerequisites still running, +1 until run()
+  int dependentCount;
+  Job *dependents[JOBS_MAX_DEPENDENTS];
+  alignas(16) unsigned char data[JOBS_DATA_SIZE];
+};
+
+// Chase-Lev deque: push/pop by the owner thread only, steal by anyone
+class WorkStealingQueue {
+public:
+  void push(Job *job);
+  Job *pop();
+  Job *steal();
+
+private:
+  std::atomic<long> top{0};
+  std::atomic<long> bottom{0};
+  std::atomic<Job *> jobs[JOBS_QUEUE_SIZE];
+};
+
+struct JobStats {
+  unsigned long long executed;
+  unsigned long long stolen;
+};
+
+class JobSystem {
+public:
+  // JOBS_AUTO_WORKERS: one worker per hardware thread minus the caller;
+  // 0: none, the calling thread runs every job in wait()/parallelFor()
+  explicit JobSystem(unsigned workerThreads = JOBS_AUTO_WORKERS);
+  ~JobSystem();
+
+  // Workers + the registered outside thread that calls wait()/parallelFor()
+  unsigned threadCount() const { return workerCount + 1; }
+
+  // A job whose function is fn(job, data), data copied inline. If parent is
+  // given, waiting on the parent also waits for this job
+  Job *create(JobFunction fn, const void *data, size_t size, Job *parent = NULL);
+
+  // Same with a lambda (captures must fit JOBS_DATA_SIZE bytes)
+  template <typename F>
+  Job *create(const F &f, Job *parent = NULL) {
+    static_assert(sizeof(F) <= JOBS_DATA_SIZE, "job lambda captures too much");
+    static_assert(std::is_trivially_copyable<F>::value, "job lambda must be trivially copyable");
+    Job *job = create(&invokeLambda<F>, NULL, 0, parent);
+    new (job->data) F(f);
+    return job;
+  }
+
+  // job won't start before prerequisite has finished. Must be called
+  // before run(prerequisite) and before any child of prerequisite runs
+  void addDependency(Job *job, Job *prerequisite);
+
+  // Submits the job; it is queued as soon as its dependencies are done
+  void run(Job *job);
+
+  // Runs other jobs while waiting for job (and its children) to finish
+  void wait(const Job *job);
+
+  // f(begin, end) over [0, count), ranges split recursively down to grain
+  // so thieves always take the biggest remaining half
+  template <typename F>
+  void parallelFor(size_t count, size_t grain, const F &f) {
+    if (count == 0)
+      return;
+    if (grain == 0)
+      grain = 1;
+    if (count <= grain || workerCount == 0) {
+      f((size_t) 0, count);
+      return;
+    }
+
+    Job *root = create(&emptyJob, NULL, 0);
+    ParallelForData data = { this, root, &callRange<F>, &f, 0, count, grain };
+    run(create(&parallelForJob, &data, sizeof(data), root));
+    run(root);
+    wait(root);
+  }
+
+  // Per-thread counters since the last reset (index 0 = first registered
+  // outside thread, then workers)
+  void getStats(std::vector<JobStats> &stats) const;
+  void resetStats();
+
+private:
+  struct ParallelForData {
+    JobSystem *system;
+    Job *root;
+    void (*call)(const void *f, size_t begin, size_t end);
+    const void *f;
+    size_t begin, end, grain;
+  };
+
+  struct alignas(64) ThreadSlot {
+    WorkStealingQueue queue;
+    Job *pool;
+    unsigned poolIndex;
+    unsigned rng;
+    std::atomic<unsigned long long> executed;
+    std::atomic<unsigned long long> stolen;
+  };
+
+  template <typename F>
+  static void invokeLambda(Job *, const void *data) { (*static_cast<const F *>(data))(); }
+  template <typename F>
+  static void callRange(const void *f, size_t begin, size_t end) { (*static_cast<const F *>(f))(begin, end); }
+  static void emptyJob(Job *, const void *) {}
+  static void parallelForJob(Job *job, const void *data);
+
+  int currentSlot();
+  Job *getJob(int slot);
+  void push(Job *job);
+  void execute(Job *job, int slot);
+  void finish(Job *job);
+  void workerMain(int slot);
+
+  unsigned workerCount;
+  int slotCount;
+  ThreadSlot *slots;
+  std::atomic<int> externalThreads{0};
+  std::vector<std::thread> workers;
+
+  // Idle workers sleep here instead of spinning
+  std::atomic<bool> running{true};
+  std::atomic<int> sleeping{0};
+  std::mutex sleepMutex;
+  std::condition_variable wakeUp;
+};
+
+#endif
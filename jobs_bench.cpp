@@ -0,0 +1,133 @@
+// jobs_bench.cpp: scaling benchmark for the job system (jobs.h)
+//
+// Runs the per-frame simulation work (object transforms + frustum culling,
+// as in simulate()) and a fan-in job graph with 1, 2, 4, ... up to the
+// requested number of threads, and prints time per frame and speedup.
+//
+// Usage: jobs_bench [max threads (64)] [objects (200000)] [frames (50)]
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "jobs.h"
+#include "scene.h"
+
+static double now() {
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Same work as simulate(): one model matrix and one frustum test per object
+static double benchTransforms(JobSystem &jobs, const std::vector<SceneObject> &objects,
+                              int frames, size_t *visibleCount) {
+  std::vector<glm::mat4> models(objects.size());
+  std::vector<unsigned char> visible(objects.size());
+  glm::mat4 proj = glm::perspective(glm::radians(50.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 60.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+  Frustum frustum = extractFrustum(proj * view);
+
+  double start = now();
+  for (int frame = 0; frame < frames; frame++) {
+    double time = frame / 60.0;
+    jobs.parallelFor(objects.size(), 256, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        models[i] = objectModelMatrix(objects[i], time);
+        visible[i] = sphereInFrustum(frustum, glm::vec3(models[i][3]), objects[i].scale);
+      }
+    });
+  }
+  double elapsed = (now() - start) / frames;
+
+  *visibleCount = 0;
+  for (size_t i = 0; i < visible.size(); i++)
+    *visibleCount += visible[i];
+  return elapsed;
+}
+
+// Independent jobs with one fan-in job per group of JOBS_MAX_DEPENDENTS
+static double benchGraph(JobSystem &jobs, int jobCount, int frames) {
+  static volatile float sink;
+
+  double start = now();
+  for (int frame = 0; frame < frames; frame++) {
+    Job *done = jobs.create([] {});
+    for (int g = 0; g < jobCount; g += JOBS_MAX_DEPENDENTS) {
+      Job *group = jobs.create([] {}, done);
+      for (int j = g; j < g + JOBS_MAX_DEPENDENTS && j < jobCount; j++) {
+        Job *work = jobs.create([j] {
+          float x = (float) j;
+          for (int k = 0; k < 2000; k++)
+            x = x * 0.999f + 1.0f;
+          sink = x;
+        });
+        jobs.addDependency(group, work);
+        jobs.run(work);
+      }
+      jobs.run(group);
+    }
+    jobs.run(done);
+    jobs.wait(done);
+  }
+  (void) sink;   // read once so the stores count as used
+  return (now() - start) / frames;
+}
+
+int main(int argc, char **argv) {
+  unsigned maxThreads = argc > 1 ? (unsigned) atoi(argv[1]) : 64;
+  size_t objectCount = argc > 2 ? (size_t) atol(argv[2]) : 200000;
+  int frames = argc > 3 ? atoi(argv[3]) : 50;
+
+  // Objects spread in a cube, like a benchmark scene
+  std::vector<SceneObject> objects(objectCount);
+  srand(1234);
+  for (size_t i = 0; i < objectCount; i++) {
+    SceneObject &o = objects[i];
+    o.mesh = 0;
+    o.diffuseMap = o.specularMap = 0;
+    o.position = glm::vec3(rand() % 100 - 50, rand() % 100 - 50, rand() % 100 - 50);
+    o.scale = 0.5f;
+    o.spin = glm::vec2((float) (rand() % 90), (float) (rand() % 90));
+    o.isStatic = false;
+  }
+
+  printf("Hardware threads: %u, objects: %zu, frames: %d\n",
+         std::thread::hardware_concurrency(), objectCount, frames);
+  printf("%8s %16s %9s %14s %9s %12s\n",
+         "threads", "transforms(ms)", "speedup", "job graph(ms)", "speedup", "steals/frame");
+
+  double baseTransforms = 0.0, baseGraph = 0.0;
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+    JobSystem jobs(threads - 1);
+    size_t visible;
+
+    // Warm up (thread start, caches), then measure
+    benchTransforms(jobs, objects, 2, &visible);
+    jobs.resetStats();
+    double transforms = benchTransforms(jobs, objects, frames, &visible);
+    double graph = benchGraph(jobs, 2048, frames);
+
+    std::vector<JobStats> stats;
+    jobs.getStats(stats);
+    unsigned long long steals = 0;
+    for (size_t i = 0; i < stats.size(); i++)
+      steals += stats[i].stolen;
+
+    if (threads == 1) {
+      baseTransforms = transforms;
+      baseGraph = graph;
+    }
+
+    printf("%8u %16.3f %8.2fx %14.3f %8.2fx %12llu\n", threads,
+           transforms * 1000.0, baseTransforms / transforms,
+           graph * 1000.0, baseGraph / graph,
+           steals / (unsigned long long) (2 * frames));
+  }
+
+  return 0;
+}
@@ -0,0 +1,343 @@
+// lod.cpp: level-of-detail chains and their selection by screen-space error
+
+#include "lod.h"
+#include "gl_state.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <queue>
+#include <tuple>
+
+// Symmetric 4x4 matrix: sum of p p^T over the planes p = (a, b, c, d)
+struct Quadric {
+  double m[10];   // aa ab ac ad bb bc bd cc cd dd
+};
+
+static void addPlane(Quadric *q, const glm::dvec3 &n, double d) {
+  q->m[0] += n.x * n.x; q->m[1] += n.x * n.y; q->m[2] += n.x * n.z; q->m[3] += n.x * d;
+  q->m[4] += n.y * n.y; q->m[5] += n.y * n.z; q->m[6] += n.y * d;
+  q->m[7] += n.z * n.z; q->m[8] += n.z * d;
+  q->m[9] += d * d;
+}
+
+static void addQuadric(Quadric *q, const Quadric &other) {
+  for (int i = 0; i < 10; i++)
+    q->m[i] += other.m[i];
+}
+
+// Sum of squared distances from p to the planes
+static double quadricError(const Quadric &q, const glm::dvec3 &p) {
+  const double *m = q.m;
+  return m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x +
+         m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y +
+         m[7] * p.z * p.z + 2.0 * m[8] * p.z + m[9];
+}
+
+struct LodVertex {
+  glm::dvec3 position;
+  Quadric quadric;
+  std::vector<int> triangles;   // dead ones included
+  int version;                  // bumped when the quadric changes
+  bool removed, locked;
+};
+
+// Half-edge collapse candidate: from moves onto to
+struct Collapse {
+  double cost;
+  int from, to;
+  int fromVersion, toVersion;
+
+  bool operator<(const Collapse &other) const { return cost > other.cost; } // cheapest on top
+};
+
+// Working state of one simplification
+struct Simplifier {
+  std::vector<LodVertex> vertices;
+  std::vector<int> corners;             // 3 vertices per triangle
+  std::vector<unsigned char> alive;     // per triangle
+  std::priority_queue<Collapse> heap;
+};
+
+static void pushCollapse(Simplifier *s, int from, int to) {
+  const LodVertex &a = s->vertices[from], &b = s->vertices[to];
+  Quadric q = a.quadric;
+  addQuadric(&q, b.quadric);
+  s->heap.push({ quadricError(q, b.position), from, to, a.version, b.version });
+}
+
+// Both directions of every edge around v
+static void pushCollapses(Simplifier *s, int v) {
+  const std::vector<int> &triangles = s->vertices[v].triangles;
+  for (size_t i = 0; i < triangles.size(); i++) {
+    int t = triangles[i];
+    if (!s->alive[t])
+      continue;
+    for (int k = 0; k < 3; k++) {
+      int u = s->corners[t * 3 + k];
+      if (u != v) {
+        pushCollapse(s, v, u);
+        pushCollapse(s, u, v);
+      }
+    }
+  }
+}
+
+static void neighbours(const Simplifier *s, int v, std::vector<int> *result) {
+  const std::vector<int> &triangles = s->vertices[v].triangles;
+  for (size_t i = 0; i < triangles.size(); i++) {
+    int t = triangles[i];
+    if (!s->alive[t])
+      continue;
+    for (int k = 0; k < 3; k++)
+      if (s->corners[t * 3 + k] != v)
+        result->push_back(s->corners[t * 3 + k]);
+  }
+  std::sort(result->begin(), result->end());
+  result->erase(std::unique(result->begin(), result->end()), result->end());
+}
+
+static bool hasCorner(const Simplifier *s, int t, int v) {
+  return s->corners[t * 3] == v || s->corners[t * 3 + 1] == v || s->corners[t * 3 + 2] == v;
+}
+
+// Keeps the surface manifold (link condition) and no triangle flips
+static bool canCollapse(const Simplifier *s, int from, int to) {
+  const LodVertex &a = s->vertices[from];
+  if (a.locked)
+    return false;
+
+  // The common neighbours must be the third vertices of the edge's triangles
+  std::vector<int> fromNeighbours, toNeighbours, common;
+  neighbours(s, from, &fromNeighbours);
+  neighbours(s, to, &toNeighbours);
+  std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(),
+                        toNeighbours.begin(), toNeighbours.end(), std::back_inserter(common));
+  int edgeTriangles = 0;
+  for (size_t i = 0; i < a.triangles.size(); i++) {
+    int t = a.triangles[i];
+    if (s->alive[t] && hasCorner(s, t, to))
+      edgeTriangles++;
+  }
+  if (edgeTriangles == 0 || (int) common.size() != edgeTriangles)
+    return false;
+
+  const glm::dvec3 &target = s->vertices[to].position;
+  for (size_t i = 0; i < a.triangles.size(); i++) {
+    int t = a.triangles[i];
+    if (!s->alive[t] || hasCorner(s, t, to))
+      continue;
+
+    glm::dvec3 before[3], after[3];
+    for (int k = 0; k < 3; k++) {
+      int v = s->corners[t * 3 + k];
+      before[k] = s->vertices[v].position;
+      after[k] = v == from ? target : before[k];
+    }
+    glm::dvec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+    glm::dvec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+    if (glm::dot(n0, n1) <= 0.0)
+      return false;
+  }
+  return true;
+}
+
+// Returns how many triangles died
+static int collapse(Simplifier *s, int from, int to) {
+  LodVertex &a = s->vertices[from];
+  LodVertex &b = s->vertices[to];
+  int removed = 0;
+
+  for (size_t i = 0; i < a.triangles.size(); i++) {
+    int t = a.triangles[i];
+    if (!s->alive[t])
+      continue;
+    if (hasCorner(s, t, to)) {
+      s->alive[t] = 0;
+      removed++;
+    } else {
+      for (int k = 0; k < 3; k++)
+        if (s->corners[t * 3 + k] == from)
+          s->corners[t * 3 + k] = to;
+      b.triangles.push_back(t);
+    }
+  }
+
+  addQuadric(&b.quadric, a.quadric);
+  b.version++;
+  a.removed = true;
+  a.triangles.clear();
+  return removed;
+}
+
+static void emitLevel(const Simplifier *s, const GLfloat *texCoords, float error,
+                      std::vector<LodLevel> *levels) {
+  LodLevel level;
+  level.error = error;
+  for (size_t t = 0; t < s->alive.size(); t++) {
+    if (!s->alive[t])
+      continue;
+
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++)
+      p[k] = glm::vec3(s->vertices[s->corners[t * 3 + k]].position);
+    glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+    float length = glm::length(n);
+    if (length > 0.0f)
+      n /= length;
+
+    for (int k = 0; k < 3; k++) {
+      size_t c = t * 3 + k;
+      level.positions.insert(level.positions.end(), { p[k].x, p[k].y, p[k].z });
+      level.normals.insert(level.normals.end(), { n.x, n.y, n.z });
+      level.texCoords.insert(level.texCoords.end(), { texCoords[c * 2], texCoords[c * 2 + 1] });
+    }
+  }
+  levels->push_back(level);
+}
+
+void simplifyMesh(const GLfloat *positions, const GLfloat *texCoords, int vertexCount,
+                  std::vector<LodLevel> *levels) {
+  levels->clear();
+  int triangleCount = vertexCount / 3;
+
+  // Weld corners with the same position
+  Simplifier s;
+  std::map<std::tuple<float, float, float>, int> welded;
+  s.corners.resize(triangleCount * 3);
+  for (int c = 0; c < triangleCount * 3; c++) {
+    const GLfloat *p = positions + c * 3;
+    std::pair<std::map<std::tuple<float, float, float>, int>::iterator, bool> inserted =
+      welded.insert(std::make_pair(std::make_tuple(p[0], p[1], p[2]), (int) s.vertices.size()));
+    if (inserted.second) {
+      LodVertex v = {};
+      v.position = glm::dvec3(p[0], p[1], p[2]);
+      s.vertices.push_back(v);
+    }
+    s.corners[c] = inserted.first->second;
+  }
+
+  // Plane quadrics; triangles degenerate after welding are dropped
+  int aliveCount = 0;
+  s.alive.assign(triangleCount, 0);
+  for (int t = 0; t < triangleCount; t++) {
+    int *c = &s.corners[t * 3];
+    if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+      continue;
+    s.alive[t] = 1;
+    aliveCount++;
+
+    glm::dvec3 n = glm::cross(s.vertices[c[1]].position - s.vertices[c[0]].position,
+                              s.vertices[c[2]].position - s.vertices[c[0]].position);
+    double length = glm::length(n);
+    for (int k = 0; k < 3; k++) {
+      if (length > 0.0)
+        addPlane(&s.vertices[c[k]].quadric, n / length,
+                 -glm::dot(n / length, s.vertices[c[0]].position));
+      s.vertices[c[k]].triangles.push_back(t);
+    }
+  }
+
+  // Vertices on open (or non-manifold) edges stay put
+  std::map<std::pair<int, int>, int> edgeUses;
+  for (int t = 0; t < triangleCount; t++) {
+    if (!s.alive[t])
+      continue;
+    for (int k = 0; k < 3; k++) {
+      int a = s.corners[t * 3 + k], b = s.corners[t * 3 + (k + 1) % 3];
+      edgeUses[std::make_pair(std::min(a, b), std::max(a, b))]++;
+    }
+  }
+  for (std::map<std::pair<int, int>, int>::iterator it = edgeUses.begin(); it != edgeUses.end(); ++it) {
+    if (it->second != 2)
+      s.vertices[it->first.first].locked = s.vertices[it->first.second].locked = true;
+  }
+
+  for (size_t v = 0; v < s.vertices.size(); v++)
+    pushCollapses(&s, (int) v);
+
+  // One collapse run; each level is a snapshot at half the triangles of the
+  // one before
+  double error = 0.0;
+  int previous = aliveCount;
+  int target = aliveCount / 2;
+  while ((int) levels->size() < LOD_MAX_LEVELS && target >= LOD_MIN_TRIANGLES) {
+    while (aliveCount > target && !s.heap.empty()) {
+      Collapse c = s.heap.top();
+      s.heap.pop();
+      const LodVertex &a = s.vertices[c.from], &b = s.vertices[c.to];
+      if (a.removed || b.removed || a.version != c.fromVersion || b.version != c.toVersion ||
+          !canCollapse(&s, c.from, c.to))
+        continue;
+
+      aliveCount -= collapse(&s, c.from, c.to);
+      error = std::max(error, sqrt(std::max(c.cost, 0.0)));
+      pushCollapses(&s, c.to);
+    }
+
+    // Out of valid collapses long before the target: not worth a level
+    if (aliveCount > previous * 3 / 4)
+      break;
+
+    emitLevel(&s, texCoords, (float) error, levels);
+    previous = aliveCount;
+    target = aliveCount / 2;
+  }
+}
+
+void createLodMeshes(std::vector<Mesh> *meshes, int mesh, const std::vector<LodLevel> &levels,
+                     std::vector<GLuint> *buffers) {
+  int finer = mesh;
+  for (size_t l = 0; l < levels.size(); l++) {
+    const LodLevel &level = levels[l];
+    const std::vector<GLfloat> *attributes[3] = { &level.positions, &level.normals, &level.texCoords };
+
+    // Same attribute layout as the source meshes: 0 position, 1 normal, 2 UV
+    GLuint vao = 0, vbos[3] = { 0, 0, 0 };
+    glGenVertexArrays(1, &vao);
+    glsBindVertexArray(vao);
+    glGenBuffers(3, vbos);
+    for (int a = 0; a < 3; a++) {
+      glsBindBuffer(GL_ARRAY_BUFFER, vbos[a]);
+      glBufferData(GL_ARRAY_BUFFER, attributes[a]->size() * sizeof(GLfloat), attributes[a]->data(),
+                   GL_STATIC_DRAW);
+      glVertexAttribPointer(a, a == 2 ? 2 : 3, GL_FLOAT, GL_FALSE, 0, NULL);
+      glEnableVertexAttribArray(a);
+      buffers->push_back(vbos[a]);
+    }
+    glsBindBuffer(GL_ARRAY_BUFFER, 0);
+    glsBindVertexArray(0);
+
+    // Half-edge collapses keep the vertices inside the source's sphere
+    Mesh lod = { vao, (GLsizei) (level.positions.size() / 3), (*meshes)[mesh].radius };
+    lod.lodError = level.error;
+    (*meshes)[finer].coarser = (int) meshes->size();
+    finer = (int) meshes->size();
+    meshes->push_back(lod);
+  }
+}
+
+float lodPixelScale(const glm::mat4 &proj, int height) {
+  return proj[1][1] * height * 0.5f;
+}
+
+int selectLod(const std::vector<Mesh> &meshes, int mesh, float errorScale, float threshold,
+              unsigned char *level) {
+  int chain[LOD_MAX_LEVELS + 1];
+  int count = 0;
+  for (int m = mesh; m >= 0 && count <= LOD_MAX_LEVELS; m = meshes[m].coarser)
+    chain[count++] = m;
+
+  // Finer while the current level is visibly off, coarser only while the
+  // next one is well under the threshold
+  int l = std::min((int) *level, count - 1);
+  while (l > 0 && meshes[chain[l]].lodError * errorScale > threshold)
+    l--;
+  while (l + 1 < count && meshes[chain[l + 1]].lodError * errorScale <= threshold * (1.0f - LOD_HYSTERESIS))
+    l++;
+
+  *level = (unsigned char) l;
+  return chain[l];
+}
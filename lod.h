@@ -0,0 +1,61 @@
+// lod.h: level-of-detail chains and their selection by screen-space error
+//
+// Each source mesh (a triangle list, as all the scene meshes are) is
+// simplified at startup into up to LOD_MAX_LEVELS coarser levels, each with
+// about half the triangles of the one before.
+//
+// The simplifier welds the corners by position and does half-edge
+// collapses: a vertex moves onto a neighbour, so no new positions appear.
+// They are taken cheapest first by quadric error (sum of squared distances
+// to the planes of the original triangles around the vertex). A collapse
+// is skipped if it would flip a triangle or make the surface non-manifold.
+// Boundary vertices never move. Texture coordinates stay with their corner
+// and are not part of the error. Normals are flat, like the source meshes.
+//
+// Each level's error is the largest quadric distance of its collapses: an
+// object space bound on how far its surface is from the original. Scaled
+// by the projection and the object's distance, it becomes an error in
+// pixels. The coarsest level under the threshold is drawn. An object only
+// moves to a coarser level once that level is LOD_HYSTERESIS below the
+// threshold, so objects near a boundary don't flicker between levels.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef LOD_H
+#define LOD_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+
+#define LOD_MAX_LEVELS 4
+#define LOD_MIN_TRIANGLES 4
+#define LOD_HYSTERESIS 0.25f   // fraction of the threshold
+
+// One simplified level, a triangle list like the source
+struct LodLevel {
+  std::vector<GLfloat> positions, normals, texCoords;
+  float error;              // object space
+};
+
+// CPU only: the levels coarser than the source, finest first
+void simplifyMesh(const GLfloat *positions, const GLfloat *texCoords, int vertexCount,
+                  std::vector<LodLevel> *levels);
+
+// Uploads the levels as new meshes chained from meshes[mesh] (Mesh::coarser).
+// Their buffers are appended to buffers
+void createLodMeshes(std::vector<Mesh> *meshes, int mesh, const std::vector<LodLevel> &levels,
+                     std::vector<GLuint> *buffers);
+
+// Pixels per object space unit at distance 1, for a viewport height
+float lodPixelScale(const glm::mat4 &proj, int height);
+
+// Mesh to draw for an object of mesh whose errors project to errorScale
+// pixels per unit (pixel scale * object scale / distance). level holds the
+// object's level last frame and is updated
+int selectLod(const std::vector<Mesh> &meshes, int mesh, float errorScale, float threshold,
+              unsigned char *level);
+
+#endif
@@ -0,0 +1,133 @@
+// material.cpp: material table for draws that mix materials
+
+#include "material.h"
+#include "gl_state.h"
+
+#include <stdio.h>
+
+// Layer of texture, adding it the first time; -1 for no texture
+static GLint textureLayer(MaterialTable *table, unsigned int texture) {
+  if (!texture)
+    return -1;
+  for (size_t i = 0; i < table->layerTextures.size(); i++)
+    if (table->layerTextures[i] == texture)
+      return (GLint) i;
+  table->layerTextures.push_back(texture);
+  return (GLint) table->layerTextures.size() - 1;
+}
+
+bool createMaterialTable(MaterialTable *table, const std::vector<SceneObject> &objects,
+                         float shininess) {
+  // Materials in order of first appearance
+  std::vector<unsigned int> materialMaps;   // diffuse, specular pairs
+  table->objectMaterials.resize(objects.size());
+  for (size_t i = 0; i < objects.size(); i++) {
+    size_t m = 0;
+    while (m < table->materials.size() &&
+           (materialMaps[m * 2] != objects[i].diffuseMap ||
+            materialMaps[m * 2 + 1] != objects[i].specularMap))
+      m++;
+
+    if (m == table->materials.size()) {
+      MaterialRecord record;
+      record.diffuseLayer = textureLayer(table, objects[i].diffuseMap);
+      record.specularLayer = textureLayer(table, objects[i].specularMap);
+      record.shininess = shininess;
+      record.pad = 0.0f;
+      table->materials.push_back(record);
+      materialMaps.push_back(objects[i].diffuseMap);
+      materialMaps.push_back(objects[i].specularMap);
+    }
+    table->objectMaterials[i] = (unsigned int) m;
+  }
+
+  // Layer size: the largest map in each direction
+  size_t layers = table->layerTextures.size();
+  std::vector<GLint> widths(layers), heights(layers);
+  table->layerWidth = table->layerHeight = 1;
+  for (size_t l = 0; l < layers; l++) {
+    glsBindTexture(0, GL_TEXTURE_2D, table->layerTextures[l]);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &widths[l]);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &heights[l]);
+    if (widths[l] > table->layerWidth)
+      table->layerWidth = widths[l];
+    if (heights[l] > table->layerHeight)
+      table->layerHeight = heights[l];
+  }
+  glsBindTexture(0, GL_TEXTURE_2D, 0);
+
+  GLint maxLayers = 0;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+  if ((GLint) layers > maxLayers) {
+    fprintf(stderr, "ERROR: %zu material maps, texture arrays hold %d\n", layers, maxLayers);
+    return false;
+  }
+
+  int levels = 1;
+  for (int size = table->layerWidth > table->layerHeight ? table->layerWidth : table->layerHeight;
+       size > 1; size /= 2)
+    levels++;
+
+  glGenTextures(1, &table->textureArray);
+  glsBindTexture(0, GL_TEXTURE_2D_ARRAY, table->textureArray);
+  for (int level = 0, w = table->layerWidth, h = table->layerHeight; level < levels; level++) {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, w, h, layers > 0 ? (GLsizei) layers : 1,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    w = w > 1 ? w / 2 : 1;
+    h = h > 1 ? h / 2 : 1;
+  }
+
+  // Copy (and scale) each map into its layer on the GPU: the decoded images
+  // are long gone
+  GLuint framebuffers[2];
+  glGenFramebuffers(2, framebuffers);
+  glsBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+  glsBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+  for (size_t l = 0; l < layers; l++) {
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           table->layerTextures[l], 0);
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, table->textureArray,
+                              0, (GLint) l);
+    bool scaled = widths[l] != table->layerWidth || heights[l] != table->layerHeight;
+    glBlitFramebuffer(0, 0, widths[l], heights[l], 0, 0, table->layerWidth, table->layerHeight,
+                      GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+  }
+  glsBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glsDeleteFramebuffers(2, framebuffers);
+
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glsBindTexture(0, GL_TEXTURE_2D_ARRAY, 0);
+
+  glGenBuffers(1, &table->buffer);
+  glsBindBuffer(GL_SHADER_STORAGE_BUFFER, table->buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, table->materials.size() * sizeof(MaterialRecord),
+               table->materials.data(), GL_STATIC_DRAW);
+  glsBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR) {
+    fprintf(stderr, "ERROR: could not create the material table (0x%x)\n", error);
+    return false;
+  }
+
+  printf("Material table: %zu materials, %zu maps in a %dx%d texture array\n",
+         table->materials.size(), layers, table->layerWidth, table->layerHeight);
+  return true;
+}
+
+void destroyMaterialTable(MaterialTable *table) {
+  if (table->textureArray)
+    glsDeleteTextures(1, &table->textureArray);
+  if (table->buffer)
+    glsDeleteBuffers(1, &table->buffer);
+  *table = MaterialTable();
+}
+
+void bindMaterialTable(const MaterialTable *table, GLuint unit) {
+  glsBindTexture(unit, GL_TEXTURE_2D_ARRAY, table->textureArray);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BUFFER_BINDING, table->buffer);
+}
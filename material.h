@@ -0,0 +1,55 @@
+// material.h: material table for draws that mix materials
+//
+// Every distinct (diffuse map, specular map) pair of the scene becomes a
+// material record in a shader storage buffer, and every map is copied into
+// one layer of a shared texture array. The records hold layer indices, not
+// texture names. A shader that knows its material index (the multi-draw
+// vertex shader reads it from the draw's static record) samples the right
+// maps with nothing bound per object. Objects with different textures can
+// then go in the same indirect draw.
+//
+// Layers share one size: the largest width and height of the maps. Smaller
+// maps are scaled up with linear filtering when copied, which keeps UVs
+// valid and changes the image only by that filtering. Objects without a
+// map get layer -1, which the shaders read as black.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include "scene.h"
+
+// Shader storage binding of the records (multidraw_vs.glsl)
+#define MATERIAL_BUFFER_BINDING 4
+
+// std430 record read by the shaders
+struct MaterialRecord {
+  GLint diffuseLayer;         // -1: no map
+  GLint specularLayer;
+  float shininess;
+  float pad;
+};
+
+struct MaterialTable {
+  GLuint textureArray = 0;
+  GLuint buffer = 0;
+  int layerWidth = 0, layerHeight = 0;
+  std::vector<unsigned int> layerTextures;    // source texture of each layer
+  std::vector<MaterialRecord> materials;
+  std::vector<unsigned int> objectMaterials;  // one per scene object
+};
+
+// Builds the records and the texture array for the objects' maps (which
+// must be 2D textures). False if they don't fit or GL fails
+bool createMaterialTable(MaterialTable *table, const std::vector<SceneObject> &objects,
+                         float shininess);
+void destroyMaterialTable(MaterialTable *table);
+
+// Texture array on unit, records on MATERIAL_BUFFER_BINDING
+void bindMaterialTable(const MaterialTable *table, GLuint unit);
+
+#endif
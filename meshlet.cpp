@@ -0,0 +1,276 @@
+// meshlet.cpp: meshes split into small clusters that are culled one by one
+
+#include "meshlet.h"
+#include "gl_state.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <array>
+#include <map>
+
+#define MESHLET_VERTEX_FLOATS 8   // position, normal, UV
+
+static glm::vec3 vertexPosition(const std::vector<GLfloat> &vertices, GLuint v) {
+  return glm::vec3(vertices[v * MESHLET_VERTEX_FLOATS], vertices[v * MESHLET_VERTEX_FLOATS + 1],
+                   vertices[v * MESHLET_VERTEX_FLOATS + 2]);
+}
+
+// Bounding sphere (around the box centre) and normal cone of the triangles
+static void meshletBounds(const std::vector<GLfloat> &vertices, const GLuint *indices,
+                          int triangleCount, Meshlet *meshlet) {
+  glm::vec3 lo = vertexPosition(vertices, indices[0]), hi = lo;
+  for (int c = 1; c < triangleCount * 3; c++) {
+    glm::vec3 p = vertexPosition(vertices, indices[c]);
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  meshlet->center = (lo + hi) * 0.5f;
+  meshlet->radius = 0.0f;
+  for (int c = 0; c < triangleCount * 3; c++)
+    meshlet->radius = glm::max(meshlet->radius,
+                               glm::length(vertexPosition(vertices, indices[c]) - meshlet->center));
+
+  // Face normals from the winding, which the scene normals agree with
+  std::vector<glm::vec3> normals;
+  glm::vec3 sum(0.0f);
+  for (int t = 0; t < triangleCount; t++) {
+    glm::vec3 a = vertexPosition(vertices, indices[t * 3]);
+    glm::vec3 n = glm::cross(vertexPosition(vertices, indices[t * 3 + 1]) - a,
+                             vertexPosition(vertices, indices[t * 3 + 2]) - a);
+    float length = glm::length(n);
+    if (length > 0.0f) {
+      normals.push_back(n / length);
+      sum += n / length;
+    }
+  }
+
+  meshlet->coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+  meshlet->coneCutoff = 1.0f;
+  if (normals.empty() || glm::length(sum) == 0.0f)
+    return;
+
+  glm::vec3 axis = glm::normalize(sum);
+  float minDot = 1.0f;
+  for (size_t i = 0; i < normals.size(); i++)
+    minDot = glm::min(minDot, glm::dot(axis, normals[i]));
+  meshlet->coneAxis = axis;
+  if (minDot > 0.1f)
+    meshlet->coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+// Groups the triangles into meshlets; indices come back in meshlet order.
+// Triangles are neighbours when they share a position, even if the normals
+// or UVs there differ (the faces of a cube)
+static void buildMeshlets(const std::vector<GLfloat> &vertices, std::vector<GLuint> *indices,
+                          std::vector<Meshlet> *meshlets) {
+  int vertexCount = (int) (vertices.size() / MESHLET_VERTEX_FLOATS);
+  int triangleCount = (int) (indices->size() / 3);
+  const std::vector<GLuint> &source = *indices;
+
+  std::map<std::array<GLfloat, 3>, int> positions;
+  std::vector<int> positionIds(vertexCount);   // vertex -> distinct position
+  for (int v = 0; v < vertexCount; v++) {
+    const GLfloat *vertex = &vertices[v * MESHLET_VERTEX_FLOATS];
+    std::array<GLfloat, 3> p = { vertex[0], vertex[1], vertex[2] };
+    positionIds[v] = positions.insert(std::make_pair(p, (int) positions.size())).first->second;
+  }
+
+  std::vector<std::vector<int> > positionTriangles(positions.size());
+  std::vector<glm::vec3> centroids(triangleCount);
+  for (int t = 0; t < triangleCount; t++) {
+    centroids[t] = glm::vec3(0.0f);
+    for (int k = 0; k < 3; k++) {
+      positionTriangles[positionIds[source[t * 3 + k]]].push_back(t);
+      centroids[t] += vertexPosition(vertices, source[t * 3 + k]) / 3.0f;
+    }
+  }
+
+  std::vector<unsigned char> assigned(triangleCount, 0);
+  std::vector<int> owner(vertexCount, -1);     // last meshlet that took the vertex
+  std::vector<GLuint> ordered;
+  ordered.reserve(source.size());
+  std::vector<GLuint> meshletVertices;
+
+  for (int seed = 0; seed < triangleCount; seed++) {
+    if (assigned[seed])
+      continue;
+
+    int id = (int) meshlets->size();
+    Meshlet meshlet = {};
+    meshlet.firstIndex = (GLuint) ordered.size();
+    meshletVertices.clear();
+    glm::vec3 centroidSum(0.0f);
+
+    int next = seed;
+    while (next >= 0) {
+      assigned[next] = 1;
+      centroidSum += centroids[next];
+      for (int k = 0; k < 3; k++) {
+        GLuint v = source[next * 3 + k];
+        ordered.push_back(v);
+        if (owner[v] != id) {
+          owner[v] = id;
+          meshletVertices.push_back(v);
+        }
+      }
+      meshlet.indexCount += 3;
+      if (meshlet.indexCount == MESHLET_MAX_TRIANGLES * 3)
+        break;
+
+      // Neighbour adding the fewest vertices
+      next = -1;
+      int fewest = 4;
+      for (size_t i = 0; i < meshletVertices.size() && fewest > 0; i++) {
+        const std::vector<int> &around = positionTriangles[positionIds[meshletVertices[i]]];
+        for (size_t j = 0; j < around.size(); j++) {
+          int t = around[j];
+          if (assigned[t])
+            continue;
+          int added = 0;
+          for (int k = 0; k < 3; k++)
+            added += owner[source[t * 3 + k]] != id;
+          if (added < fewest) {
+            fewest = added;
+            next = t;
+          }
+        }
+      }
+
+      // No neighbour left (a separate part of the mesh): the unassigned
+      // triangle closest to the meshlet, so it still fills up
+      if (next < 0) {
+        glm::vec3 center = centroidSum / (float) (meshlet.indexCount / 3);
+        float closest = INFINITY;
+        for (int t = seed + 1; t < triangleCount; t++) {
+          float distance = glm::length(centroids[t] - center);
+          if (!assigned[t] && distance < closest) {
+            closest = distance;
+            next = t;
+          }
+        }
+        fewest = 0;
+        if (next >= 0)
+          for (int k = 0; k < 3; k++)
+            fewest += owner[source[next * 3 + k]] != id;
+      }
+
+      // Only if its vertices still fit
+      if (next >= 0 && (int) meshletVertices.size() + fewest > MESHLET_MAX_VERTICES)
+        next = -1;
+    }
+
+    meshletBounds(vertices, ordered.data() + meshlet.firstIndex, meshlet.indexCount / 3, &meshlet);
+    meshlets->push_back(meshlet);
+  }
+
+  *indices = ordered;
+}
+
+bool createMeshletMesh(MeshletMesh *mesh, const GLfloat *positions, const GLfloat *normals,
+                       const GLfloat *texCoords, int vertexCount) {
+  destroyMeshletMesh(mesh);
+  if (vertexCount < 3) {
+    fprintf(stderr, "ERROR: no triangles to split into meshlets\n");
+    return false;
+  }
+
+  // Weld identical vertices (all attributes equal)
+  std::vector<GLfloat> vertices;
+  std::vector<GLuint> indices;
+  std::map<std::array<GLfloat, MESHLET_VERTEX_FLOATS>, GLuint> welded;
+  for (int i = 0; i < vertexCount / 3 * 3; i++) {
+    std::array<GLfloat, MESHLET_VERTEX_FLOATS> v = {
+      positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2],
+      normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2],
+      texCoords[i * 2], texCoords[i * 2 + 1]
+    };
+    std::pair<std::map<std::array<GLfloat, MESHLET_VERTEX_FLOATS>, GLuint>::iterator, bool> inserted =
+      welded.insert(std::make_pair(v, (GLuint) (vertices.size() / MESHLET_VERTEX_FLOATS)));
+    if (inserted.second)
+      vertices.insert(vertices.end(), v.begin(), v.end());
+    indices.push_back(inserted.first->second);
+  }
+
+  buildMeshlets(vertices, &indices, &mesh->meshlets);
+  mesh->vertexCount = (int) (vertices.size() / MESHLET_VERTEX_FLOATS);
+  mesh->triangleCount = (int) (indices.size() / 3);
+
+  glGenVertexArrays(1, &mesh->vao);
+  glsBindVertexArray(mesh->vao);
+
+  glGenBuffers(1, &mesh->indexBuffer);
+  glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+  const GLsizei stride = MESHLET_VERTEX_FLOATS * sizeof(GLfloat);
+  glGenBuffers(1, &mesh->vertexBuffer);
+  glsBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (const void *) 0);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (const void *) (3 * sizeof(GLfloat)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (const void *) (6 * sizeof(GLfloat)));
+  glEnableVertexAttribArray(2);
+
+  glsBindBuffer(GL_ARRAY_BUFFER, 0);
+  glsBindVertexArray(0);
+  return true;
+}
+
+void destroyMeshletMesh(MeshletMesh *mesh) {
+  if (mesh->vao)
+    glsDeleteVertexArrays(1, &mesh->vao);
+  if (mesh->vertexBuffer)
+    glsDeleteBuffers(1, &mesh->vertexBuffer);
+  if (mesh->indexBuffer)
+    glsDeleteBuffers(1, &mesh->indexBuffer);
+  *mesh = MeshletMesh();
+}
+
+int cullMeshlets(const MeshletMesh &mesh, const glm::mat4 &model, const Frustum &frustum,
+                 const glm::vec3 &cameraPos, GLsizei *counts, const void **offsets,
+                 MeshletStats *stats) {
+  float scale = glm::length(glm::vec3(model[0]));
+  glm::mat3 rotation = glm::mat3(model);
+  int ranges = 0;
+  GLuint end = 0;
+
+  for (size_t i = 0; i < mesh.meshlets.size(); i++) {
+    const Meshlet &meshlet = mesh.meshlets[i];
+    glm::vec3 center = glm::vec3(model * glm::vec4(meshlet.center, 1.0f));
+    float radius = meshlet.radius * scale;
+    stats->tested++;
+
+    if (!sphereInFrustum(frustum, center, radius)) {
+      stats->frustumCulled++;
+      continue;
+    }
+
+    // Backfacing from every point of the sphere: the view direction is
+    // within 90 degrees minus the cone's half angle of the axis
+    if (meshlet.coneCutoff < 1.0f) {
+      glm::vec3 axis = glm::normalize(rotation * meshlet.coneAxis);
+      glm::vec3 view = center - cameraPos;
+      if (glm::dot(view, axis) >= meshlet.coneCutoff * glm::length(view) + radius * (1.0f + meshlet.coneCutoff)) {
+        stats->backfaceCulled++;
+        continue;
+      }
+    }
+
+    if (ranges > 0 && meshlet.firstIndex == end) {
+      counts[ranges - 1] += meshlet.indexCount;
+    } else {
+      counts[ranges] = meshlet.indexCount;
+      offsets[ranges] = (const void *) (uintptr_t) (meshlet.firstIndex * sizeof(GLuint));
+      ranges++;
+    }
+    end = meshlet.firstIndex + meshlet.indexCount;
+  }
+
+  stats->ranges += ranges;
+  return ranges;
+}
@@ -0,0 +1,71 @@
+// meshlet.h: meshes split into small clusters that are culled one by one
+//
+// A mesh (a triangle list, as the scene meshes are) is welded into an
+// indexed one and its triangles are grouped into meshlets of at most
+// MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles. Each
+// meshlet grows from a seed triangle, taking whichever neighbouring
+// triangle (sharing a position, whatever its normals and UVs) adds the
+// fewest new vertices. With no neighbour left it takes the closest free
+// triangle, so meshlets fill up on meshes made of separate pieces. The
+// triangles of a meshlet are contiguous in the index buffer. Every meshlet
+// keeps:
+//  - a bounding sphere, for frustum culling;
+//  - a normal cone around every triangle normal (axis, and the sine of its
+//    half angle). When the camera sees the whole sphere from behind the
+//    cone, every triangle of the meshlet faces away from it.
+// The backface test assumes closed meshes with outward normals, like the
+// scene's. Cones wider than about 84 degrees are never backface culled.
+//
+// Per draw, cullMeshlets() tests every meshlet of the mesh against the
+// camera on the CPU. The index ranges of the visible ones, adjacent ranges
+// merged, go to one glMultiDrawElements. The limits are the usual mesh
+// shader ones, but without mesh shaders the indices stay global and 32 bit.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet {
+  glm::vec3 center;           // bounding sphere, object space
+  float radius;
+  glm::vec3 coneAxis;
+  float coneCutoff;           // sine of the half angle; 1: never backfacing
+  GLuint firstIndex, indexCount;
+};
+
+// Indexed copy of a mesh, same attribute layout (0 position, 1 normal, 2 UV)
+struct MeshletMesh {
+  GLuint vao = 0, vertexBuffer = 0, indexBuffer = 0;
+  int vertexCount = 0, triangleCount = 0;
+  std::vector<Meshlet> meshlets;
+};
+
+// Meshlets tested and culled, accumulated until reset
+struct MeshletStats {
+  unsigned long long tested, frustumCulled, backfaceCulled;
+  unsigned long long ranges;
+};
+
+bool createMeshletMesh(MeshletMesh *mesh, const GLfloat *positions, const GLfloat *normals,
+                       const GLfloat *texCoords, int vertexCount);
+void destroyMeshletMesh(MeshletMesh *mesh);
+
+// Index ranges (for glMultiDrawElements) of the meshlets visible with
+// model, which may only rotate, translate and scale uniformly. counts and
+// offsets need room for every meshlet. Returns the number of ranges, 0 if
+// nothing is visible
+int cullMeshlets(const MeshletMesh &mesh, const glm::mat4 &model, const Frustum &frustum,
+                 const glm::vec3 &cameraPos, GLsizei *counts, const void **offsets,
+                 MeshletStats *stats);
+
+#endif
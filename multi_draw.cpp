@@ -0,0 +1,230 @@
+// multi_draw.cpp: GPU-driven scene submission with glMultiDrawElementsIndirect
+
+#include "multi_draw.h"
+#include "gl_state.h"
+#include "jobs.h"
+
+#include <stdio.h>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#define VERTEX_FLOATS 8   // position, normal, uv
+#define CULL_GROUP_SIZE 64
+
+int addMultiDrawMesh(MultiDraw *md, const GLfloat *positions, const GLfloat *normals,
+                     const GLfloat *texCoords, int vertexCount,
+                     const GLuint *indices, int indexCount) {
+  MultiDrawMesh mesh;
+  mesh.firstIndex = (GLuint) md->indices.size();
+  mesh.baseVertex = (GLint) (md->vertices.size() / VERTEX_FLOATS);
+
+  for (int v = 0; v < vertexCount; v++) {
+    md->vertices.insert(md->vertices.end(), positions + v * 3, positions + v * 3 + 3);
+    md->vertices.insert(md->vertices.end(), normals + v * 3, normals + v * 3 + 3);
+    md->vertices.insert(md->vertices.end(), texCoords + v * 2, texCoords + v * 2 + 2);
+  }
+
+  if (!indices) {
+    indexCount = vertexCount;
+    for (int i = 0; i < vertexCount; i++)
+      md->indices.push_back((GLuint) i);
+  } else {
+    md->indices.insert(md->indices.end(), indices, indices + indexCount);
+  }
+  mesh.indexCount = (GLuint) indexCount;
+
+  md->meshes.push_back(mesh);
+  return (int) md->meshes.size() - 1;
+}
+
+static GLuint createBuffer(GLenum target, size_t size, const void *data, GLenum usage) {
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glsBindBuffer(target, buffer);
+  glBufferData(target, size, data, usage);
+  return buffer;
+}
+
+bool createMultiDraw(MultiDraw *md, const std::vector<SceneObject> &objects,
+                     const std::vector<unsigned int> &objectMaterials, GLuint cullProgram) {
+  size_t count = objects.size();
+  md->objectCount = (GLuint) count;
+
+  // Static records; record r is also baseInstance r
+  std::vector<MultiDrawObject> records(count > 0 ? count : 1);
+  for (size_t i = 0; i < count; i++) {
+    const MultiDrawMesh &mesh = md->meshes[objects[i].mesh];
+    records[i] = { mesh.indexCount, mesh.firstIndex, mesh.baseVertex, objectMaterials[i] };
+  }
+
+  // Shared geometry
+  glGenVertexArrays(1, &md->vao);
+  glsBindVertexArray(md->vao);
+
+  md->vbo = createBuffer(GL_ARRAY_BUFFER, md->vertices.size() * sizeof(float),
+                         md->vertices.data(), GL_STATIC_DRAW);
+  GLsizei stride = VERTEX_FLOATS * sizeof(float);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *) 0);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void *) (3 * sizeof(float)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void *) (6 * sizeof(float)));
+  glEnableVertexAttribArray(2);
+
+  std::vector<GLuint> drawIds(count > 0 ? count : 1);
+  for (size_t i = 0; i < drawIds.size(); i++)
+    drawIds[i] = (GLuint) i;
+  md->drawIdBuffer = createBuffer(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint),
+                                  drawIds.data(), GL_STATIC_DRAW);
+  glVertexAttribIPointer(MULTIDRAW_DRAW_ID_ATTRIB, 1, GL_UNSIGNED_INT, 0, NULL);
+  glVertexAttribDivisor(MULTIDRAW_DRAW_ID_ATTRIB, 1);
+  glEnableVertexAttribArray(MULTIDRAW_DRAW_ID_ATTRIB);
+
+  md->ebo = createBuffer(GL_ELEMENT_ARRAY_BUFFER, md->indices.size() * sizeof(GLuint),
+                         md->indices.data(), GL_STATIC_DRAW);
+
+  glsBindVertexArray(0);
+  glsBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  std::vector<float>().swap(md->vertices);
+  std::vector<GLuint>().swap(md->indices);
+
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &md->storageAlignment);
+
+  md->objectBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, records.size() * sizeof(MultiDrawObject),
+                                  records.data(), GL_STATIC_DRAW);
+
+  // Commands written by the culling pass stay on the GPU
+  md->cullProgram = cullProgram;
+  md->gpuCulling = cullProgram != 0;
+  if (md->gpuCulling) {
+    md->commandBuffer = createBuffer(GL_DRAW_INDIRECT_BUFFER, records.size() * sizeof(DrawElementsIndirectCommand),
+                                     NULL, GL_DYNAMIC_DRAW);
+    md->countBuffer = createBuffer(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+    md->planes_uniform = findUniform<glm::vec4>(cullProgram, "frustum_planes");
+    md->object_count_uniform = findUniform<int>(cullProgram, "object_count");
+  }
+  glsBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  glsBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR) {
+    fprintf(stderr, "ERROR: could not create multi-draw buffers (0x%x)\n", error);
+    return false;
+  }
+
+  return true;
+}
+
+void destroyMultiDraw(MultiDraw *md) {
+  GLuint buffers[] = { md->vbo, md->ebo, md->drawIdBuffer, md->objectBuffer,
+                       md->commandBuffer, md->countBuffer };
+  glsDeleteBuffers(sizeof(buffers) / sizeof(buffers[0]), buffers);
+  if (md->vao)
+    glsDeleteVertexArrays(1, &md->vao);
+
+  *md = MultiDraw();
+}
+
+size_t multiDrawFrameSize(const MultiDraw *md) {
+  size_t count = md->objectCount;
+  return count * (sizeof(MultiDrawData) + sizeof(DrawElementsIndirectCommand)) +
+         2 * (size_t) md->storageAlignment;
+}
+
+void updateMultiDraw(MultiDraw *md, const FramePacket &frame,
+                     const std::vector<SceneObject> &objects,
+                     const std::vector<Mesh> &meshes, RingBuffer *ring, JobSystem *jobs) {
+  size_t count = md->objectCount;
+  md->visibleCount = 0;
+
+  RingAllocation records = ringAlloc(ring, count * sizeof(MultiDrawData), md->storageAlignment);
+  RingAllocation commands = { 0, NULL };
+  if (!md->gpuCulling)
+    commands = ringAlloc(ring, count * sizeof(DrawElementsIndirectCommand), 4);
+
+  md->frameValid = records.data && (md->gpuCulling || commands.data);
+  if (!md->frameValid)
+    return;
+
+  md->frameBuffer = ring->buffer;
+  md->dataOffset = records.offset;
+  md->commandOffset = commands.offset;
+
+  MultiDrawData *data = (MultiDrawData *) records.data;
+  auto fillRecords = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const glm::mat4 &model = frame.models[i];
+      MultiDrawData record;
+
+      record.model = model;
+      // Normal matrix: normal vectors to world coordinates
+      record.normal_to_world = glm::mat4(glm::inverseTranspose(glm::mat3(model)));
+      record.sphere = glm::vec4(glm::vec3(model[3]), meshes[objects[i].mesh].radius * objects[i].scale);
+      data[i] = record;   // write-combined memory: one sequential store
+    }
+  };
+  if (jobs)
+    jobs->parallelFor(count, 256, fillRecords);
+  else
+    fillRecords(0, count);
+
+  if (md->gpuCulling) {
+    flushRingBuffer(ring);
+
+    // The counter starts at zero, the culling pass appends to it
+    glsBindBuffer(GL_SHADER_STORAGE_BUFFER, md->countBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &md->visibleCount);
+    glsBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glsUseProgram(md->cullProgram);
+    setUniform(md->planes_uniform, frame.frustum.planes, 6);
+    setUniform(md->object_count_uniform, (int) count);
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, md->frameBuffer, md->dataOffset,
+                      count * sizeof(MultiDrawData));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, md->objectBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, md->commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, md->countBuffer);
+
+    glDispatchCompute((GLuint) ((count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE), 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    return;
+  }
+
+  // CPU culling: the visible commands, packed
+  DrawElementsIndirectCommand *command = (DrawElementsIndirectCommand *) commands.data;
+  for (size_t i = 0; i < count; i++) {
+    if (!frame.visible[i])
+      continue;
+
+    const MultiDrawMesh &mesh = md->meshes[objects[i].mesh];
+    command[md->visibleCount++] = { mesh.indexCount, 1, mesh.firstIndex, mesh.baseVertex, (GLuint) i };
+  }
+
+  flushRingBuffer(ring);
+}
+
+void submitMultiDraw(MultiDraw *md) {
+  if (!md->frameValid || md->objectCount == 0)
+    return;
+  if (!md->gpuCulling && md->visibleCount == 0)
+    return;
+
+  glsBindVertexArray(md->vao);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, md->frameBuffer, md->dataOffset,
+                    md->objectCount * sizeof(MultiDrawData));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, md->objectBuffer);
+
+  if (md->gpuCulling) {
+    glsBindBuffer(GL_DRAW_INDIRECT_BUFFER, md->commandBuffer);
+    glsBindBuffer(GL_PARAMETER_BUFFER_ARB, md->countBuffer);
+    glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, 0, md->objectCount, 0);
+  } else {
+    glsBindBuffer(GL_DRAW_INDIRECT_BUFFER, md->frameBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void *) md->commandOffset,
+                                md->visibleCount, 0);
+    md->commandsSubmitted += md->visibleCount;
+  }
+  md->indirectCalls++;
+}
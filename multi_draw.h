@@ -0,0 +1,120 @@
+// multi_draw.h: GPU-driven scene submission with glMultiDrawElementsIndirect
+//
+// Every mesh lives in one VAO (interleaved vertex buffer + index buffer) and
+// every object owns a DrawElementsIndirectCommand and a per-draw record
+// (model and normal matrices, bounding sphere) in a shader storage buffer.
+// The vertex shader (multidraw_vs.glsl) finds its record through an
+// instanced attribute fed by the command's baseInstance, so one indirect
+// call draws any number of objects. Materials come from the material table
+// (material.h) through the index in each object's static record, so the
+// whole scene is a single call whatever its textures.
+//
+// With GPU culling a compute pass (multidraw_cull_cs.glsl) tests every
+// sphere against the frustum and appends the visible commands, and the draw
+// count is read from a buffer (ARB_indirect_parameters).
+// Otherwise the CPU compacts the commands from the frame's culling results.
+// Per-draw records (and CPU commands) are written straight into the frame's
+// segment of the persistently mapped ring buffer (ring_buffer.h).
+//////////////////////////////////////////////////////////////////////
+
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+#include "ring_buffer.h"
+#include "program_reflection.h"
+
+class JobSystem;
+
+// Instanced vertex attribute holding the draw record index
+#define MULTIDRAW_DRAW_ID_ATTRIB 3
+
+// Layout fixed by the GL spec
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+// std430 record read by the shaders (normal matrix padded to a mat4)
+struct MultiDrawData {
+  glm::mat4 model;
+  glm::mat4 normal_to_world;
+  glm::vec4 sphere;           // world space center, radius
+};
+
+// Static per-object data: command for the culling pass, material for the
+// vertex shader (std430)
+struct MultiDrawObject {
+  GLuint indexCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint material;            // MaterialTable record
+};
+
+struct MultiDrawMesh {
+  GLuint firstIndex;
+  GLuint indexCount;
+  GLint baseVertex;
+};
+
+struct MultiDraw {
+  GLuint vao = 0, vbo = 0, ebo = 0, drawIdBuffer = 0, objectBuffer = 0;
+  GLuint commandBuffer = 0, countBuffer = 0;       // GPU culling
+  GLint storageAlignment = 256;                    // SSBO offset alignment
+  GLuint cullProgram = 0;
+  Uniform<glm::vec4> planes_uniform;
+  Uniform<int> object_count_uniform;
+  bool gpuCulling = false;
+
+  std::vector<float> vertices;      // position, normal, uv; freed on upload
+  std::vector<GLuint> indices;
+  std::vector<MultiDrawMesh> meshes;
+
+  GLuint objectCount = 0;           // draw record r is scene object r
+
+  // Current frame: ring buffer ranges of the records and CPU commands
+  GLuint frameBuffer = 0;
+  size_t dataOffset = 0, commandOffset = 0;
+  bool frameValid = false;
+  GLuint visibleCount = 0;
+
+  // Stats: indirect calls and (CPU culling only) commands submitted
+  unsigned long long indirectCalls = 0, commandsSubmitted = 0;
+};
+
+// Appends a mesh to the shared buffers (indices NULL: 0..vertexCount-1),
+// returns its index. Meshes must be added in scene mesh order
+int addMultiDrawMesh(MultiDraw *md, const GLfloat *positions, const GLfloat *normals,
+                     const GLfloat *texCoords, int vertexCount,
+                     const GLuint *indices, int indexCount);
+
+// Uploads the geometry and the static records of the scene objects
+// (objectMaterials: material table record of each). cullProgram 0: CPU
+// culling. False if the buffers cannot be created
+bool createMultiDraw(MultiDraw *md, const std::vector<SceneObject> &objects,
+                     const std::vector<unsigned int> &objectMaterials, GLuint cullProgram);
+void destroyMultiDraw(MultiDraw *md);
+
+// Ring buffer space one frame needs (RingBuffer segment size)
+size_t multiDrawFrameSize(const MultiDraw *md);
+
+// Per-draw records and commands for one frame, allocated from ring (runs
+// the culling pass on the GPU, which changes the current program).
+// jobs may be NULL
+void updateMultiDraw(MultiDraw *md, const FramePacket &frame,
+                     const std::vector<SceneObject> &objects,
+                     const std::vector<Mesh> &meshes, RingBuffer *ring, JobSystem *jobs);
+
+// Draws the scene with the current program and its pass uniforms; the
+// material table must be bound
+void submitMultiDraw(MultiDraw *md);
+
+#endif
@@ -0,0 +1,32 @@
+// multi_view.cpp: several cameras drawn in one submission, one viewport each
+
+#include "multi_view.h"
+
+#include <math.h>
+
+bool instancedViewsSupported() {
+  return GLEW_VERSION_4_1 &&
+         (GLEW_ARB_shader_viewport_layer_array || GLEW_AMD_vertex_shader_viewport_index);
+}
+
+void layoutViews(int count, int width, int height, glm::vec4 *viewports) {
+  int columns = (int) ceil(sqrt((double) count));
+  int rows = (count + columns - 1) / columns;
+  int cellWidth = width / columns, cellHeight = height / rows;
+  if (cellWidth < 1)
+    cellWidth = 1;
+  if (cellHeight < 1)
+    cellHeight = 1;
+
+  // GL puts y = 0 at the bottom
+  for (int i = 0; i < count; i++) {
+    int column = i % columns, row = i / columns;
+    viewports[i] = glm::vec4((float) (column * cellWidth),
+                             (float) (height - (row + 1) * cellHeight),
+                             (float) cellWidth, (float) cellHeight);
+  }
+}
+
+void setViewports(const glm::vec4 *viewports, int count) {
+  glViewportArrayv(0, count, &viewports[0].x);
+}
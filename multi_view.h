@@ -0,0 +1,32 @@
+// multi_view.h: several cameras drawn in one submission, one viewport each
+//
+// The window is split into a grid of viewports, one per camera. With
+// ARB_viewport_array (GL 4.1) and a vertex shader that can write
+// gl_ViewportIndex (ARB_shader_viewport_layer_array or
+// AMD_vertex_shader_viewport_index), each object is drawn once, instanced
+// once per camera: instance i takes camera i's matrices and goes to
+// viewport i (multiview_vs.glsl). Draw calls and state changes cost the
+// same as for a single camera; only the vertex work grows with the number
+// of views. Without those extensions the caller draws the scene once per
+// viewport instead.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#define MAX_VIEWS 16   // GL_MAX_VIEWPORTS is at least 16
+
+// Whether instance i of a draw can be routed to viewport i
+bool instancedViewsSupported();
+
+// count viewports (x, y, width, height) in a grid over the window, row by
+// row from the top left
+void layoutViews(int count, int width, int height, glm::vec4 *viewports);
+
+// Sets viewports 0 to count - 1 (instanced views only)
+void setViewports(const glm::vec4 *viewports, int count);
+
+#endif
@@ -0,0 +1,51 @@
+#version 430
+
+// Frustum culling + compaction of the multi-draw commands: every visible
+// object appends its command
+layout(local_size_x = 64) in;
+
+struct DrawData {
+  mat4 model;
+  mat4 normal_to_world;
+  vec4 sphere;
+};
+
+struct DrawObject {
+  uint index_count;
+  uint first_index;
+  int base_vertex;
+  uint material;
+};
+
+struct DrawCommand {
+  uint count;
+  uint instance_count;
+  uint first_index;
+  int base_vertex;
+  uint base_instance;
+};
+
+layout(std430, binding = 0) readonly buffer DrawDataBuffer { DrawData draws[]; };
+layout(std430, binding = 1) readonly buffer DrawObjectBuffer { DrawObject objects[]; };
+layout(std430, binding = 2) writeonly buffer CommandBuffer { DrawCommand commands[]; };
+layout(std430, binding = 3) buffer CountBuffer { uint command_count; };
+
+uniform vec4 frustum_planes[6];
+uniform int object_count;
+
+void main() {
+  uint i = gl_GlobalInvocationID.x;
+  if (i >= uint(object_count))
+    return;
+
+  vec4 sphere = draws[i].sphere;
+  for (int p = 0; p < 6; p++) {
+    if (dot(frustum_planes[p].xyz, sphere.xyz) + frustum_planes[p].w < -sphere.w)
+      return;
+  }
+
+  DrawObject object = objects[i];
+  uint slot = atomicAdd(command_count, 1u);
+  commands[slot] =
+    DrawCommand(object.index_count, 1u, object.first_index, object.base_vertex, i);
+}
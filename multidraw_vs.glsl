@@ -0,0 +1,66 @@
+#version 430
+
+in vec3 v_pos;
+in vec3 v_normal;
+in vec2 v_tex;
+in uint v_draw_id;   // baseInstance of the indirect command
+
+out vec3 frag_3Dpos;
+out vec3 vs_normal;
+out vec2 vs_tex_coord;
+flat out ivec2 vs_material_layers;   // diffuse, specular (material.h)
+flat out float vs_shininess;
+
+// Shared by the prepass and shading programs of the multi-draw path
+invariant gl_Position;
+
+// Same layout as MultiDrawData (multi_draw.h)
+struct DrawData {
+  mat4 model;
+  mat4 normal_to_world;
+  vec4 sphere;
+};
+
+layout(std430, binding = 0) readonly buffer DrawDataBuffer {
+  DrawData draws[];
+};
+
+// Static per-object data (MultiDrawObject) and material table (MaterialRecord)
+struct DrawObject {
+  uint index_count;
+  uint first_index;
+  int base_vertex;
+  uint material;
+};
+
+struct MaterialRecord {
+  int diffuse_layer;
+  int specular_layer;
+  float shininess;
+  float pad;
+};
+
+layout(std430, binding = 1) readonly buffer DrawObjectBuffer {
+  DrawObject objects[];
+};
+
+layout(std430, binding = 4) readonly buffer MaterialBuffer {
+  MaterialRecord materials[];
+};
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+  mat4 model = draws[v_draw_id].model;
+
+  frag_3Dpos = vec3(model * vec4(v_pos, 1.0));
+  vs_normal = normalize(mat3(draws[v_draw_id].normal_to_world) * v_normal);
+
+  gl_Position = projection * view * model * vec4(v_pos, 1.0f);
+  vs_tex_coord = v_tex;
+
+  MaterialRecord material = materials[objects[v_draw_id].material];
+  vs_material_layers = ivec2(material.diffuse_layer, material.specular_layer);
+  vs_shininess = material.shininess;
+}
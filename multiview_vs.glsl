@@ -0,0 +1,34 @@
+#version 410
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+
+// Multi-view (multi_view.h): instance i is seen by camera i and goes to
+// viewport i. MULTI_VIEW, the number of cameras, is defined by the app
+
+in vec3 v_pos;
+in vec3 v_normal;
+in vec2 v_tex;
+
+out vec3 frag_3Dpos;
+out vec3 vs_normal;
+out vec2 vs_tex_coord;
+flat out int vs_view;
+
+// Shared by the prepass and shading programs of the multi-view path
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 views[MULTI_VIEW];
+uniform mat4 projections[MULTI_VIEW];
+uniform mat3 normal_to_world;
+
+void main() {
+  vs_view = gl_InstanceID;
+  gl_ViewportIndex = gl_InstanceID;
+
+  frag_3Dpos = vec3(model * vec4(v_pos, 1.0));
+  vs_normal = normalize(normal_to_world * v_normal);
+
+  gl_Position = projections[vs_view] * views[vs_view] * model * vec4(v_pos, 1.0f);
+  vs_tex_coord = v_tex;
+}
@@ -0,0 +1,219 @@
+// program_reflection.cpp: active uniforms and blocks of linked programs
+
+#include "program_reflection.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define REFLECTION_NAME_SIZE 256
+
+struct UniformEntry {
+  uint32_t hash;
+  uint32_t nameOffset;         // into ProgramReflection::names
+  ReflectedUniform uniform;
+};
+
+struct BlockEntry {
+  uint32_t nameOffset;
+  ReflectedBlock block;
+};
+
+struct ProgramReflection {
+  std::vector<UniformEntry> uniforms;
+  std::vector<int> table;      // power of two, uniform index or -1
+  std::vector<BlockEntry> blocks;
+  std::string names;           // NUL separated
+};
+
+// GL objects belong to the context: only touched from its thread
+static std::unordered_map<GLuint, ProgramReflection> reflections;
+
+// FNV-1a of the name without a trailing "[0]"
+static uint32_t nameHash(const char *name, size_t *length) {
+  size_t n = strlen(name);
+  if (n > 3 && strcmp(name + n - 3, "[0]") == 0)
+    n -= 3;
+  *length = n;
+
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < n; i++) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static uint32_t addName(ProgramReflection *reflection, const char *name, size_t length) {
+  uint32_t offset = (uint32_t) reflection->names.size();
+  reflection->names.append(name, length);
+  reflection->names.push_back('\0');
+  return offset;
+}
+
+static void addUniform(ProgramReflection *reflection, const char *name,
+                       GLint location, GLenum type, GLint arraySize) {
+  // Uniforms in blocks have no location: the block is what gets bound
+  if (location < 0)
+    return;
+
+  size_t length;
+  UniformEntry entry;
+  entry.hash = nameHash(name, &length);
+  entry.nameOffset = addName(reflection, name, length);
+  entry.uniform.location = location;
+  entry.uniform.type = type;
+  entry.uniform.arraySize = arraySize;
+  reflection->uniforms.push_back(entry);
+}
+
+static void addBlock(ProgramReflection *reflection, const char *name, GLenum interface,
+                     GLint index, GLint binding, GLint dataSize) {
+  size_t length;
+  nameHash(name, &length);
+
+  BlockEntry entry;
+  entry.nameOffset = addName(reflection, name, length);
+  entry.block.interface = interface;
+  entry.block.index = index;
+  entry.block.binding = binding;
+  entry.block.dataSize = dataSize;
+  reflection->blocks.push_back(entry);
+}
+
+// GL 4.3 / ARB_program_interface_query
+static void queryInterfaces(GLuint program, ProgramReflection *reflection) {
+  char name[REFLECTION_NAME_SIZE];
+  GLint count = 0;
+
+  glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+  const GLenum uniformProps[] = { GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE };
+  for (GLint i = 0; i < count; i++) {
+    GLint values[3];
+    glGetProgramResourceiv(program, GL_UNIFORM, i, 3, uniformProps, 3, NULL, values);
+    glGetProgramResourceName(program, GL_UNIFORM, i, sizeof(name), NULL, name);
+    addUniform(reflection, name, values[0], (GLenum) values[1], values[2]);
+  }
+
+  const GLenum interfaces[] = { GL_UNIFORM_BLOCK, GL_SHADER_STORAGE_BLOCK };
+  const GLenum blockProps[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+  for (int k = 0; k < 2; k++) {
+    glGetProgramInterfaceiv(program, interfaces[k], GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; i++) {
+      GLint values[2];
+      glGetProgramResourceiv(program, interfaces[k], i, 2, blockProps, 2, NULL, values);
+      glGetProgramResourceName(program, interfaces[k], i, sizeof(name), NULL, name);
+      addBlock(reflection, name, interfaces[k], i, values[0], values[1]);
+    }
+  }
+}
+
+// GL 3.x: the older per-uniform queries (uniform blocks only)
+static void queryActiveUniforms(GLuint program, ProgramReflection *reflection) {
+  char name[REFLECTION_NAME_SIZE];
+  GLint count = 0;
+
+  glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+  for (GLint i = 0; i < count; i++) {
+    GLint arraySize;
+    GLenum type;
+    glGetActiveUniform(program, (GLuint) i, sizeof(name), NULL, &arraySize, &type, name);
+    addUniform(reflection, name, glGetUniformLocation(program, name), type, arraySize);
+  }
+
+  glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+  for (GLint i = 0; i < count; i++) {
+    GLint binding, dataSize;
+    glGetActiveUniformBlockName(program, (GLuint) i, sizeof(name), NULL, name);
+    glGetActiveUniformBlockiv(program, (GLuint) i, GL_UNIFORM_BLOCK_BINDING, &binding);
+    glGetActiveUniformBlockiv(program, (GLuint) i, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+    addBlock(reflection, name, GL_UNIFORM_BLOCK, i, binding, dataSize);
+  }
+}
+
+void reflectProgram(GLuint program) {
+  ProgramReflection &reflection = reflections[program];
+  reflection = ProgramReflection();
+
+  if (GLEW_VERSION_4_3 || GLEW_ARB_program_interface_query)
+    queryInterfaces(program, &reflection);
+  else
+    queryActiveUniforms(program, &reflection);
+
+  // Load factor <= 1/2, linear probing
+  size_t size = 8;
+  while (size < reflection.uniforms.size() * 2)
+    size *= 2;
+  reflection.table.assign(size, -1);
+  for (size_t i = 0; i < reflection.uniforms.size(); i++) {
+    size_t slot = reflection.uniforms[i].hash & (size - 1);
+    while (reflection.table[slot] >= 0)
+      slot = (slot + 1) & (size - 1);
+    reflection.table[slot] = (int) i;
+  }
+}
+
+void forgetProgram(GLuint program) {
+  reflections.erase(program);
+}
+
+const ReflectedUniform *findReflectedUniform(GLuint program, const char *name) {
+  std::unordered_map<GLuint, ProgramReflection>::const_iterator it = reflections.find(program);
+  if (it == reflections.end())
+    return NULL;
+  const ProgramReflection &reflection = it->second;
+
+  size_t length;
+  uint32_t hash = nameHash(name, &length);
+  size_t mask = reflection.table.size() - 1;
+  for (size_t slot = hash & mask; reflection.table[slot] >= 0; slot = (slot + 1) & mask) {
+    const UniformEntry &entry = reflection.uniforms[reflection.table[slot]];
+    const char *entryName = reflection.names.c_str() + entry.nameOffset;
+    if (entry.hash == hash && strncmp(entryName, name, length) == 0 && entryName[length] == '\0')
+      return &entry.uniform;
+  }
+  return NULL;
+}
+
+const ReflectedBlock *findReflectedBlock(GLuint program, const char *name) {
+  std::unordered_map<GLuint, ProgramReflection>::const_iterator it = reflections.find(program);
+  if (it == reflections.end())
+    return NULL;
+
+  // A handful per program: no table needed
+  for (size_t i = 0; i < it->second.blocks.size(); i++) {
+    const BlockEntry &entry = it->second.blocks[i];
+    if (strcmp(it->second.names.c_str() + entry.nameOffset, name) == 0)
+      return &entry.block;
+  }
+  return NULL;
+}
+
+bool uniformTypeMatches(GLenum type, const int *) {
+  switch (type) {
+  case GL_INT: case GL_BOOL:
+  case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+  case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+  case GL_SAMPLER_2D_ARRAY_SHADOW: case GL_SAMPLER_CUBE_SHADOW: case GL_SAMPLER_BUFFER:
+  case GL_SAMPLER_2D_RECT: case GL_SAMPLER_CUBE_MAP_ARRAY:
+  case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool uniformTypeMatches(GLenum type, const float *) { return type == GL_FLOAT; }
+bool uniformTypeMatches(GLenum type, const glm::vec3 *) { return type == GL_FLOAT_VEC3; }
+bool uniformTypeMatches(GLenum type, const glm::vec4 *) { return type == GL_FLOAT_VEC4; }
+bool uniformTypeMatches(GLenum type, const glm::mat3 *) { return type == GL_FLOAT_MAT3; }
+bool uniformTypeMatches(GLenum type, const glm::mat4 *) { return type == GL_FLOAT_MAT4; }
+
+void reportUniformTypeMismatch(GLuint program, const char *name, GLenum type) {
+  fprintf(stderr, "WARNING: uniform %s of program %u has GL type 0x%04x, not the one requested\n",
+          name, program, type);
+}
@@ -0,0 +1,106 @@
+// program_reflection.h: active uniforms and blocks of linked programs
+//
+// reflectProgram() runs once when a program links: it enumerates the
+// active uniforms and the uniform / shader storage blocks (program
+// interface queries on GL 4.3, glGetActiveUniform and friends before) into
+// an open addressing table keyed by the FNV-1a hash of the name. Code asks
+// for typed handles by name at setup time and only uses the handles
+// afterwards, so frames never look anything up:
+//
+//   Uniform<glm::vec3> viewPos = findUniform<glm::vec3>(program, "view_pos");
+//   setUniform(viewPos, frame.cameraPos);
+//
+// A name the program doesn't have (or the compiler optimised out) gives a
+// handle with location -1, which the setters skip; asking with the wrong
+// type is reported and also gives -1. Arrays answer to "name" and
+// "name[0]". Setters go through the gl_state cache: the program must be
+// current.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef PROGRAM_REFLECTION_H
+#define PROGRAM_REFLECTION_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "gl_state.h"
+
+struct ReflectedUniform {
+  GLint location;
+  GLenum type;                 // GL_FLOAT_VEC3, GL_SAMPLER_2D...
+  GLint arraySize;             // 1 if not an array
+};
+
+struct ReflectedBlock {
+  GLenum interface;            // GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK
+  GLint index;
+  GLint binding;
+  GLint dataSize;              // bytes (minimum, for storage blocks)
+};
+
+// Call once the program linked successfully; replaces older data for the id
+void reflectProgram(GLuint program);
+void forgetProgram(GLuint program);
+
+// NULL if the program has no such active uniform / block
+const ReflectedUniform *findReflectedUniform(GLuint program, const char *name);
+const ReflectedBlock *findReflectedBlock(GLuint program, const char *name);
+
+template <typename T>
+struct Uniform {
+  GLint location = -1;
+};
+
+// Whether a GL uniform type can be set as T (int covers bools and samplers)
+bool uniformTypeMatches(GLenum type, const int *);
+bool uniformTypeMatches(GLenum type, const float *);
+bool uniformTypeMatches(GLenum type, const glm::vec3 *);
+bool uniformTypeMatches(GLenum type, const glm::vec4 *);
+bool uniformTypeMatches(GLenum type, const glm::mat3 *);
+bool uniformTypeMatches(GLenum type, const glm::mat4 *);
+void reportUniformTypeMismatch(GLuint program, const char *name, GLenum type);
+
+template <typename T>
+Uniform<T> findUniform(GLuint program, const char *name) {
+  Uniform<T> handle;
+  const ReflectedUniform *uniform = findReflectedUniform(program, name);
+  if (!uniform)
+    return handle;
+  if (!uniformTypeMatches(uniform->type, (const T *) NULL)) {
+    reportUniformTypeMismatch(program, name, uniform->type);
+    return handle;
+  }
+  handle.location = uniform->location;
+  return handle;
+}
+
+inline void setUniform(Uniform<int> u, int value) {
+  glsUniform1i(u.location, value);
+}
+inline void setUniform(Uniform<float> u, float value) {
+  glsUniform1f(u.location, value);
+}
+inline void setUniform(Uniform<float> u, const float *values, int count) {
+  glsUniform1fv(u.location, count, values);
+}
+inline void setUniform(Uniform<glm::vec3> u, const glm::vec3 &value) {
+  glsUniform3fv(u.location, 1, glm::value_ptr(value));
+}
+inline void setUniform(Uniform<glm::vec3> u, const glm::vec3 *values, int count) {
+  glsUniform3fv(u.location, count, glm::value_ptr(values[0]));
+}
+inline void setUniform(Uniform<glm::vec4> u, const glm::vec4 *values, int count) {
+  glsUniform4fv(u.location, count, glm::value_ptr(values[0]));
+}
+inline void setUniform(Uniform<glm::mat3> u, const glm::mat3 &value) {
+  glsUniformMatrix3fv(u.location, 1, GL_FALSE, glm::value_ptr(value));
+}
+inline void setUniform(Uniform<glm::mat4> u, const glm::mat4 &value) {
+  glsUniformMatrix4fv(u.location, 1, GL_FALSE, glm::value_ptr(value));
+}
+inline void setUniform(Uniform<glm::mat4> u, const glm::mat4 *values, int count) {
+  glsUniformMatrix4fv(u.location, count, GL_FALSE, glm::value_ptr(values[0]));
+}
+
+#endif
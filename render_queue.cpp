@@ -0,0 +1,147 @@
+// render_queue.cpp: sort-key based draw command queue
+
+#include "render_queue.h"
+#include "gl_state.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#define KEY_PASS_SHIFT     60
+#define KEY_PROGRAM_SHIFT  48
+#define KEY_DIFFUSE_SHIFT  36
+#define KEY_SPECULAR_SHIFT 24
+#define KEY_DEPTH_BITS     24
+
+unsigned long long makeSortKey(RenderPass pass, GLuint program,
+                               unsigned int diffuseMap, unsigned int specularMap,
+                               float depth) {
+  // GL names are small integers, masking them only risks sorting two
+  // materials together, never drawing with the wrong one
+  unsigned long long key = (unsigned long long) (pass & 0xF) << KEY_PASS_SHIFT;
+  key |= (unsigned long long) (program & 0xFFF) << KEY_PROGRAM_SHIFT;
+  key |= (unsigned long long) (diffuseMap & 0xFFF) << KEY_DIFFUSE_SHIFT;
+  key |= (unsigned long long) (specularMap & 0xFFF) << KEY_SPECULAR_SHIFT;
+
+  // d / (d + 1) keeps the order of any distance without knowing the far plane
+  if (depth < 0.0f)
+    depth = 0.0f;
+  float normalized = depth / (depth + 1.0f);
+  unsigned long long quantized = (unsigned long long) (normalized * (float) (1 << KEY_DEPTH_BITS));
+  if (quantized >= (1ull << KEY_DEPTH_BITS))
+    quantized = (1ull << KEY_DEPTH_BITS) - 1;
+
+  return key | quantized;
+}
+
+void clearRenderQueue(RenderQueue *queue, Arena *arena, size_t capacity) {
+  // The previous frame's arrays belong to the other arena, just drop them
+  queue->items = ArenaVector<DrawItem>(ArenaAllocator<DrawItem>(arena));
+  queue->sorted = ArenaVector<RenderQueueEntry>(ArenaAllocator<RenderQueueEntry>(arena));
+  queue->scratch = ArenaVector<RenderQueueEntry>(ArenaAllocator<RenderQueueEntry>(arena));
+  queue->items.reserve(capacity);
+}
+
+void pushDrawItem(RenderQueue *queue, const DrawItem &item) {
+  queue->items.push_back(item);
+}
+
+// LSD radix sort, one byte per pass. Bytes shared by every key (usually
+// the pass and most of the depth on small scenes) are skipped
+void sortRenderQueue(RenderQueue *queue) {
+  size_t count = queue->items.size();
+  queue->sorted.resize(count);
+  queue->scratch.resize(count);
+  if (count == 0)
+    return;
+
+  for (size_t i = 0; i < count; i++)
+    queue->sorted[i] = { queue->items[i].key, (unsigned int) i };
+
+  RenderQueueEntry *src = queue->sorted.data();
+  RenderQueueEntry *dst = queue->scratch.data();
+
+  for (int shift = 0; shift < 64; shift += 8) {
+    size_t offsets[256];
+    memset(offsets, 0, sizeof(offsets));
+    for (size_t i = 0; i < count; i++)
+      offsets[(src[i].key >> shift) & 0xFF]++;
+
+    if (offsets[(src[0].key >> shift) & 0xFF] == count)
+      continue;
+
+    size_t total = 0;
+    for (int d = 0; d < 256; d++) {
+      size_t c = offsets[d];
+      offsets[d] = total;
+      total += c;
+    }
+    for (size_t i = 0; i < count; i++)
+      dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+    std::swap(src, dst);
+  }
+
+  if (src != queue->sorted.data())
+    memcpy(queue->sorted.data(), src, count * sizeof(RenderQueueEntry));
+}
+
+void submitRenderQueue(RenderQueue *queue, RenderPass pass, int instances) {
+  unsigned long long first = (unsigned long long) pass << KEY_PASS_SHIFT;
+  ArenaVector<RenderQueueEntry>::const_iterator it =
+    std::lower_bound(queue->sorted.begin(), queue->sorted.end(), first,
+                     [](const RenderQueueEntry &e, unsigned long long key) { return e.key < key; });
+
+  GLuint program = 0, vao = 0;
+  unsigned int diffuseMap = 0, specularMap = 0;
+  bool firstDraw = true;
+
+  for (; it != queue->sorted.end() && (it->key >> KEY_PASS_SHIFT) == (unsigned long long) pass; ++it) {
+    const DrawItem &item = queue->items[it->item];
+
+    if (firstDraw || item.program != program) {
+      glsUseProgram(item.program);
+      program = item.program;
+      queue->stats.programChanges++;
+    }
+    if (firstDraw || item.vao != vao) {
+      glsBindVertexArray(item.vao);
+      vao = item.vao;
+      queue->stats.vaoChanges++;
+    }
+    if (item.diffuseMap && (firstDraw || item.diffuseMap != diffuseMap)) {
+      glsBindTexture(0, GL_TEXTURE_2D, item.diffuseMap);
+      diffuseMap = item.diffuseMap;
+      queue->stats.textureChanges++;
+    }
+    if (item.specularMap && (firstDraw || item.specularMap != specularMap)) {
+      glsBindTexture(1, GL_TEXTURE_2D, item.specularMap);
+      specularMap = item.specularMap;
+      queue->stats.textureChanges++;
+    }
+    firstDraw = false;
+
+    setUniform(item.model_uniform, *item.model);
+    if (item.normal_uniform.location >= 0) {
+      // Normal matrix: normal vectors to world coordinates
+      setUniform(item.normal_uniform, glm::inverseTranspose(glm::mat3(*item.model)));
+    }
+
+    if (item.rangeCount > 0 && instances > 1) {
+      // No instanced multi-draw without indirect buffers: one draw per range
+      for (int r = 0; r < item.rangeCount; r++)
+        glDrawElementsInstanced(GL_TRIANGLES, item.rangeCounts[r], GL_UNSIGNED_INT,
+                                item.rangeOffsets[r], instances);
+    } else if (item.rangeCount > 0) {
+      glMultiDrawElements(GL_TRIANGLES, item.rangeCounts, GL_UNSIGNED_INT, item.rangeOffsets,
+                          item.rangeCount);
+    } else if (instances > 1) {
+      glDrawArraysInstanced(GL_TRIANGLES, 0, item.vertexCount, instances);
+    } else {
+      glDrawArrays(GL_TRIANGLES, 0, item.vertexCount);
+    }
+    queue->stats.draws++;
+  }
+}
@@ -0,0 +1,85 @@
+// render_queue.h: sort-key based draw command queue
+//
+// Passes submit draw items tagged with a 64-bit sort key; the queue is
+// radix sorted once per frame and each pass is then drawn in key order, so
+// objects sharing a program, VAO or textures end up next to each other.
+// Key layout, most significant bits first:
+//   63-60  pass
+//   59-48  program
+//   47-24  material (diffuse map 12 bits, specular map 12 bits)
+//   23-0   view depth, front to back
+//////////////////////////////////////////////////////////////////////
+
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "frame_arena.h"
+#include "program_reflection.h"
+
+enum RenderPass {
+  RENDER_PASS_DEPTH = 0,     // depth prepass
+  RENDER_PASS_GBUFFER = 1,   // deferred geometry pass
+  RENDER_PASS_OPAQUE = 2,    // forward shading
+  RENDER_PASS_VT_FEEDBACK = 3 // virtual texture tiles in view (virtual_texture.h)
+};
+
+struct DrawItem {
+  unsigned long long key;
+  GLuint program;
+  GLuint vao;
+  GLsizei vertexCount;
+  const glm::mat4 *model;     // must outlive the submission
+  Uniform<glm::mat4> model_uniform;
+  Uniform<glm::mat3> normal_uniform;   // location -1: no normal matrix
+  unsigned int diffuseMap;    // 0: left unbound (unit 0)
+  unsigned int specularMap;   // 0: left unbound (unit 1)
+
+  // Indexed ranges of the VAO's element buffer instead of vertexCount
+  // (meshlet.h), drawn with one glMultiDrawElements; must outlive the
+  // submission. 0: glDrawArrays
+  int rangeCount = 0;
+  const GLsizei *rangeCounts = NULL;
+  const void *const *rangeOffsets = NULL;
+};
+
+// State changes the sorted order still needed, accumulated until reset
+struct RenderQueueStats {
+  unsigned long long draws;
+  unsigned long long programChanges;
+  unsigned long long vaoChanges;
+  unsigned long long textureChanges;
+};
+
+struct RenderQueueEntry {
+  unsigned long long key;
+  unsigned int item;
+};
+
+// Item and sort arrays live in the frame arena given to clearRenderQueue
+struct RenderQueue {
+  ArenaVector<DrawItem> items;
+  ArenaVector<RenderQueueEntry> sorted, scratch;
+  RenderQueueStats stats = {};
+};
+
+// depth: view space distance (>= 0), only its order matters
+unsigned long long makeSortKey(RenderPass pass, GLuint program,
+                               unsigned int diffuseMap, unsigned int specularMap,
+                               float depth);
+
+// Starts an empty queue in arena with room for capacity items
+void clearRenderQueue(RenderQueue *queue, Arena *arena, size_t capacity);
+void pushDrawItem(RenderQueue *queue, const DrawItem &item);
+
+// Radix sort by key (stable, so equal keys keep submission order)
+void sortRenderQueue(RenderQueue *queue);
+
+// Draws the items of one pass in key order; pass uniforms and render state
+// are up to the caller. instances > 1: every item drawn that many times
+// (one instance per view, multi_view.h)
+void submitRenderQueue(RenderQueue *queue, RenderPass pass, int instances = 1);
+
+#endif
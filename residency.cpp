@@ -0,0 +1,337 @@
+// residency.cpp: GPU memory accounting and a texture memory budget
+
+#include "residency.h"
+#include "gl_state.h"
+#include "stb_image.h"
+
+#include <stdio.h>
+
+static unsigned long long resourceKey(GLenum kind, GLuint name) {
+  return (unsigned long long) kind << 32 | name;
+}
+
+static size_t texelBytes(GLint internalFormat) {
+  switch (internalFormat) {
+  case GL_RED: case GL_R8:
+    return 1;
+  case GL_RG8: case GL_R16F:
+    return 2;
+  case GL_RGBA16F:
+    return 8;
+  case GL_RGB32F:
+    return 12;
+  case GL_RGBA32F:
+    return 16;
+  default:
+    // RGB8 included: drivers store it padded to four bytes
+    return 4;
+  }
+}
+
+// Unsized format of an 8-bit colour texture (as uploadTexture creates them)
+static GLenum pixelFormat(GLint internalFormat, int *components) {
+  switch (internalFormat) {
+  case GL_RED: case GL_R8:
+    *components = 1;
+    return GL_RED;
+  case GL_RGB: case GL_RGB8:
+    *components = 3;
+    return GL_RGB;
+  default:
+    *components = 4;
+    return GL_RGBA;
+  }
+}
+
+static size_t measureTexture(GLenum target, GLuint texture) {
+  size_t bytes = 0;
+  glsBindTexture(0, target, texture);
+  for (int level = 0; level < 16; level++) {
+    GLint width = 0, height = 0, depth = 0, internalFormat = 0;
+    glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+    if (!width)
+      break;
+    glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(target, level, GL_TEXTURE_DEPTH, &depth);
+    glGetTexLevelParameteriv(target, level, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+    bytes += (size_t) width * height * (depth > 1 ? depth : 1) * texelBytes(internalFormat);
+  }
+  glsBindTexture(0, target, 0);
+  return bytes;
+}
+
+static void setBytes(ResidencyManager *rm, ResidentResource *r, size_t bytes) {
+  rm->categoryBytes[r->category] += bytes - r->bytes;
+  rm->totalBytes += bytes - r->bytes;
+  r->bytes = bytes;
+  if (rm->totalBytes > rm->peakBytes)
+    rm->peakBytes = rm->totalBytes;
+}
+
+static ResidentResource *track(ResidencyManager *rm, GLenum kind, GLuint name,
+                               ResidencyCategory category, size_t bytes) {
+  if (!name)
+    return NULL;
+
+  unsigned long long key = resourceKey(kind, name);
+  std::unordered_map<unsigned long long, size_t>::iterator it = rm->index.find(key);
+  if (it == rm->index.end()) {
+    ResidentResource r = {};
+    r.kind = kind;
+    r.name = name;
+    r.category = category;
+    it = rm->index.insert(std::make_pair(key, rm->resources.size())).first;
+    rm->resources.push_back(r);
+  }
+
+  ResidentResource *r = &rm->resources[it->second];
+  if (r->category != category) {
+    rm->categoryBytes[r->category] -= r->bytes;
+    rm->categoryBytes[category] += r->bytes;
+    r->category = category;
+  }
+  setBytes(rm, r, bytes);
+  return r;
+}
+
+void initResidency(ResidencyManager *rm, size_t budget, JobSystem *jobs) {
+  rm->budget = budget;
+  rm->jobs = jobs;
+}
+
+void destroyResidency(ResidencyManager *rm) {
+  for (size_t i = 0; i < rm->resources.size(); i++) {
+    ResidencyReload *reload = rm->resources[i].reload;
+    if (!reload)
+      continue;
+    // Helps run it; the loop covers its pool slot having been reused
+    while (!reload->done)
+      rm->jobs->wait(reload->job);
+    stbi_image_free(reload->data);
+    delete reload;
+  }
+  rm->resources.clear();
+  rm->index.clear();
+}
+
+void residencyTrackTexture(ResidencyManager *rm, GLenum target, GLuint texture,
+                           ResidencyCategory category, const char *reloadPath) {
+  ResidentResource *r = track(rm, GL_TEXTURE, texture, category, measureTexture(target, texture));
+  if (r && reloadPath && target == GL_TEXTURE_2D) {
+    r->path = reloadPath;
+    r->fullBytes = r->bytes;
+  }
+}
+
+void residencyTrackBuffer(ResidencyManager *rm, GLuint buffer, ResidencyCategory category) {
+  GLint64 size = 0;
+  glsBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glGetBufferParameteri64v(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+  glsBindBuffer(GL_COPY_READ_BUFFER, 0);
+  track(rm, GL_BUFFER, buffer, category, (size_t) size);
+}
+
+void residencyTrackRenderbuffer(ResidencyManager *rm, GLuint renderbuffer, ResidencyCategory category) {
+  GLint width = 0, height = 0, internalFormat = 0, samples = 0;
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+  glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_WIDTH, &width);
+  glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_HEIGHT, &height);
+  glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_INTERNAL_FORMAT, &internalFormat);
+  glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_SAMPLES, &samples);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  track(rm, GL_RENDERBUFFER, renderbuffer, category,
+        (size_t) width * height * (samples > 1 ? samples : 1) * texelBytes(internalFormat));
+}
+
+void residencyForget(ResidencyManager *rm, GLenum kind, GLuint name) {
+  std::unordered_map<unsigned long long, size_t>::iterator it = rm->index.find(resourceKey(kind, name));
+  if (it == rm->index.end())
+    return;
+
+  size_t i = it->second;
+  setBytes(rm, &rm->resources[i], 0);
+  rm->index.erase(it);
+  if (i + 1 != rm->resources.size()) {
+    rm->resources[i] = rm->resources.back();
+    rm->index[resourceKey(rm->resources[i].kind, rm->resources[i].name)] = i;
+  }
+  rm->resources.pop_back();
+}
+
+void residencyTouch(ResidencyManager *rm, GLuint texture) {
+  std::unordered_map<unsigned long long, size_t>::iterator it =
+    rm->index.find(resourceKey(GL_TEXTURE, texture));
+  if (it != rm->index.end())
+    rm->resources[it->second].lastUsed = rm->frame;
+}
+
+// Level sizes of the bound GL_TEXTURE_2D
+static int textureLevels(std::vector<GLint> *widths, std::vector<GLint> *heights) {
+  for (int level = 0; level < 16; level++) {
+    GLint width = 0, height = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+    if (!width)
+      break;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+    widths->push_back(width);
+    heights->push_back(height);
+  }
+  return (int) widths->size();
+}
+
+// Level l becomes level l - 1; the last one is freed. With whole, level 0
+// is the last level (one texel: the average colour) and the rest is freed
+static void shrinkTexture(ResidentResource *r, bool whole) {
+  glsBindTexture(0, GL_TEXTURE_2D, r->name);
+  std::vector<GLint> widths, heights;
+  int levels = textureLevels(&widths, &heights);
+  GLint internalFormat = 0;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+  int components;
+  GLenum format = pixelFormat(internalFormat, &components);
+
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  std::vector<unsigned char> texels;
+  int first = whole ? levels - 1 : 1;
+  for (int l = first; l < levels; l++) {
+    texels.resize((size_t) widths[l] * heights[l] * components);
+    glGetTexImage(GL_TEXTURE_2D, l, format, GL_UNSIGNED_BYTE, texels.data());
+    glTexImage2D(GL_TEXTURE_2D, l - first, format, widths[l], heights[l], 0, format,
+                 GL_UNSIGNED_BYTE, texels.data());
+  }
+  for (int l = levels - first; l < levels; l++)
+    glTexImage2D(GL_TEXTURE_2D, l, format, 0, 0, 0, format, GL_UNSIGNED_BYTE, NULL);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glsBindTexture(0, GL_TEXTURE_2D, 0);
+}
+
+// Least recently used evictable texture not drawn in the last frames
+static int evictionCandidate(const ResidencyManager *rm) {
+  int best = -1;
+  for (size_t i = 0; i < rm->resources.size(); i++) {
+    const ResidentResource &r = rm->resources[i];
+    if (!r.path || r.evicted || r.reload || r.lastUsed + RESIDENCY_KEEP_FRAMES > rm->frame)
+      continue;
+    if (best < 0 || r.lastUsed < rm->resources[best].lastUsed)
+      best = (int) i;
+  }
+  return best;
+}
+
+// One mip level (or the whole texture, once small) off the LRU texture
+static bool evictStep(ResidencyManager *rm) {
+  int i = evictionCandidate(rm);
+  if (i < 0)
+    return false;
+
+  ResidentResource *r = &rm->resources[i];
+  std::vector<GLint> widths, heights;
+  glsBindTexture(0, GL_TEXTURE_2D, r->name);
+  int levels = textureLevels(&widths, &heights);
+
+  bool whole = levels < 2 ||
+               (widths[1] < RESIDENCY_MIN_SIZE && heights[1] < RESIDENCY_MIN_SIZE);
+  shrinkTexture(r, whole);
+  if (whole) {
+    r->evicted = true;
+    rm->stats.textureEvictions++;
+  } else {
+    r->droppedLevels++;
+    rm->stats.mipEvictions++;
+  }
+
+  size_t before = r->bytes;
+  setBytes(rm, r, measureTexture(GL_TEXTURE_2D, r->name));
+  rm->stats.evictedBytes += before - r->bytes;
+  return true;
+}
+
+static void startReload(ResidencyManager *rm, ResidentResource *r) {
+  ResidencyReload *reload = new ResidencyReload();
+  const char *path = r->path;
+  r->reload = reload;
+  reload->job = rm->jobs->create([reload, path] {
+    reload->data = stbi_load(path, &reload->width, &reload->height, &reload->components, 0);
+    reload->done = true;
+  });
+  rm->jobs->run(reload->job);
+
+  // Without workers nothing else would ever run it: decode it now
+  if (rm->jobs->threadCount() == 1)
+    rm->jobs->wait(reload->job);
+}
+
+static void finishReload(ResidencyManager *rm, ResidentResource *r) {
+  ResidencyReload *reload = r->reload;
+  r->reload = NULL;
+
+  if (!reload->data) {
+    fprintf(stderr, "ERROR: could not reload %s, keeping it reduced\n", r->path);
+    r->path = NULL;   // pinned as it is
+  } else {
+    GLenum format = reload->components == 1 ? GL_RED : reload->components == 4 ? GL_RGBA : GL_RGB;
+    glsBindTexture(0, GL_TEXTURE_2D, r->name);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, reload->width, reload->height, 0, format,
+                 GL_UNSIGNED_BYTE, reload->data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glsBindTexture(0, GL_TEXTURE_2D, 0);
+
+    r->droppedLevels = 0;
+    r->evicted = false;
+    setBytes(rm, r, measureTexture(GL_TEXTURE_2D, r->name));
+    rm->stats.reloads++;
+  }
+
+  stbi_image_free(reload->data);
+  delete reload;
+}
+
+void updateResidency(ResidencyManager *rm) {
+  rm->frame++;
+
+  for (size_t i = 0; i < rm->resources.size(); i++) {
+    ResidentResource *r = &rm->resources[i];
+    if (r->reload && r->reload->done)
+      finishReload(rm, r);
+  }
+
+  // Reduced textures drawn last frame come back, if evicting colder ones
+  // makes room
+  for (size_t i = 0; i < rm->resources.size(); i++) {
+    ResidentResource *r = &rm->resources[i];
+    if (!r->path || r->reload || (!r->droppedLevels && !r->evicted) || r->lastUsed + 1 < rm->frame)
+      continue;
+
+    size_t needed = r->fullBytes > r->bytes ? r->fullBytes - r->bytes : 0;
+    while (rm->budget && rm->totalBytes + needed > rm->budget && evictStep(rm))
+      ;
+    if (!rm->budget || rm->totalBytes + needed <= rm->budget)
+      startReload(rm, &rm->resources[i]);
+    else
+      rm->stats.reloadsDeferred++;
+  }
+
+  while (rm->budget && rm->totalBytes > rm->budget && evictStep(rm))
+    ;
+}
+
+void reportResidency(const ResidencyManager *rm) {
+  const double mb = 1024.0 * 1024.0;
+  const size_t *c = rm->categoryBytes;
+  printf("Residency: %.1f MB (geometry %.1f, materials %.1f, targets %.1f, streaming %.1f, "
+         "other %.1f), peak %.1f MB",
+         rm->totalBytes / mb, c[RESIDENCY_GEOMETRY] / mb, c[RESIDENCY_MATERIAL] / mb,
+         c[RESIDENCY_RENDER_TARGET] / mb, c[RESIDENCY_STREAMING] / mb, c[RESIDENCY_OTHER] / mb,
+         rm->peakBytes / mb);
+  if (rm->budget) {
+    const ResidencyStats &s = rm->stats;
+    printf(", budget %.1f MB: %llu mip / %llu texture evictions (%.1f MB), %llu reloads, "
+           "%llu deferred", rm->budget / mb, s.mipEvictions, s.textureEvictions,
+           s.evictedBytes / mb, s.reloads, s.reloadsDeferred);
+  }
+  printf("\n");
+}
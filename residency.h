@@ -0,0 +1,109 @@
+// residency.h: GPU memory accounting and a texture memory budget
+//
+// Every texture, buffer and renderbuffer the app creates is registered here
+// with a category. Sizes are estimated from dimensions and formats, since
+// drivers pad and compress as they like. Textures loaded from a file may
+// also be evicted to keep the total under a budget:
+//  - The least recently used one loses its top mip level, then the next.
+//  - Below RESIDENCY_MIN_SIZE texels it becomes a single texel of its
+//    average colour.
+//  - Dropping a level reads the remaining levels back and re-specifies
+//    them. That is a synchronous readback, so it only happens when over
+//    budget.
+// A reduced texture that gets drawn (residencyTouch) is decoded again from
+// its file on the job system. It is uploaded at full size once that is
+// done and there is room. Everything else (geometry, render targets,
+// generated textures) is pinned, and only counted.
+//
+// Textures keep their GL names through all of this, so nothing that refers
+// to them has to change. Render thread only (GL), except the decode jobs.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+#include "jobs.h"
+
+#define RESIDENCY_MIN_SIZE 8       // smallest mip kept before whole eviction
+#define RESIDENCY_KEEP_FRAMES 2    // textures drawn this recently are never evicted
+
+enum ResidencyCategory {
+  RESIDENCY_GEOMETRY,
+  RESIDENCY_MATERIAL,
+  RESIDENCY_RENDER_TARGET,
+  RESIDENCY_STREAMING,       // virtual texture, per-frame ring
+  RESIDENCY_OTHER,
+  RESIDENCY_CATEGORIES
+};
+
+// Image decoded by a reload job; done is set last
+struct ResidencyReload {
+  Job *job = NULL;
+  std::atomic<bool> done{false};
+  unsigned char *data = NULL;
+  int width = 0, height = 0, components = 0;
+};
+
+struct ResidentResource {
+  GLenum kind;                  // GL_TEXTURE, GL_BUFFER or GL_RENDERBUFFER
+  GLuint name;
+  ResidencyCategory category;
+  size_t bytes;
+
+  // Evictable textures only
+  const char *path;             // NULL: pinned
+  size_t fullBytes;             // as loaded
+  int droppedLevels;
+  bool evicted;                 // down to one texel
+  unsigned long long lastUsed;
+  ResidencyReload *reload;      // decode in flight
+};
+
+struct ResidencyStats {
+  unsigned long long mipEvictions, textureEvictions;
+  unsigned long long reloads, reloadsDeferred;
+  size_t evictedBytes;
+};
+
+struct ResidencyManager {
+  size_t budget = 0;            // bytes; 0: account only
+  JobSystem *jobs = NULL;
+  std::vector<ResidentResource> resources;
+  std::unordered_map<unsigned long long, size_t> index;   // (kind, name) -> resource
+  size_t categoryBytes[RESIDENCY_CATEGORIES] = {};
+  size_t totalBytes = 0, peakBytes = 0;
+  unsigned long long frame = 0;
+  ResidencyStats stats = {};
+};
+
+void initResidency(ResidencyManager *rm, size_t budget, JobSystem *jobs);
+// Waits for the reload jobs; the GL objects themselves belong to their owners
+void destroyResidency(ResidencyManager *rm);
+
+// Registers (or, for a name already known, re-measures) a GL object.
+// reloadPath: file a GL_TEXTURE_2D was loaded from, which makes it evictable
+// (the string must outlive the manager)
+void residencyTrackTexture(ResidencyManager *rm, GLenum target, GLuint texture,
+                           ResidencyCategory category, const char *reloadPath = NULL);
+void residencyTrackBuffer(ResidencyManager *rm, GLuint buffer, ResidencyCategory category);
+void residencyTrackRenderbuffer(ResidencyManager *rm, GLuint renderbuffer, ResidencyCategory category);
+// Before deleting a tracked object
+void residencyForget(ResidencyManager *rm, GLenum kind, GLuint name);
+
+// The texture is drawn this frame
+void residencyTouch(ResidencyManager *rm, GLuint texture);
+
+// Once per frame: uploads finished reloads, starts reloads of reduced
+// textures in use, evicts down to the budget
+void updateResidency(ResidencyManager *rm);
+
+// Resident bytes by category and eviction counts
+void reportResidency(const ResidencyManager *rm);
+
+#endif
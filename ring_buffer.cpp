@@ -0,0 +1,117 @@
+// ring_buffer.cpp: persistently mapped ring buffer for per-frame GPU data
+
+#include "ring_buffer.h"
+#include "gl_state.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+bool createRingBuffer(RingBuffer *ring, size_t segmentSize) {
+  destroyRingBuffer(ring);
+
+  // Segments start on a generous boundary so any alignment request fits
+  segmentSize = (segmentSize + 255) & ~(size_t) 255;
+  size_t size = segmentSize * RING_SEGMENTS;
+
+  ring->segmentSize = segmentSize;
+  ring->persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+  glGenBuffers(1, &ring->buffer);
+  glsBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+
+  if (ring->persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+    ring->mapped = (unsigned char *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+  } else {
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+    ring->mapped = (unsigned char *) malloc(size);
+  }
+  glsBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  if (!ring->mapped) {
+    fprintf(stderr, "ERROR: could not map the frame ring buffer (%zu bytes)\n", size);
+    destroyRingBuffer(ring);
+    return false;
+  }
+
+  // Start on the last segment so the first frame gets segment 0
+  ring->segment = RING_SEGMENTS - 1;
+  ring->head = ring->flushed = ring->segment * segmentSize;
+  return true;
+}
+
+void destroyRingBuffer(RingBuffer *ring) {
+  for (int i = 0; i < RING_SEGMENTS; i++)
+    if (ring->fences[i])
+      glDeleteSync(ring->fences[i]);
+
+  if (ring->buffer) {
+    if (ring->persistent && ring->mapped) {
+      glsBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+      glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+      glsBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    glsDeleteBuffers(1, &ring->buffer);
+  }
+  if (!ring->persistent)
+    free(ring->mapped);
+
+  *ring = RingBuffer();
+}
+
+void beginRingFrame(RingBuffer *ring) {
+  ring->segment = (ring->segment + 1) % RING_SEGMENTS;
+  ring->head = ring->flushed = ring->segment * ring->segmentSize;
+
+  GLsync fence = ring->fences[ring->segment];
+  if (!fence)
+    return;
+
+  // Only blocks when the GPU is RING_SEGMENTS frames behind
+  GLenum status = glClientWaitSync(fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    ring->fenceWaits++;
+    do {
+      status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+    } while (status == GL_TIMEOUT_EXPIRED);
+  }
+  if (status == GL_WAIT_FAILED)
+    fprintf(stderr, "ERROR: frame ring fence wait failed\n");
+
+  glDeleteSync(fence);
+  ring->fences[ring->segment] = 0;
+}
+
+void endRingFrame(RingBuffer *ring) {
+  ring->fences[ring->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+RingAllocation ringAlloc(RingBuffer *ring, size_t size, size_t alignment) {
+  RingAllocation allocation = { 0, NULL };
+
+  size_t end = (ring->segment + 1) * ring->segmentSize;
+  size_t offset = (ring->head + alignment - 1) & ~(alignment - 1);
+  if (offset + size > end) {
+    ring->overflows++;
+    return allocation;
+  }
+
+  ring->head = offset + size;
+  ring->bytesAllocated += size;
+
+  allocation.offset = offset;
+  allocation.data = ring->mapped + offset;
+  return allocation;
+}
+
+void flushRingBuffer(RingBuffer *ring) {
+  if (ring->persistent || ring->flushed == ring->head)
+    return;
+
+  glsBindBuffer(GL_COPY_WRITE_BUFFER, ring->buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, ring->flushed, ring->head - ring->flushed,
+                  ring->mapped + ring->flushed);
+  glsBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  ring->flushed = ring->head;
+}
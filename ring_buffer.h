@@ -0,0 +1,60 @@
+// ring_buffer.h: persistently mapped ring buffer for per-frame GPU data
+//
+// One buffer object split into RING_SEGMENTS segments, mapped once with
+// GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT. Each frame bump-allocates
+// from its own segment and writes straight into the mapping; the segment is
+// fenced when the frame is submitted and only reused once that fence has
+// signalled, so uploads never stall on buffers the GPU is still reading.
+// Allocations return a buffer offset usable for UBO/SSBO ranges, vertex
+// data or indirect commands.
+//
+// Without GL 4.4 / ARB_buffer_storage the segments live in client memory
+// and flushRingBuffer() uploads them with glBufferSubData.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+
+#define RING_SEGMENTS 3   // frames in flight
+
+struct RingAllocation {
+  size_t offset;          // in the buffer object
+  void *data;             // where to write; NULL if the segment is full
+};
+
+struct RingBuffer {
+  GLuint buffer = 0;
+  unsigned char *mapped = NULL;   // whole buffer (GL mapping or client copy)
+  bool persistent = false;
+  size_t segmentSize = 0;
+  int segment = 0;
+  size_t head = 0;                // next free byte, absolute
+  size_t flushed = 0;             // fallback: first byte not uploaded yet
+  GLsync fences[RING_SEGMENTS] = {};
+
+  // Stats, accumulated until reset
+  unsigned long long bytesAllocated = 0;
+  unsigned int fenceWaits = 0;    // segment still in use when reached
+  unsigned int overflows = 0;     // allocations that did not fit
+};
+
+// False if the buffer cannot be created or mapped
+bool createRingBuffer(RingBuffer *ring, size_t segmentSize);
+void destroyRingBuffer(RingBuffer *ring);
+
+// Moves to the next segment, waiting for the GPU to be done with it
+void beginRingFrame(RingBuffer *ring);
+// Fences the current segment; call after the last command reading it
+void endRingFrame(RingBuffer *ring);
+
+// alignment: a power of two (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, ...)
+RingAllocation ringAlloc(RingBuffer *ring, size_t size, size_t alignment);
+
+// Makes the data written so far visible to GL (no-op when persistent)
+void flushRingBuffer(RingBuffer *ring);
+
+#endif
@@ -0,0 +1,61 @@
+// scene.cpp: scene objects and the per-frame data built from them
+
+#include "scene.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+glm::mat4 objectModelMatrix(const SceneObject &object, double time) {
+  glm::mat4 model_matrix = glm::mat4(1.f);
+
+  model_matrix = glm::rotate(model_matrix,
+                             glm::radians((float)time * object.spin.x),
+                             glm::vec3(0.0f, 1.0f, 0.0f));
+
+  model_matrix = glm::rotate(model_matrix,
+                             glm::radians((float)time * object.spin.y),
+                             glm::vec3(1.0f, 0.0f, 0.0f));
+
+  model_matrix = glm::translate(model_matrix, object.position);
+  model_matrix = glm::scale(model_matrix, glm::vec3(object.scale));
+
+  return model_matrix;
+}
+
+float meshRadius(const GLfloat *positions, int vertexCount) {
+  float radius = 0.0f;
+  for (int i = 0; i < vertexCount; i++) {
+    glm::vec3 v(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+    radius = glm::max(radius, glm::length(v));
+  }
+  return radius;
+}
+
+// Gribb & Hartmann: planes are sums/differences of the matrix rows
+Frustum extractFrustum(const glm::mat4 &m) {
+  Frustum frustum;
+  glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+  glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+  glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+  glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+  frustum.planes[0] = row3 + row0; // left
+  frustum.planes[1] = row3 - row0; // right
+  frustum.planes[2] = row3 + row1; // bottom
+  frustum.planes[3] = row3 - row1; // top
+  frustum.planes[4] = row3 + row2; // near
+  frustum.planes[5] = row3 - row2; // far
+
+  for (int i = 0; i < 6; i++)
+    frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+
+  return frustum;
+}
+
+bool sphereInFrustum(const Frustum &frustum, const glm::vec3 &center, float radius) {
+  for (int i = 0; i < 6; i++) {
+    const glm::vec4 &p = frustum.planes[i];
+    if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius)
+      return false;
+  }
+  return true;
+}
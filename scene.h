@@ -0,0 +1,71 @@
+// scene.h: scene objects and the per-frame data built from them
+//
+// simulate() turns the scene description into a FramePacket (matrices,
+// camera, culling results); render() only reads packets, so both can run
+// on different threads (see frame_pipeline.h).
+//////////////////////////////////////////////////////////////////////
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// GPU geometry shared by any number of objects
+struct Mesh {
+  GLuint vao;
+  GLsizei vertexCount;
+  float radius;           // bounding sphere around the local origin
+  int coarser = -1;       // next level of detail (lod.h), -1: none
+  float lodError = 0.0f;  // object space error of this level
+};
+
+// One drawable: mesh + material + animation
+// model = rotateY(spin.x * t) * rotateX(spin.y * t) * translate(position) * scale
+struct SceneObject {
+  int mesh;
+  unsigned int diffuseMap;
+  unsigned int specularMap;
+  glm::vec3 position;
+  float scale;
+  glm::vec2 spin;         // degrees per second around Y and X
+  bool isStatic;
+};
+
+// Frustum planes (a, b, c, d), normals pointing inside
+struct Frustum {
+  glm::vec4 planes[6];
+};
+
+// Immutable snapshot of everything render() needs for one frame
+struct FramePacket {
+  double time;            // wall clock (stats)
+  double simTime;         // animation time (SimClock)
+  int width, height;
+  int cameraIndex;
+  bool depthPrepass;
+
+  glm::mat4 view, proj;
+  glm::vec3 cameraPos;
+  Frustum frustum;        // of view and proj
+
+  // Multi-view (multi_view.h): every camera and its viewport (x, y, width,
+  // height), view 0 being the one above. Empty with a single view
+  std::vector<glm::mat4> views, projs;
+  std::vector<glm::vec3> viewPositions;
+  std::vector<glm::vec4> viewports;
+
+  std::vector<glm::mat4> models;        // one per scene object
+  std::vector<unsigned char> visible;   // frustum culling, one per object
+  std::vector<int> lodMeshes;           // mesh drawn, one per object (lod.h)
+};
+
+glm::mat4 objectModelMatrix(const SceneObject &object, double time);
+float meshRadius(const GLfloat *positions, int vertexCount);
+
+Frustum extractFrustum(const glm::mat4 &viewProj);
+bool sphereInFrustum(const Frustum &frustum, const glm::vec3 &center, float radius);
+
+#endif
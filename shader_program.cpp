@@ -0,0 +1,277 @@
+// shader_program.cpp: shader programs built in the background, and #define permutations of them
+
+#include "shader_program.h"
+#include "gl_state.h"
+#include "program_reflection.h"
+#include "multi_draw.h"
+#include "textfile_ALT.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+std::vector<ShaderFile> shaderFiles;
+
+// shader file contents: from the startup read jobs if it was preloaded,
+// from disk otherwise. The caller frees it
+// ---------------------------------------------------------------------
+char *shaderSource(const char *fileName) {
+  for (size_t i = 0; i < shaderFiles.size(); i++)
+    if (strcmp(shaderFiles[i].name, fileName) == 0 && shaderFiles[i].source)
+      return strdup(shaderFiles[i].source);
+  return textFileRead(fileName);
+}
+
+// utility function to issue the compile of one shader, status not checked.
+// Defines go right after #version, which must stay the first line; #line
+// keeps the compiler's line numbers those of the file
+// ---------------------------------------------------------------------
+static bool submitShader(PendingProgram *pending, GLenum type, const char *fileName,
+                         const char *defines) {
+  char *source = shaderSource(fileName);
+  if (!source) {
+    fprintf(stderr, "ERROR: could not read shader %s\n", fileName);
+    return false;
+  }
+
+  const char *strings[4];
+  GLint lengths[4];
+  GLsizei count = 0;
+  char *body = source;
+  if (defines && strncmp(source, "#version", 8) == 0) {
+    char *newline = strchr(source, '\n');
+    body = newline ? newline + 1 : source + strlen(source);
+    strings[count] = source;
+    lengths[count++] = (GLint) (body - source);
+  }
+  if (defines) {
+    strings[count] = defines;
+    lengths[count++] = -1;
+    strings[count] = body == source ? "#line 1\n" : "#line 2\n";
+    lengths[count++] = -1;
+  }
+  strings[count] = body;
+  lengths[count++] = -1;
+
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, count, strings, lengths);
+  free(source);
+  glCompileShader(shader);
+
+  pending->shaders[pending->shaderCount] = shader;
+  pending->fileNames[pending->shaderCount] = fileName;
+  pending->shaderCount++;
+  glAttachShader(pending->program, shader);
+  return true;
+}
+
+// utility function to compile and link a vertex + fragment shader pair;
+// finishProgram() checks the result
+// ---------------------------------------------------------------------
+bool submitProgram(PendingProgram *pending, const char *vsFileName, const char *fsFileName,
+                   const char **fragOutputs, int fragOutputCount, const char *defines) {
+  TRACE_SCOPE("submitProgram");
+  pending->program = glCreateProgram();
+  pending->shaderCount = 0;
+
+  if (!submitShader(pending, GL_FRAGMENT_SHADER, fsFileName, defines) ||
+      !submitShader(pending, GL_VERTEX_SHADER, vsFileName, defines))
+    return false;
+
+  // Same attribute slots for every program so they can share the VAOs
+  glBindAttribLocation(pending->program, 0, "v_pos");
+  glBindAttribLocation(pending->program, 1, "v_normal");
+  glBindAttribLocation(pending->program, 2, "v_tex");
+  glBindAttribLocation(pending->program, MULTIDRAW_DRAW_ID_ATTRIB, "v_draw_id");
+
+  // Multiple render targets (G-buffer): output i goes to draw buffer i
+  for (int i = 0; i < fragOutputCount; i++)
+    glBindFragDataLocation(pending->program, i, fragOutputs[i]);
+
+  glLinkProgram(pending->program);
+  return true;
+}
+
+// utility function to compile and link a compute shader; finishProgram()
+// checks the result
+// ---------------------------------------------------------------------
+bool submitComputeProgram(PendingProgram *pending, const char *csFileName) {
+  TRACE_SCOPE("submitComputeProgram");
+  pending->program = glCreateProgram();
+  pending->shaderCount = 0;
+
+  if (!submitShader(pending, GL_COMPUTE_SHADER, csFileName, NULL))
+    return false;
+
+  glLinkProgram(pending->program);
+  return true;
+}
+
+bool programCompleted(const PendingProgram *pending) {
+  if (!GLEW_KHR_parallel_shader_compile)
+    return true;
+  GLint done = GL_FALSE;
+  glGetProgramiv(pending->program, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
+
+// Waits for a submitted program (the status queries block until the driver
+// is done); returns it, or 0 after printing the compile or link log
+// ---------------------------------------------------------------------
+GLuint finishProgram(PendingProgram *pending) {
+  TRACE_SCOPE("finishProgram");
+  int  success;
+  char infoLog[512];
+  GLuint program = pending->program;
+
+  for (int i = 0; i < pending->shaderCount; i++) {
+    glGetShaderiv(pending->shaders[i], GL_COMPILE_STATUS, &success);
+    if (!success) {
+      glGetShaderInfoLog(pending->shaders[i], 512, NULL, infoLog);
+      printf("ERROR: Shader %s compilation failed!\n%s\n", pending->fileNames[i], infoLog);
+      program = 0;
+    }
+  }
+
+  if (program) {
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+      glGetProgramInfoLog(program, 512, NULL, infoLog);
+      printf("ERROR: Shader Program linking failed!\n%s\n", infoLog);
+      program = 0;
+    } else {
+      glValidateProgram(program);
+      reflectProgram(program);
+    }
+  }
+
+  // Release shader objects
+  for (int i = 0; i < pending->shaderCount; i++)
+    glDeleteShader(pending->shaders[i]);
+  if (!program)
+    glsDeleteProgram(pending->program);
+
+  return program;
+}
+
+unsigned int permutationKey(int lightCount, bool hasSpecularMap, bool hasTexture) {
+  return ((unsigned int) lightCount << PERMUTATION_LIGHT_SHIFT) |
+         (hasSpecularMap ? PERMUTATION_HAS_SPECULAR_MAP : 0) |
+         (hasTexture ? PERMUTATION_HAS_TEXTURE : 0);
+}
+
+static void permutationDefines(unsigned int key, char *defines, size_t size) {
+  snprintf(defines, size, "#define LIGHT_COUNT %u\n#define HAS_SPECULAR_MAP %d\n#define HAS_TEXTURE %d\n",
+           key >> PERMUTATION_LIGHT_SHIFT, (key & PERMUTATION_HAS_SPECULAR_MAP) ? 1 : 0,
+           (key & PERMUTATION_HAS_TEXTURE) ? 1 : 0);
+}
+
+// For the log: "LIGHT_COUNT 2, HAS_SPECULAR_MAP 0, HAS_TEXTURE 1"
+static void permutationName(unsigned int key, char *name, size_t size) {
+  snprintf(name, size, "LIGHT_COUNT %u, HAS_SPECULAR_MAP %d, HAS_TEXTURE %d",
+           key >> PERMUTATION_LIGHT_SHIFT, (key & PERMUTATION_HAS_SPECULAR_MAP) ? 1 : 0,
+           (key & PERMUTATION_HAS_TEXTURE) ? 1 : 0);
+}
+
+static double permutationClock() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void initShaderPermutations(ShaderPermutations *permutations, const char *vsFileName,
+                            const char *fsFileName, GLuint generic) {
+  permutations->vsFileName = vsFileName;
+  permutations->fsFileName = fsFileName;
+  permutations->generic = generic;
+  permutations->variants.clear();
+  permutations->failures = 0;
+}
+
+static void finishPermutation(ShaderPermutations *permutations, ShaderVariant *variant) {
+  variant->program = finishProgram(&variant->pending);
+  variant->compiling = false;
+
+  char name[128];
+  permutationName(variant->key, name, sizeof(name));
+
+  if (variant->program) {
+    printf("Shader variant %s ready (%.1f ms)\n", name,
+           (permutationClock() - variant->submitTime) * 1000.0);
+  } else {
+    // Draws go on with the generic program
+    fprintf(stderr, "WARNING: shader variant %s failed, using the generic program\n", name);
+    permutations->failures++;
+  }
+}
+
+void destroyShaderPermutations(ShaderPermutations *permutations) {
+  for (size_t i = 0; i < permutations->variants.size(); i++) {
+    ShaderVariant &variant = permutations->variants[i];
+    if (variant.compiling)
+      finishPermutation(permutations, &variant);
+    if (variant.program) {
+      forgetProgram(variant.program);
+      glsDeleteProgram(variant.program);
+    }
+  }
+  permutations->variants.clear();
+}
+
+int requestPermutation(ShaderPermutations *permutations, unsigned int key, bool genericFallback) {
+  for (size_t i = 0; i < permutations->variants.size(); i++) {
+    if (permutations->variants[i].key == key) {
+      if (permutations->variants[i].compiling && !genericFallback)
+        finishPermutation(permutations, &permutations->variants[i]);
+      return (int) i;
+    }
+  }
+
+  TRACE_SCOPE("requestPermutation");
+  char defines[128];
+  permutationDefines(key, defines, sizeof(defines));
+
+  ShaderVariant variant;
+  variant.key = key;
+  variant.program = 0;
+  variant.submitTime = permutationClock();
+  variant.compiling = submitProgram(&variant.pending, permutations->vsFileName,
+                                    permutations->fsFileName, NULL, 0, defines);
+  if (!variant.compiling) {
+    for (int i = 0; i < variant.pending.shaderCount; i++)
+      glDeleteShader(variant.pending.shaders[i]);
+    glsDeleteProgram(variant.pending.program);
+    permutations->failures++;
+  }
+  permutations->variants.push_back(variant);
+
+  ShaderVariant *added = &permutations->variants.back();
+  if (added->compiling && !genericFallback)
+    finishPermutation(permutations, added);
+  return (int) permutations->variants.size() - 1;
+}
+
+int updateShaderPermutations(ShaderPermutations *permutations) {
+  int ready = 0;
+  for (size_t i = 0; i < permutations->variants.size(); i++) {
+    ShaderVariant &variant = permutations->variants[i];
+    if (!variant.compiling || !programCompleted(&variant.pending))
+      continue;
+
+    finishPermutation(permutations, &variant);
+    if (variant.program)
+      ready++;
+    if (!GLEW_KHR_parallel_shader_compile)
+      break;
+  }
+  return ready;
+}
+
+int pendingPermutations(const ShaderPermutations *permutations) {
+  int count = 0;
+  for (size_t i = 0; i < permutations->variants.size(); i++)
+    if (permutations->variants[i].compiling)
+      count++;
+  return count;
+}
@@ -0,0 +1,99 @@
+// shader_program.h: shader programs built in the background, and #define
+// permutations of them
+//
+// submitProgram() issues the compiles and the link and returns at once;
+// finishProgram() checks them, blocking until the driver is done unless
+// programCompleted() said so first. With KHR_parallel_shader_compile the
+// driver works on its own threads in the meantime.
+//
+// ShaderPermutations specialises one vertex + fragment pair with #defines
+// inserted after the #version line (LIGHT_COUNT, HAS_SPECULAR_MAP,
+// HAS_TEXTURE), so each material runs a variant without the work it doesn't
+// need. A variant is compiled the first time it is requested and kept for
+// the rest of the run. Until it links, its draws use the generic program
+// (the same source without defines), which renders the same image more
+// slowly. Variants whose draws the generic program can't stand in for are
+// finished on request.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef SHADER_PROGRAM_H
+#define SHADER_PROGRAM_H
+
+#include <GL/glew.h>
+#include <stddef.h>
+
+#include <vector>
+
+// Shader sources read ahead of time (on the job system at startup);
+// shaderSource() falls back to the file for the ones not here
+struct ShaderFile {
+  const char *name;
+  char *source;
+};
+extern std::vector<ShaderFile> shaderFiles;
+
+// Contents of a shader file, the caller frees it
+char *shaderSource(const char *fileName);
+
+// Program whose compile and link have been issued but not checked
+struct PendingProgram {
+  GLuint program;
+  GLuint shaders[2];
+  const char *fileNames[2];
+  int shaderCount;
+};
+
+// defines: "#define ...\n" lines for every shader of the program, or NULL
+bool submitProgram(PendingProgram *pending, const char *vsFileName, const char *fsFileName,
+                   const char **fragOutputs = NULL, int fragOutputCount = 0,
+                   const char *defines = NULL);
+bool submitComputeProgram(PendingProgram *pending, const char *csFileName);
+
+// Whether finishProgram() would return without waiting (always true
+// without KHR_parallel_shader_compile, where there is no way to know)
+bool programCompleted(const PendingProgram *pending);
+
+// The program, or 0 after printing the compile or link log
+GLuint finishProgram(PendingProgram *pending);
+
+// Permutation key: light count and one bit per material feature
+#define PERMUTATION_HAS_TEXTURE      0x1
+#define PERMUTATION_HAS_SPECULAR_MAP 0x2
+#define PERMUTATION_LIGHT_SHIFT      2
+
+unsigned int permutationKey(int lightCount, bool hasSpecularMap, bool hasTexture);
+
+struct ShaderVariant {
+  unsigned int key;
+  GLuint program;             // 0 while compiling, or if the build failed
+  PendingProgram pending;
+  bool compiling;
+  double submitTime;          // seconds, for the compile latency report
+};
+
+struct ShaderPermutations {
+  const char *vsFileName;
+  const char *fsFileName;
+  GLuint generic;
+  std::vector<ShaderVariant> variants;
+  unsigned int failures;
+};
+
+void initShaderPermutations(ShaderPermutations *permutations, const char *vsFileName,
+                            const char *fsFileName, GLuint generic);
+void destroyShaderPermutations(ShaderPermutations *permutations);
+
+// Index of the variant for key, submitting its compile the first time.
+// genericFallback: the generic program may draw it until it is linked;
+// otherwise it is finished right away
+int requestPermutation(ShaderPermutations *permutations, unsigned int key, bool genericFallback);
+
+// Finishes the variants the driver is done with (one per call without
+// KHR_parallel_shader_compile, to spread the stalls); returns how many
+// became usable
+int updateShaderPermutations(ShaderPermutations *permutations);
+
+// Variants compiling
+int pendingPermutations(const ShaderPermutations *permutations);
+
+#endif
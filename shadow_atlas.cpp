@@ -0,0 +1,220 @@
+// shadow_atlas.cpp: omnidirectional shadow maps for point lights
+
+#include "shadow_atlas.h"
+#include "gl_state.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Cube face directions and up vectors (+X, -X, +Y, -Y, +Z, -Z)
+static const glm::vec3 faceDirs[SHADOW_FACES] = {
+  glm::vec3( 1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+  glm::vec3( 0.0f, 1.0f, 0.0f), glm::vec3( 0.0f,-1.0f, 0.0f),
+  glm::vec3( 0.0f, 0.0f, 1.0f), glm::vec3( 0.0f, 0.0f,-1.0f)
+};
+static const glm::vec3 faceUps[SHADOW_FACES] = {
+  glm::vec3(0.0f,-1.0f, 0.0f), glm::vec3(0.0f,-1.0f, 0.0f),
+  glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f,-1.0f),
+  glm::vec3(0.0f,-1.0f, 0.0f), glm::vec3(0.0f,-1.0f, 0.0f)
+};
+
+static GLuint createDepthTarget(int width, int height, GLuint *fbo) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glsBindTexture(0, GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0,
+               GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  glGenFramebuffers(1, fbo);
+  glsBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+
+  // Start fully lit: everything at the far plane
+  glClearDepth(1.0);
+  glClear(GL_DEPTH_BUFFER_BIT);
+
+  return texture;
+}
+
+bool createShadowAtlas(ShadowAtlas *atlas, GLuint program, int tileSize, int maxLights) {
+  if (maxLights > SHADOW_MAX_LIGHTS)
+    maxLights = SHADOW_MAX_LIGHTS;
+
+  atlas->program = program;
+  atlas->tileSize = tileSize;
+  atlas->maxLights = maxLights;
+
+  atlas->model_uniform = findUniform<glm::mat4>(program, "model");
+  atlas->view_proj_uniform = findUniform<glm::mat4>(program, "light_view_proj");
+  atlas->light_pos_uniform = findUniform<glm::vec3>(program, "light_pos");
+  atlas->range_uniform = findUniform<float>(program, "light_range");
+
+  int width = tileSize * SHADOW_FACES;
+  int height = tileSize * maxLights;
+  atlas->texture = createDepthTarget(width, height, &atlas->fbo);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  atlas->staticTexture = createDepthTarget(width, height, &atlas->staticFbo);
+  if (status == GL_FRAMEBUFFER_COMPLETE)
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+  glsBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glsBindTexture(0, GL_TEXTURE_2D, 0);
+
+  for (int i = 0; i < SHADOW_MAX_LIGHTS; i++) {
+    atlas->staticValid[i] = false;
+    atlas->dynamicValid[i] = false;
+    atlas->cachedSignature[i] = 0;
+    atlas->cachedRange[i] = 0.0f;
+    atlas->ranges[i] = 1.0f;
+  }
+
+  if (status != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "ERROR: shadow atlas framebuffer incomplete (0x%x)\n", status);
+    return false;
+  }
+
+  printf("Shadow atlas: %dx%d, %d lights, %dx%d tiles\n",
+         width, height, maxLights, tileSize, tileSize);
+  return true;
+}
+
+void destroyShadowAtlas(ShadowAtlas *atlas) {
+  glsDeleteFramebuffers(1, &atlas->fbo);
+  glsDeleteFramebuffers(1, &atlas->staticFbo);
+  glsDeleteTextures(1, &atlas->texture);
+  glsDeleteTextures(1, &atlas->staticTexture);
+  atlas->texture = atlas->staticTexture = atlas->fbo = atlas->staticFbo = 0;
+}
+
+static bool inRange(const ShadowLight &light, const ShadowCaster &caster) {
+  glm::vec3 d = caster.center - light.position;
+  float r = light.range + caster.radius;
+  return glm::dot(d, d) <= r * r;
+}
+
+// FNV-1a over the transforms of the dynamic casters in range: any movement
+// (or a caster entering/leaving the range) changes the signature
+static unsigned long long dynamicSignature(const ShadowLight &light,
+                                           const ShadowCaster *casters, int casterCount) {
+  unsigned long long hash = 14695981039346656037ull;
+  for (int i = 0; i < casterCount; i++) {
+    if (casters[i].isStatic || !inRange(light, casters[i]))
+      continue;
+
+    const unsigned char *bytes = (const unsigned char *) glm::value_ptr(casters[i].model);
+    for (size_t b = 0; b < sizeof(glm::mat4); b++) {
+      hash ^= bytes[b];
+      hash *= 1099511628211ull;
+    }
+    hash ^= (unsigned long long) i;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Draws the casters in range (static or dynamic ones) into the light's row
+static void renderLightRow(ShadowAtlas *atlas, int lightIndex, const ShadowLight &light,
+                           const ShadowCaster *casters, int casterCount, bool staticCasters) {
+  int tile = atlas->tileSize;
+
+  setUniform(atlas->light_pos_uniform, light.position);
+  setUniform(atlas->range_uniform, light.range);
+
+  for (int face = 0; face < SHADOW_FACES; face++) {
+    glViewport(face * tile, lightIndex * tile, tile, tile);
+    setUniform(atlas->view_proj_uniform, atlas->matrices[lightIndex * SHADOW_FACES + face]);
+
+    for (int i = 0; i < casterCount; i++) {
+      if (casters[i].isStatic != staticCasters || !inRange(light, casters[i]))
+        continue;
+
+      glsBindVertexArray(casters[i].vao);
+      setUniform(atlas->model_uniform, casters[i].model);
+      glDrawArrays(GL_TRIANGLES, 0, casters[i].vertexCount);
+    }
+  }
+}
+
+static void clearLightRow(int lightIndex, int tileSize) {
+  glsEnable(GL_SCISSOR_TEST);
+  glScissor(0, lightIndex * tileSize, tileSize * SHADOW_FACES, tileSize);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glsDisable(GL_SCISSOR_TEST);
+}
+
+void updateShadowAtlas(ShadowAtlas *atlas,
+                       const ShadowLight *lights, int lightCount,
+                       const ShadowCaster *casters, int casterCount) {
+  if (lightCount > atlas->maxLights)
+    lightCount = atlas->maxLights;
+
+  int tile = atlas->tileSize;
+  bool programBound = false;
+
+  for (int l = 0; l < lightCount; l++) {
+    const ShadowLight &light = lights[l];
+    bool moved = light.position != atlas->cachedPosition[l] ||
+                 light.range != atlas->cachedRange[l];
+    unsigned long long signature = dynamicSignature(light, casters, casterCount);
+
+    bool renderStatic = moved || atlas->staticDirty || !atlas->staticValid[l];
+    bool renderDynamic = renderStatic || !atlas->dynamicValid[l] ||
+                         signature != atlas->cachedSignature[l];
+
+    if (!renderDynamic) {
+      atlas->cachedLightHits++;
+      continue;
+    }
+
+    if (!programBound) {
+      glsUseProgram(atlas->program);
+      programBound = true;
+    }
+
+    if (moved || !atlas->staticValid[l]) {
+      glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, light.range);
+      for (int face = 0; face < SHADOW_FACES; face++)
+        atlas->matrices[l * SHADOW_FACES + face] =
+          proj * glm::lookAt(light.position, light.position + faceDirs[face], faceUps[face]);
+      atlas->ranges[l] = light.range;
+    }
+
+    // Static layer: only when the light or the static geometry changed
+    if (renderStatic) {
+      glsBindFramebuffer(GL_FRAMEBUFFER, atlas->staticFbo);
+      clearLightRow(l, tile);
+      renderLightRow(atlas, l, light, casters, casterCount, true);
+      atlas->staticValid[l] = true;
+      atlas->staticLightRenders++;
+    }
+
+    // Dynamic layer: copy of the static row + dynamic casters on top
+    glsBindFramebuffer(GL_READ_FRAMEBUFFER, atlas->staticFbo);
+    glsBindFramebuffer(GL_DRAW_FRAMEBUFFER, atlas->fbo);
+    glBlitFramebuffer(0, l * tile, SHADOW_FACES * tile, (l + 1) * tile,
+                      0, l * tile, SHADOW_FACES * tile, (l + 1) * tile,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glsBindFramebuffer(GL_FRAMEBUFFER, atlas->fbo);
+    renderLightRow(atlas, l, light, casters, casterCount, false);
+
+    atlas->cachedPosition[l] = light.position;
+    atlas->cachedRange[l] = light.range;
+    atlas->cachedSignature[l] = signature;
+    atlas->dynamicValid[l] = true;
+    atlas->dynamicLightRenders++;
+  }
+
+  // Static geometry changes invalidate every light at once
+  atlas->staticDirty = false;
+  glsBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
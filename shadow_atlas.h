@@ -0,0 +1,76 @@
+// shadow_atlas.h: omnidirectional shadow maps for point lights
+//
+// Every shadowed light owns one row of six square tiles (one per cube face)
+// in a shared depth atlas storing distance to the light / range. Tiles are
+// only re-rendered when the light or a caster inside its range moves:
+// static casters are kept in a second atlas that is copied into the main
+// one before the dynamic casters are drawn on top.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "program_reflection.h"
+
+#define SHADOW_MAX_LIGHTS 4
+#define SHADOW_FACES      6
+
+struct ShadowCaster {
+  GLuint vao;
+  GLsizei vertexCount;
+  glm::mat4 model;
+  glm::vec3 center;   // world space bounding sphere
+  float radius;
+  bool isStatic;
+};
+
+struct ShadowLight {
+  glm::vec3 position;
+  float range;
+};
+
+struct ShadowAtlas {
+  GLuint texture = 0, fbo = 0;               // what the shading passes sample
+  GLuint staticTexture = 0, staticFbo = 0;   // static casters only
+  GLuint program = 0;
+  Uniform<glm::mat4> model_uniform, view_proj_uniform;
+  Uniform<glm::vec3> light_pos_uniform;
+  Uniform<float> range_uniform;
+  int tileSize = 0;
+  int maxLights = 0;
+
+  // Face view-projection matrices, SHADOW_FACES per light, and the range
+  // each light's distances are divided by, for the shaders
+  glm::mat4 matrices[SHADOW_MAX_LIGHTS * SHADOW_FACES];
+  float ranges[SHADOW_MAX_LIGHTS];
+
+  // Cache state per light
+  glm::vec3 cachedPosition[SHADOW_MAX_LIGHTS];
+  float cachedRange[SHADOW_MAX_LIGHTS];
+  unsigned long long cachedSignature[SHADOW_MAX_LIGHTS];
+  bool staticValid[SHADOW_MAX_LIGHTS];
+  bool dynamicValid[SHADOW_MAX_LIGHTS];
+
+  // Set by the caller when a static caster is added, removed or moved
+  bool staticDirty = true;
+
+  // Counters, reset by the caller
+  unsigned int staticLightRenders = 0;
+  unsigned int dynamicLightRenders = 0;
+  unsigned int cachedLightHits = 0;
+};
+
+// program: shadow_vs.glsl + shadow_fs.glsl
+bool createShadowAtlas(ShadowAtlas *atlas, GLuint program, int tileSize, int maxLights);
+void destroyShadowAtlas(ShadowAtlas *atlas);
+
+// Brings every light's tiles up to date, re-rendering only what changed.
+// Leaves the default framebuffer bound; the caller restores the viewport
+void updateShadowAtlas(ShadowAtlas *atlas,
+                       const ShadowLight *lights, int lightCount,
+                       const ShadowCaster *casters, int casterCount);
+
+#endif
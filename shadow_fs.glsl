@@ -0,0 +1,11 @@
+#version 130
+
+in vec3 frag_3Dpos;
+
+uniform vec3 light_pos;
+uniform float light_range;
+
+// Linear distance to the light, the same on every face of the cube
+void main() {
+  gl_FragDepth = length(frag_3Dpos - light_pos) / light_range;
+}
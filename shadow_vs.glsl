@@ -0,0 +1,13 @@
+#version 130
+
+in vec3 v_pos;
+
+out vec3 frag_3Dpos;
+
+uniform mat4 model;
+uniform mat4 light_view_proj; // one cube face of the light
+
+void main() {
+  frag_3Dpos = vec3(model * vec4(v_pos, 1.0));
+  gl_Position = light_view_proj * vec4(frag_3Dpos, 1.0);
+}
@@ -5,7 +5,14 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include <filesystem>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -18,41 +25,280 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "textfile_ALT.h"
-
-int gl_width = 640;
-int gl_height = 480;
+#include "gbuffer.h"
+#include "shadow_atlas.h"
+#include "scene.h"
+#include "frame_pipeline.h"
+#include "jobs.h"
+#include "gl_state.h"
+#include "render_queue.h"
+#include "multi_draw.h"
+#include "ring_buffer.h"
+#include "frame_arena.h"
+#include "frame_clock.h"
+#include "benchmark.h"
+#include "capture.h"
+#include "trace.h"
+#include "startup_profile.h"
+#include "program_reflection.h"
+#include "shader_program.h"
+#include "material.h"
+#include "texture_atlas.h"
+#include "virtual_texture.h"
+#include "residency.h"
+#include "lod.h"
+#include "meshlet.h"
+#include "multi_view.h"
+#include "camera.h"
+
+// Written by the window callback, read by the simulation thread
+std::atomic<int> gl_width(640);
+std::atomic<int> gl_height(480);
 
 void glfw_window_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
-void render(double, 
-            GLuint *cubeVao,
-            GLuint *tetrahedronVao,
-            const float tetrahedronScaleFactor,
-            unsigned int cubeDiffuseMap,
-            unsigned int tetrahedronDiffuseMap,
-            unsigned int cubeSpecularMap,
-            unsigned int tetrahedronSpecularMap,
-            int activeCameraIndex);
+static bool keyPressed(GLFWwindow *window, int key);
+void simulate(double wallTime, FramePacket *frame);
+void render(const FramePacket &frame);
+void renderScene(const FramePacket &frame, Arena *arena);
+void runThreaded(GLFWwindow *window);
 void obtenerNormales(GLfloat * normales, const GLfloat vertices[]);
+
+// Decoded image waiting to be uploaded (decoding can run on any thread)
+struct Image {
+  unsigned char *data;
+  int width, height, components;
+  const char *path;   // file it came from (NULL: generated), kept for reloads
+};
+
 unsigned int loadTexture(const char *path);
+bool decodeImage(const char *path, Image *image);
+unsigned int uploadTexture(Image *image);
+
+GLuint createLightData(int extraLightCount, int *lightCount);
+void buildRenderQueue(const FramePacket &frame, RenderQueue *queue, Arena *arena);
+void drawScene(RenderPass pass, int instances = 1);
+void updateOverdrawStats(const FramePacket &frame);
+void traceJobCounters();
+void setShadowUniforms(GLuint program, int atlasUnit);
+void requestMaterialPermutations();
+void updateShadingVariants();
+bool isBlackTexture(unsigned int texture);
+void trackGBuffer(bool tracked);
+
+// Buffers of a mesh the atlas rebuilds with rewritten texture coordinates
+struct MeshSource {
+  GLuint positions, normals;
+  const GLfloat *texCoords;
+};
+void applyTextureAtlas(const MeshSource *sources);
 
 GLuint shader_program = 0; // shader program to set render pipeline
 GLuint cubeVao, tetrahedronVao = 0; // Vertext Array Object to set input data
-GLint model_location, view_location, proj_location, normal_location; // Uniforms for transformation matrices
-GLint light_position_location, light_ambient_location, light_diffuse_location, light_specular_location; // Uniforms for light1 data
-GLint light2_position_location, light2_ambient_location, light2_diffuse_location, light2_specular_location; // Uniforms for light2 data
-GLint material_ambient_location, material_diffuse_location, material_specular_location, material_shininess_location; // Uniforms for material matrices
-GLint camera_pos_location;
-int activeCameraIndex = 0;
+
+// Uniforms of the scene programs, looked up by name once after linking
+// (program_reflection.h); the ones a program lacks stay at -1 and are skipped
+struct LightUniforms {
+  Uniform<glm::vec3> position, ambient, diffuse, specular;
+};
+
+struct SceneUniforms {
+  Uniform<glm::mat4> model, view, projection; // transformation matrices
+  Uniform<glm::mat3> normalToWorld;
+  Uniform<glm::vec3> viewPos;
+  Uniform<glm::mat4> views, projections;      // multi-view: one per camera
+  Uniform<glm::vec3> viewPositions;
+  LightUniforms light, light2;
+  Uniform<glm::vec3> materialAmbient;
+  Uniform<int> materialDiffuse, materialSpecular; // texture units
+  Uniform<float> materialShininess;
+  Uniform<glm::mat4> shadowMatrices;
+  Uniform<float> shadowRanges;
+};
+
+SceneUniforms findSceneUniforms(GLuint program);
+void uploadShadowMatrices(const SceneUniforms &uniforms);
+void setShadingUniforms(const SceneUniforms &uniforms, const FramePacket &frame);
+void drawViews(const FramePacket &frame, RenderPass pass, GLuint program,
+               const SceneUniforms &uniforms);
+SceneUniforms shader_uniforms;
+std::atomic<int> activeCameraIndex(0);
+
+// Forward shading permutations: each object's material picks a variant of
+// the Phong program (light count, specular map, texture), compiled in the
+// background; shader_program draws it until the variant is linked
+ShaderPermutations shaderPermutations;
+struct ShadingVariant {
+  GLuint program;               // 0 until linked and set up
+  SceneUniforms uniforms;
+};
+std::vector<ShadingVariant> shadingVariants; // same index as shaderPermutations.variants
+std::vector<int> objectVariants;             // one per scene object
+std::vector<unsigned int> blackTextures;     // all black: as a specular map, no specular at all
+unsigned long long stats_variant_draws = 0, stats_generic_draws = 0;
+
+// Scene: meshes (cube, tetrahedron) and the objects drawn with them
+std::vector<Mesh> meshes;
+std::vector<SceneObject> objects;
+
+// Simulation and GL submission on their own threads (--threaded)
+bool threadedPipeline = false;
+
+// Animation clock (space: pause, '.': step, +/-: speed) and frame rate cap
+// (--fps N, only useful with --no-vsync, which otherwise paces to the
+// monitor's refresh rate)
+SimClock simClock;
+FramePacer framePacer;
+bool vsync = true;
+double targetFps = -1.0; // --fps; < 0: not given
+
+// Work-stealing job system for per-frame and startup CPU work (--workers N)
+JobSystem *jobSystem = NULL;
+unsigned int workerThreads = JOBS_AUTO_WORKERS; // one per hardware thread
+
+// Draw items of the current frame, sorted by state (render thread only)
+RenderQueue renderQueue;
+
+// Transient CPU data of the render thread (draw lists, shadow casters)
+FrameArena renderArena;
+unsigned long long stats_heap_allocations = 0;
+
+// Depth prepass: a depth-only pass lays down the nearest depth so the Phong
+// pass only shades the visible fragment of each pixel (toggle with P)
+GLuint depth_program = 0;
+SceneUniforms depth_uniforms;
+std::atomic<bool> depthPrepass(false);
+
+// Overdraw counters (GL_SAMPLES_PASSED), read back one frame late to avoid stalls
+#define SHADING_QUERY_ISSUED 1
+#define PREPASS_QUERY_ISSUED 2
+GLuint prepass_queries[2], shading_queries[2];
+int queries_issued[2] = {0, 0};
+int query_frame = 0;
+GLuint64 prepass_samples = 0, shading_samples = 0;
+unsigned int stats_frames = 0;
+double stats_start_time = 0.0;
+
+// Deferred shading (--deferred): geometry pass into an MRT G-buffer, then a
+// full-screen pass evaluates Phong once per visible pixel
+bool deferredShading = false;
+GBuffer gbuffer;
+GLuint gbuffer_program = 0, lighting_program = 0;
+GLuint fullscreenVao = 0; // empty VAO, the full-screen triangle comes from gl_VertexID
+SceneUniforms gbuffer_uniforms, lighting_uniforms;
+
+// Every light (light, light2 and the --lights N extra ones) lives in a RGB32F
+// texture, one row per light: position, ambient, diffuse, specular
+#define MAX_LIGHTS 1024
+GLuint light_data_texture = 0;
+int light_count = 0;
+int extraLights = 0;
+float lightRingRadius = 1.5f; // extra lights circle the scene
+
+// Point light shadows (--shadows): both scene lights, cached shadow atlas
+#define SHADOW_TILE_SIZE 512
+#define SHADOW_RANGE 5.0f
+bool shadowsEnabled = false;
+ShadowAtlas shadowAtlas;
+GLuint shadow_program = 0;
+
+// Multi-draw indirect (--mdi): the whole scene in one indirect call, its
+// maps in the material table's texture array, optionally culled and
+// compacted on the GPU (--gpu-cull)
+bool multiDrawEnabled = false;
+bool gpuCulling = false;
+MultiDraw multiDraw;
+MaterialTable materialTable;
+GLuint cull_program = 0;
+
+// Texture atlas (--atlas): the per-object paths draw every material of a page
+// with the same two textures, through meshes with remapped UVs
+bool atlasEnabled = false;
+TextureAtlas textureAtlas;
+
+// Virtual texture (--vt IMAGE): the first object's diffuse map, and every
+// object sharing it, streamed in tiles from IMAGE.vtex into a cache of
+// --vt-budget MB. Forward per-object path only
+#define VT_CACHE_UNIT 4
+#define VT_UPLOADS_PER_FRAME 8
+const char *virtualTextureImage = NULL;
+int virtualTextureBudget = 16;
+std::string virtualTexturePath;
+bool virtualTextureFileReady = false;
+VirtualTexture virtualTexture;
+GLuint vt_program = 0, vt_feedback_program = 0;
+SceneUniforms vt_uniforms, vt_feedback_uniforms;
+
+// Level of detail (--lod, --lod-error PX): simplified chains of the meshes,
+// each object drawn at the coarsest level less than PX pixels off the
+// original. Per-object paths only; shadows keep the full meshes
+bool lodEnabled = false;
+float lodThreshold = 1.0f;
+std::vector<unsigned char> objectLods;  // level per object (simulation thread)
+unsigned long long stats_lod_triangles = 0, stats_full_triangles = 0;
+
+// Meshlets (--meshlets): indexed copies of the meshes split into clusters of
+// up to 64 vertices / 124 triangles, each culled against the frustum and by
+// its normal cone before drawing. Per-object paths only, like --lod
+bool meshletsEnabled = false;
+std::vector<MeshletMesh> meshletMeshes;  // same index as meshes
+MeshletStats meshletStats;
+
+// Multi-view (--views N): N cameras side by side, each in its own viewport.
+// Cameras 1 and 2 are the first two, the rest orbit the scene. Forward
+// shading without --mdi only
+int viewCount = 1;
+bool instancedViews = false;  // all the views in one instanced submission
+
+// GPU memory accounting by category; with --vram-budget MB, textures loaded
+// from files are evicted least recently used first to stay under it
+ResidencyManager residency;
+int vramBudget = 0; // MB, 0: account only
+
+// Per-frame GPU data (multi-draw records and commands), persistently mapped
+RingBuffer frameRing;
+
+// Benchmark (--bench-objects N): generated scene, camera path, frame times
+BenchmarkConfig benchmarkConfig;
+Benchmark benchmark;
+
+// Golden-frame capture (--capture FILE, --capture-time T)
+const char *captureFile = NULL;
+double captureTime = 1.0;
+bool captureDone = false, captureOk = false;
+
+// Chrome trace of startup and frames (--trace FILE)
+const char *traceFile = NULL;
+
+// Startup phases, reported with the time to first frame
+StartupProfile startupProfile;
 
 // Shader names
 const char *vertexFileName = "spinningcube_withlight_vs.glsl";
 const char *fragmentFileName = "spinningcube_withlight_fs.glsl";
+const char *depthVertexFileName = "depth_prepass_vs.glsl";
+const char *depthFragmentFileName = "depth_prepass_fs.glsl";
+const char *gbufferFragmentFileName = "deferred_gbuffer_fs.glsl";
+const char *lightingVertexFileName = "deferred_lighting_vs.glsl";
+const char *lightingFragmentFileName = "deferred_lighting_fs.glsl";
+const char *shadowVertexFileName = "shadow_vs.glsl";
+const char *shadowFragmentFileName = "shadow_fs.glsl";
+const char *multidrawVertexFileName = "multidraw_vs.glsl";
+const char *cullComputeFileName = "multidraw_cull_cs.glsl";
+const char *vtFeedbackFragmentFileName = "vt_feedback_fs.glsl";
+const char *multiviewVertexFileName = "multiview_vs.glsl";
 
 // Camera
 glm::vec3 camera1_pos(0.0f, 0.0f, 3.0f);
 glm::vec3 camera2_pos(1.0f, 0.4f, 8.0f);
 
+// Cameras built from those, the benchmark flythrough and the orbiting
+// views of --views (simulation thread). Their matrices are only rebuilt
+// when they move or the aspect ratio changes
+Camera camera1, camera2, pathCamera;
+Camera orbitCameras[MAX_VIEWS];   // views 2..
+CameraStats cameraStats;
+
 // Lighting (light)
 glm::vec3 light_pos(-0.25f, 0.0f, 1.0f);
 glm::vec3 light_ambient(0.2f, 0.2f, 0.2f);
@@ -71,8 +317,210 @@ const GLfloat material_diffuse = 0;
 const GLfloat material_specular = 1;
 const GLfloat material_shininess = 32.0f;
 
-int main() {
+int main(int argc, char **argv) {
+  // Command line options
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--deferred") == 0) {
+      deferredShading = true;
+    } else if (strcmp(argv[i], "--shadows") == 0) {
+      shadowsEnabled = true;
+    } else if (strcmp(argv[i], "--threaded") == 0) {
+      threadedPipeline = true;
+    } else if (strcmp(argv[i], "--mdi") == 0) {
+      multiDrawEnabled = true;
+    } else if (strcmp(argv[i], "--gpu-cull") == 0) {
+      multiDrawEnabled = gpuCulling = true;
+    } else if (strcmp(argv[i], "--atlas") == 0) {
+      atlasEnabled = true;
+    } else if (strcmp(argv[i], "--vt") == 0 && i + 1 < argc) {
+      virtualTextureImage = argv[++i];
+    } else if (strcmp(argv[i], "--vt-budget") == 0 && i + 1 < argc) {
+      virtualTextureBudget = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--lod") == 0) {
+      lodEnabled = true;
+    } else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc) {
+      lodEnabled = true;
+      lodThreshold = (float) atof(argv[++i]);
+    } else if (strcmp(argv[i], "--meshlets") == 0) {
+      meshletsEnabled = true;
+    } else if (strcmp(argv[i], "--views") == 0 && i + 1 < argc) {
+      viewCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--vram-budget") == 0 && i + 1 < argc) {
+      vramBudget = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--deterministic") == 0) {
+      simClock.deterministic = true;
+    } else if (strcmp(argv[i], "--no-vsync") == 0) {
+      vsync = false;
+    } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+      targetFps = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+      extraLights = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      workerThreads = (unsigned int) atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-objects") == 0 && i + 1 < argc) {
+      benchmarkConfig.objects = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-textures") == 0 && i + 1 < argc) {
+      benchmarkConfig.textures = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--camera-path") == 0 && i + 1 < argc) {
+      benchmarkConfig.cameraPathFile = argv[++i];
+    } else if (strcmp(argv[i], "--bench-csv") == 0 && i + 1 < argc) {
+      benchmarkConfig.csvFile = argv[++i];
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      captureFile = argv[++i];
+    } else if (strcmp(argv[i], "--capture-time") == 0 && i + 1 < argc) {
+      captureTime = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      traceFile = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--deferred] [--shadows] [--threaded] [--mdi] [--gpu-cull] "
+                      "[--atlas] [--vt IMAGE] [--vt-budget MB] [--lod] [--lod-error PX] [--meshlets] [--views N] [--vram-budget MB] [--deterministic] [--no-vsync] [--fps N] [--lights N] [--workers N] "
+                      "[--bench-objects N] [--bench-textures N] [--camera-path FILE] [--bench-csv FILE] "
+                      "[--capture FILE] [--capture-time T] [--trace FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Captures: fixed time and size, nothing on screen, no waiting for vsync
+  if (captureFile) {
+    simClock.deterministic = true;
+    vsync = false;
+  }
+
+  // Benchmark runs must see the same frames every time
+  if (benchmarkConfig.objects > 0) {
+    simClock.deterministic = true;
+    if (benchmarkConfig.textures < 1)
+      benchmarkConfig.textures = 1;
+  }
+
+  // The multi-draw path already reads every map from one texture array
+  if (atlasEnabled && multiDrawEnabled) {
+    fprintf(stderr, "WARNING: --atlas has no effect with --mdi\n");
+    atlasEnabled = false;
+  }
+
+  // Virtual texturing swaps the forward program of its objects; the atlas
+  // would pack its page table as if it were a map
+  if (virtualTextureImage && (deferredShading || multiDrawEnabled)) {
+    fprintf(stderr, "WARNING: --vt only works with forward shading without --mdi\n");
+    virtualTextureImage = NULL;
+  }
+  if (virtualTextureImage && atlasEnabled) {
+    fprintf(stderr, "WARNING: --atlas has no effect with --vt\n");
+    atlasEnabled = false;
+  }
+  if (virtualTextureBudget < 1)
+    virtualTextureBudget = 1;
+
+  // Multi-draw merges the meshes into its own buffers, the atlas rebuilds
+  // them with remapped UVs: neither has the LOD chains
+  if (lodEnabled && (multiDrawEnabled || atlasEnabled)) {
+    fprintf(stderr, "WARNING: --lod has no effect with --mdi or --atlas\n");
+    lodEnabled = false;
+  }
+  if (lodThreshold <= 0.0f)
+    lodThreshold = 1.0f;
+  if (meshletsEnabled && (multiDrawEnabled || atlasEnabled)) {
+    fprintf(stderr, "WARNING: --meshlets has no effect with --mdi or --atlas\n");
+    meshletsEnabled = false;
+  }
+
+  // Extra views go through the forward path: one camera per G-buffer or
+  // multi-draw submission, and virtual texture feedback, are not handled
+  if (viewCount > MAX_VIEWS)
+    viewCount = MAX_VIEWS;
+  if (viewCount < 1)
+    viewCount = 1;
+  if (viewCount > 1 && (deferredShading || multiDrawEnabled || virtualTextureImage)) {
+    fprintf(stderr, "WARNING: --views only works with forward shading without --mdi or --vt\n");
+    viewCount = 1;
+  }
+  if (meshletsEnabled && viewCount > 1) {
+    fprintf(stderr, "WARNING: --meshlets has no effect with --views\n");
+    meshletsEnabled = false;
+  }
+
+  // Cameras (simulate() sets their aspect ratio). The extra views orbit the
+  // origin at camera 1's height and distance
+  initCamera(&camera1, camera1_pos, glm::vec3(0.0f, 0.0f, 0.0f), 50.0f, 0.1f, 1000.0f);
+  initCamera(&camera2, camera2_pos, glm::vec3(0.7f, 0.0f, 0.0f), 50.0f, 0.1f, 1000.0f);
+  initCamera(&pathCamera, camera1_pos, glm::vec3(0.0f, 0.0f, 0.0f), 50.0f, 0.1f, 1000.0f);
+  float orbitRadius = glm::length(glm::vec2(camera1_pos.x, camera1_pos.z));
+  for (int v = 2; v < viewCount; v++) {
+    float angle = 2.0f * 3.14159265f * (float) (v - 1) / (float) (viewCount - 1);
+    glm::vec3 position(orbitRadius * sinf(angle), camera1_pos.y, orbitRadius * cosf(angle));
+    initCamera(&orbitCameras[v], position, glm::vec3(0.0f, 0.0f, 0.0f), 50.0f, 0.1f, 1000.0f);
+  }
+  if (vramBudget < 0)
+    vramBudget = 0;
+
+  // Before any other thread starts, so they all get a named buffer
+  if (traceFile) {
+    startTrace();
+    traceThreadName("main");
+  }
+
+  startupPhase(&startupProfile, "job system + file jobs");
+  jobSystem = new JobSystem(workerThreads);
+  printf("Job system: %u threads\n", jobSystem->threadCount());
+  initResidency(&residency, (size_t) vramBudget * 1024 * 1024, jobSystem);
+
+  // Textures are decoded on the job system while GL starts up; every decode
+  // is a prerequisite of texturesDecoded, which main waits on before upload
+  static const char *texturePaths[] = {
+    "./textures/spongebob.jpg",
+    "./textures/patrick.jpg",
+    "./textures/solid_black.png"
+  };
+  const int textureCount = sizeof(texturePaths) / sizeof(texturePaths[0]);
+  static Image images[textureCount];
+
+  Job *texturesDecoded = jobSystem->create([] {});
+  for (int i = 0; i < textureCount; i++) {
+    const char *path = texturePaths[i];
+    Image *image = &images[i];
+    Job *decode = jobSystem->create([path, image] { decodeImage(path, image); });
+    jobSystem->addDependency(texturesDecoded, decode);
+    jobSystem->run(decode);
+  }
+  jobSystem->run(texturesDecoded);
+
+  // The virtual texture's tiled copy is (re)built, if stale, the same way
+  Job *virtualTextureBuilt = NULL;
+  if (virtualTextureImage) {
+    virtualTexturePath = std::string(virtualTextureImage) + ".vtex";
+    virtualTextureBuilt = jobSystem->create([] {
+      virtualTextureFileReady =
+        virtualTextureFileCurrent(virtualTextureImage, virtualTexturePath.c_str()) ||
+        buildVirtualTextureFile(virtualTextureImage, virtualTexturePath.c_str());
+    });
+    jobSystem->run(virtualTextureBuilt);
+  }
+
+  // Shader files too (all of them: which ones are used depends on the GL
+  // version, not known yet)
+  const char *shaderFileNames[] = {
+    vertexFileName, fragmentFileName, depthVertexFileName, depthFragmentFileName,
+    gbufferFragmentFileName, lightingVertexFileName, lightingFragmentFileName,
+    shadowVertexFileName, shadowFragmentFileName, multidrawVertexFileName, cullComputeFileName,
+    vtFeedbackFragmentFileName, multiviewVertexFileName
+  };
+  const int shaderFileCount = sizeof(shaderFileNames) / sizeof(shaderFileNames[0]);
+  shaderFiles.resize(shaderFileCount);
+
+  Job *shadersRead = jobSystem->create([] {});
+  for (int i = 0; i < shaderFileCount; i++) {
+    ShaderFile *file = &shaderFiles[i];
+    file->name = shaderFileNames[i];
+    file->source = NULL;
+    Job *read = jobSystem->create([file] { file->source = textFileRead(file->name); });
+    jobSystem->addDependency(shadersRead, read);
+    jobSystem->run(read);
+  }
+  jobSystem->run(shadersRead);
+
   // start GL context and O/S window using the GLFW helper library
+  startupPhase(&startupProfile, "GLFW + window");
   if (!glfwInit()) {
     fprintf(stderr, "ERROR: could not start GLFW3\n");
     return 1;
@@ -83,6 +531,11 @@ int main() {
   //  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
   //  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+  if (captureFile) {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  }
+
   GLFWwindow* window = glfwCreateWindow(gl_width, gl_height, "OpenGL Phong", NULL, NULL);
   if (!window) {
     fprintf(stderr, "ERROR: could not open window with GLFW3\n");
@@ -91,9 +544,23 @@ int main() {
   }
   glfwSetWindowSizeCallback(window, glfw_window_size_callback);
   glfwMakeContextCurrent(window);
+  glfwSwapInterval(vsync ? 1 : 0);
+
+  // Without vsync and --fps, pace to the monitor's refresh rate. Captures
+  // and benchmarks run flat out unless --fps says otherwise
+  if (!vsync && targetFps < 0.0 && !captureFile && benchmarkConfig.objects == 0) {
+    GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode *mode = monitor ? glfwGetVideoMode(monitor) : NULL;
+    if (mode && mode->refreshRate > 0) {
+      targetFps = mode->refreshRate;
+      printf("Frame pacing: %.0f fps (monitor refresh rate)\n", targetFps);
+    }
+  }
+  framePacer.interval = targetFps > 0.0 ? 1.0 / targetFps : 0.0;
 
   // start GLEW extension handler
   // glewExperimental = GL_TRUE;
+  startupPhase(&startupProfile, "GLEW");
   glewInit();
 
   // get version info
@@ -105,69 +572,97 @@ int main() {
   printf("Renderer: %s\n", renderer);
   printf("OpenGL version supported %s\n", glversion);
   printf("GLSL version supported %s\n", glslversion);
-  printf("Starting viewport: (width: %d, height: %d)\n", gl_width, gl_height);
+  printf("Starting viewport: (width: %d, height: %d)\n", gl_width.load(), gl_height.load());
 
   // Enable Depth test: only draw onto a pixel if fragment closer to viewer
-  glEnable(GL_DEPTH_TEST);
-  glDepthFunc(GL_LESS); // set a smaller value as "closer"
-
-  // Vertex Shader
-  char* vertex_shader = textFileRead(vertexFileName);
-
-  // Fragment Shader
-  char* fragment_shader = textFileRead(fragmentFileName);
-
-  // Shaders compilation
-  GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vs, 1, &vertex_shader, NULL);
-  free(vertex_shader);
-  glCompileShader(vs);
-
-  int  success;
-  char infoLog[512];
-  glGetShaderiv(vs, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(vs, 512, NULL, infoLog);
-    printf("ERROR: Vertex Shader compilation failed!\n%s\n", infoLog);
-
-    return(1);
+  glsEnable(GL_DEPTH_TEST);
+  glsDepthFunc(GL_LESS); // set a smaller value as "closer"
+
+  // Multi-draw needs GL 4.3 (indirect multi-draw, SSBOs, compute), GPU
+  // compaction also needs the draw count from a buffer
+  if (multiDrawEnabled && !GLEW_VERSION_4_3) {
+    fprintf(stderr, "WARNING: multi-draw indirect needs OpenGL 4.3, using per-object draws\n");
+    multiDrawEnabled = gpuCulling = false;
+  }
+  if (gpuCulling && !GLEW_ARB_indirect_parameters) {
+    fprintf(stderr, "WARNING: ARB_indirect_parameters not supported, culling on the CPU\n");
+    gpuCulling = false;
   }
 
-  GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fs, 1, &fragment_shader, NULL);
-  free(fragment_shader);
-  glCompileShader(fs);
-
-  glGetShaderiv(fs, GL_COMPILE_STATUS, &success);
-  if (!success) {
-    glGetShaderInfoLog(fs, 512, NULL, infoLog);
-    printf("ERROR: Fragment Shader compilation failed!\n%s\n", infoLog);
+  // Multi-view: one instanced draw per object needs viewport selection in
+  // the vertex shader, otherwise the scene is submitted once per view
+  if (viewCount > 1) {
+    instancedViews = instancedViewsSupported();
+    if (instancedViews)
+      printf("Views: %d, one instanced submission\n", viewCount);
+    else
+      fprintf(stderr, "WARNING: no gl_ViewportIndex in vertex shaders, drawing the %d views one by one\n",
+              viewCount);
+  }
 
-    return(1);
+  // Scene programs: the multi-draw path swaps in a vertex shader that reads
+  // the model and normal matrices from the per-draw buffer, and fragment
+  // shaders that sample the material table. Instanced views swap in one
+  // that picks the camera and viewport by instance, for both passes
+  const char *sceneVertexFileName = multiDrawEnabled ? multidrawVertexFileName : vertexFileName;
+  const char *sceneDefines = multiDrawEnabled ? "#define MATERIAL_ARRAY\n" : NULL;
+  const char *depthVertex = multiDrawEnabled ? multidrawVertexFileName : depthVertexFileName;
+  const char *depthDefines = NULL;
+  char viewDefines[32];
+  if (instancedViews) {
+    snprintf(viewDefines, sizeof(viewDefines), "#define MULTI_VIEW %d\n", viewCount);
+    sceneVertexFileName = depthVertex = multiviewVertexFileName;
+    sceneDefines = depthDefines = viewDefines;
   }
 
-  // Create program, attach shaders to it and link it
-  shader_program = glCreateProgram();
-  glAttachShader(shader_program, fs);
-  glAttachShader(shader_program, vs);
-  glLinkProgram(shader_program);
+  // Every program is submitted now and checked only after the geometry and
+  // textures are uploaded, so drivers that compile in the background overlap
+  // the two. KHR_parallel_shader_compile lets them use all their threads
+  startupPhase(&startupProfile, "shader submit");
+  if (GLEW_KHR_parallel_shader_compile)
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  jobSystem->wait(shadersRead);
+
+  PendingProgram shaderPending, depthPending, cullPending, gbufferPending, lightingPending,
+                 shadowPending, vtPending, vtFeedbackPending;
+
+  // Phong shader program
+  bool submitted = submitProgram(&shaderPending, sceneVertexFileName, fragmentFileName,
+                                 NULL, 0, sceneDefines);
+
+  // Depth-only program for the prepass
+  submitted &= submitProgram(&depthPending, depthVertex, depthFragmentFileName,
+                             NULL, 0, depthDefines);
+
+  if (gpuCulling)
+    submitted &= submitComputeProgram(&cullPending, cullComputeFileName);
+
+  if (deferredShading) {
+    // Geometry pass reuses the Phong vertex shader, lighting pass is full-screen
+    const char *gbufferOutputs[GBUFFER_TARGETS] = {"g_position", "g_normal", "g_albedo", "g_specular"};
+    submitted &= submitProgram(&gbufferPending, sceneVertexFileName, gbufferFragmentFileName,
+                               gbufferOutputs, GBUFFER_TARGETS, sceneDefines);
+    submitted &= submitProgram(&lightingPending, lightingVertexFileName, lightingFragmentFileName);
+  }
 
-  glValidateProgram(shader_program);
-  glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-  if(!success) {
-    glGetProgramInfoLog(shader_program, 512, NULL, infoLog);
-    printf("ERROR: Shader Program linking failed!\n%s\n", infoLog);
+  if (shadowsEnabled)
+    submitted &= submitProgram(&shadowPending, shadowVertexFileName, shadowFragmentFileName);
 
-    return(1);
+  if (virtualTextureImage) {
+    const char *feedbackOutputs[] = { "feedback" };
+    submitted &= submitProgram(&vtPending, vertexFileName, fragmentFileName,
+                               NULL, 0, "#define VIRTUAL_TEXTURE\n");
+    submitted &= submitProgram(&vtFeedbackPending, vertexFileName, vtFeedbackFragmentFileName,
+                               feedbackOutputs, 1);
   }
 
-  // Release shader objects
-  glDeleteShader(vs);
-  glDeleteShader(fs);
+  if (!submitted)
+    return(1);
 
   // Vertex Array Object
+  startupPhase(&startupProfile, "geometry");
   glGenVertexArrays(1, &cubeVao);
-  glBindVertexArray(cubeVao);
+  glsBindVertexArray(cubeVao);
 
   // Cube to be rendered
   //
@@ -283,7 +778,7 @@ int main() {
 // Vertex Buffer Object (for vertex coordinates)
   GLuint vbo = 0;
   glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glsBindBuffer(GL_ARRAY_BUFFER, vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_positions), vertex_positions, GL_STATIC_DRAW);
 
   // Vertex attributes
@@ -295,7 +790,7 @@ int main() {
   obtenerNormales(normales, vertex_positions);
   GLuint normalesBuffer = 0;
   glGenBuffers(1, &normalesBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, normalesBuffer);
+  glsBindBuffer(GL_ARRAY_BUFFER, normalesBuffer);
   glBufferData(GL_ARRAY_BUFFER, sizeof(normales), normales, GL_STATIC_DRAW);
 
   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -304,29 +799,21 @@ int main() {
   // 2: calculo coordenadas de texturas
   GLuint texCoordsBuffer = 0;
   glGenBuffers(1, &texCoordsBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, texCoordsBuffer);
+  glsBindBuffer(GL_ARRAY_BUFFER, texCoordsBuffer);
   glBufferData(GL_ARRAY_BUFFER, sizeof(cubeTexCoords), cubeTexCoords, GL_STATIC_DRAW);
 
   glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, NULL);
   glEnableVertexAttribArray(2);
 
-  // load cube texture for diffuse light
-  unsigned int cubeDiffuseMap = loadTexture("./textures/spongebob.jpg");
-
-  // load cube texture for specular light
-  unsigned int cubeSpecularMap = loadTexture("./textures/solid_black.png");
-
   // Unbind vbo (it was conveniently registered by VertexAttribPointer)
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindBuffer(GL_ARRAY_BUFFER, 1);
+  glsBindBuffer(GL_ARRAY_BUFFER, 0);
 
   // Unbind cubeVao
-  glBindVertexArray(0);
-  glBindVertexArray(1);
+  glsBindVertexArray(0);
 
   // Bind Tetrahedron VAO
   glGenVertexArrays(1, &tetrahedronVao);
-  glBindVertexArray(tetrahedronVao);
+  glsBindVertexArray(tetrahedronVao);
 
   const float tetrahedronScaleFactor = 0.3;
 
@@ -389,13 +876,13 @@ int main() {
   glGenBuffers(1, &tetrahedronEbo);
 
   // Bind the VBO and EBO
-  glBindBuffer(GL_ARRAY_BUFFER, tetrahedronVbo);
+  glsBindBuffer(GL_ARRAY_BUFFER, tetrahedronVbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(tetrahedronVertices), tetrahedronVertices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tetrahedronEbo);
+  glsBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tetrahedronEbo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(tetrahedronIndices), tetrahedronIndices, GL_STATIC_DRAW);
 
   // Bind the VBO and configure the vertex attribute pointers
-  glBindBuffer(GL_ARRAY_BUFFER, tetrahedronVbo);
+  glsBindBuffer(GL_ARRAY_BUFFER, tetrahedronVbo);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
   glEnableVertexAttribArray(0);
 
@@ -403,7 +890,7 @@ int main() {
   obtenerNormales(tetrahedronNormales, tetrahedronVertices);
   GLuint tetrahedronNormalesBuffer = 0;
   glGenBuffers(1, &tetrahedronNormalesBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, tetrahedronNormalesBuffer);
+  glsBindBuffer(GL_ARRAY_BUFFER, tetrahedronNormalesBuffer);
   glBufferData(GL_ARRAY_BUFFER, sizeof(tetrahedronNormales), tetrahedronNormales, GL_STATIC_DRAW);
 
   glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -412,218 +899,870 @@ int main() {
   // 2: calculo coordenadas de texturas
   GLuint tetrahedronTextCordsBuffer = 0;
   glGenBuffers(1, &tetrahedronTextCordsBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, tetrahedronTextCordsBuffer);
+  glsBindBuffer(GL_ARRAY_BUFFER, tetrahedronTextCordsBuffer);
   glBufferData(GL_ARRAY_BUFFER, sizeof(tetrahedronTexCoords), tetrahedronTexCoords, GL_STATIC_DRAW);
 
   glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, NULL);
   glEnableVertexAttribArray(2);
 
-  // load tetrahedron texture
-  unsigned int tetrahedronDiffuseMap = loadTexture("./textures/patrick.jpg");
-
-  // load cube texture for specular light
-  unsigned int tetrahedronSpecularMap = loadTexture("./textures/solid_black.png");
-
   // Unbind vbo (it was conveniently registered by VertexAttribPointer)
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindBuffer(GL_ARRAY_BUFFER, 1);
+  glsBindBuffer(GL_ARRAY_BUFFER, 0);
 
   // Unbind cubeVao
-  glBindVertexArray(0);
-  glBindVertexArray(1);
+  glsBindVertexArray(0);
+
+  const GLuint geometryBuffers[] = {
+    vbo, normalesBuffer, texCoordsBuffer,
+    tetrahedronVbo, tetrahedronEbo, tetrahedronNormalesBuffer, tetrahedronTextCordsBuffer
+  };
+  for (size_t i = 0; i < sizeof(geometryBuffers) / sizeof(geometryBuffers[0]); i++)
+    residencyTrackBuffer(&residency, geometryBuffers[i], RESIDENCY_GEOMETRY);
+
+  // Textures: wait for the decode jobs, upload on this (GL) thread.
+  // solid_black.png is decoded and uploaded once for both specular maps
+  startupPhase(&startupProfile, "texture decode wait");
+  jobSystem->wait(texturesDecoded);
+
+  startupPhase(&startupProfile, "texture upload");
+
+  // cube textures for diffuse and specular light
+  unsigned int cubeDiffuseMap = uploadTexture(&images[0]);
+  unsigned int blackMap = uploadTexture(&images[2]);
+  unsigned int cubeSpecularMap = blackMap;
+
+  // tetrahedron textures
+  unsigned int tetrahedronDiffuseMap = uploadTexture(&images[1]);
+  unsigned int tetrahedronSpecularMap = blackMap;
+
+  // Scene: spinning cube + tetrahedron orbiting around it
+  meshes.push_back({ cubeVao, 36, meshRadius(vertex_positions, 36) });
+  meshes.push_back({ tetrahedronVao, 12, meshRadius(tetrahedronVertices, 12) });
+  // Meshes objects may use; the LOD levels below go after them
+  int sourceMeshCount = (int) meshes.size();
+
+  // Triangle lists of the meshes, same index as meshes (LOD levels too),
+  // for the meshlets
+  struct MeshData {
+    const GLfloat *positions, *normals, *texCoords;
+    int vertexCount;
+  };
+  std::vector<MeshData> meshData = {
+    { vertex_positions, normales, cubeTexCoords, 36 },
+    { tetrahedronVertices, tetrahedronNormales, tetrahedronTexCoords, 12 }
+  };
+  std::vector<LodLevel> lodLevels[2];
+
+  if (lodEnabled) {
+    startupPhase(&startupProfile, "LOD chains");
+    std::vector<GLuint> lodBuffers;
+    for (int m = 0; m < 2; m++) {
+      std::vector<LodLevel> &levels = lodLevels[m];
+      simplifyMesh(meshData[m].positions, meshData[m].texCoords, meshData[m].vertexCount, &levels);
+      createLodMeshes(&meshes, m, levels, &lodBuffers);
+
+      printf("LOD: mesh %d, %d triangles", m, meshData[m].vertexCount / 3);
+      for (size_t l = 0; l < levels.size(); l++) {
+        printf(" -> %d (error %.3g)", (int) levels[l].positions.size() / 9, levels[l].error);
+        meshData.push_back({ levels[l].positions.data(), levels[l].normals.data(),
+                             levels[l].texCoords.data(), (int) levels[l].positions.size() / 3 });
+      }
+      printf("\n");
+    }
+    for (size_t i = 0; i < lodBuffers.size(); i++)
+      residencyTrackBuffer(&residency, lodBuffers[i], RESIDENCY_GEOMETRY);
+  }
+
+  if (meshletsEnabled) {
+    startupPhase(&startupProfile, "meshlets");
+    meshletMeshes.resize(meshData.size());
+    int meshletCount = 0;
+    for (size_t m = 0; m < meshData.size(); m++) {
+      MeshletMesh *mesh = &meshletMeshes[m];
+      if (!createMeshletMesh(mesh, meshData[m].positions, meshData[m].normals,
+                             meshData[m].texCoords, meshData[m].vertexCount))
+        return(1);
+      residencyTrackBuffer(&residency, mesh->vertexBuffer, RESIDENCY_GEOMETRY);
+      residencyTrackBuffer(&residency, mesh->indexBuffer, RESIDENCY_GEOMETRY);
+      meshletCount += (int) mesh->meshlets.size();
+    }
+    printf("Meshlets: %d in %d meshes\n", meshletCount, (int) meshletMeshes.size());
+  }
+
+  objects.push_back({ 0, cubeDiffuseMap, cubeSpecularMap,
+                      glm::vec3(0.0f), 1.0f, glm::vec2(30.0f, 81.0f), false });
+  objects.push_back({ 1, tetrahedronDiffuseMap, tetrahedronSpecularMap,
+                      glm::vec3(0.7f, 0.0f, 0.0f), tetrahedronScaleFactor,
+                      glm::vec2(30.0f, 40.0f), false });
+
+  if (benchmarkConfig.objects > 0) {
+    // Generated scene instead: same two meshes, checker textures
+    std::vector<unsigned int> benchmarkMaps;
+    for (int i = 0; i < benchmarkConfig.textures; i++) {
+      Image image = { generateBenchmarkTexture(i, 256), 256, 256, 3, NULL };
+      benchmarkMaps.push_back(uploadTexture(&image));
+    }
+    float sceneRadius = generateBenchmarkScene(benchmarkConfig, sourceMeshCount,
+                                               benchmarkMaps.data(), (int) benchmarkMaps.size(),
+                                               blackMap, &objects);
+    lightRingRadius = sceneRadius;
+    if (!createBenchmark(&benchmark, benchmarkConfig, sceneRadius))
+      return(1);
+    printf("Benchmark: %d objects, %d textures, %.1f s camera path\n",
+           (int) objects.size(), benchmarkConfig.textures, benchmark.duration);
+  }
+
+  if (atlasEnabled) {
+    startupPhase(&startupProfile, "texture atlas");
+    if (!buildTextureAtlas(&textureAtlas, objects, 4096))
+      return(1);
+    for (size_t p = 0; p < textureAtlas.pages.size(); p++) {
+      residencyTrackTexture(&residency, GL_TEXTURE_2D, textureAtlas.pages[p].diffuse, RESIDENCY_MATERIAL);
+      residencyTrackTexture(&residency, GL_TEXTURE_2D, textureAtlas.pages[p].specular, RESIDENCY_MATERIAL);
+    }
+    const MeshSource sources[] = {
+      { vbo, normalesBuffer, cubeTexCoords },
+      { tetrahedronVbo, tetrahedronNormalesBuffer, tetrahedronTexCoords }
+    };
+    applyTextureAtlas(sources);
+    reportTextureAtlas(&textureAtlas);
+  }
+
+  if (virtualTextureImage) {
+    startupPhase(&startupProfile, "virtual texture");
+    jobSystem->wait(virtualTextureBuilt);
+    if (!virtualTextureFileReady ||
+        !createVirtualTexture(&virtualTexture, virtualTexturePath.c_str(),
+                              (size_t) virtualTextureBudget * 1024 * 1024))
+      return(1);
+    residencyTrackTexture(&residency, GL_TEXTURE_2D, virtualTexture.pageTable, RESIDENCY_STREAMING);
+    residencyTrackTexture(&residency, GL_TEXTURE_2D, virtualTexture.cache, RESIDENCY_STREAMING);
+
+    // The page table stands in for the streamed map in the draw items
+    unsigned int streamedMap = objects[0].diffuseMap;
+    int streamedObjects = 0;
+    for (size_t i = 0; i < objects.size(); i++) {
+      if (objects[i].diffuseMap == streamedMap) {
+        objects[i].diffuseMap = virtualTexture.pageTable;
+        streamedObjects++;
+      }
+    }
+    printf("Virtual texture: diffuse map of %d objects\n", streamedObjects);
+  }
+
+  // Programs: only now wait for the compiles and links
+  startupPhase(&startupProfile, "shader compile + link wait");
+  shader_program = finishProgram(&shaderPending);
+  depth_program = finishProgram(&depthPending);
+  if (!shader_program || !depth_program)
+    return(1);
+
+  if (virtualTextureImage) {
+    vt_program = finishProgram(&vtPending);
+    vt_feedback_program = finishProgram(&vtFeedbackPending);
+    if (!vt_program || !vt_feedback_program)
+      return(1);
+  }
+
+  if (gpuCulling) {
+    cull_program = finishProgram(&cullPending);
+    if (!cull_program)
+      return(1);
+  }
+
+  startupPhase(&startupProfile, "render targets + buffers");
+  if (deferredShading) {
+    gbuffer_program = finishProgram(&gbufferPending);
+    lighting_program = finishProgram(&lightingPending);
+    if (!gbuffer_program || !lighting_program)
+      return(1);
+
+    if (!createGBuffer(&gbuffer, gl_width, gl_height))
+      return(1);
+    trackGBuffer(true);
+
+    glGenVertexArrays(1, &fullscreenVao);
+  }
+
+  if (shadowsEnabled) {
+    shadow_program = finishProgram(&shadowPending);
+    if (!shadow_program)
+      return(1);
+
+    if (!createShadowAtlas(&shadowAtlas, shadow_program, SHADOW_TILE_SIZE, 2))
+      return(1);
+    residencyTrackTexture(&residency, GL_TEXTURE_2D, shadowAtlas.texture, RESIDENCY_RENDER_TARGET);
+    residencyTrackTexture(&residency, GL_TEXTURE_2D, shadowAtlas.staticTexture, RESIDENCY_RENDER_TARGET);
+  }
+
+  if (multiDrawEnabled) {
+    // Same geometry again, merged into the multi-draw buffers
+    addMultiDrawMesh(&multiDraw, vertex_positions, normales, cubeTexCoords, 36, NULL, 0);
+    addMultiDrawMesh(&multiDraw, tetrahedronVertices, tetrahedronNormales, tetrahedronTexCoords, 12,
+                     tetrahedronIndices, 12);
+    if (!createMaterialTable(&materialTable, objects, material_shininess) ||
+        !createMultiDraw(&multiDraw, objects, materialTable.objectMaterials, cull_program) ||
+        !createRingBuffer(&frameRing, multiDrawFrameSize(&multiDraw)))
+      return(1);
+    residencyTrackTexture(&residency, GL_TEXTURE_2D_ARRAY, materialTable.textureArray, RESIDENCY_MATERIAL);
+    residencyTrackBuffer(&residency, materialTable.buffer, RESIDENCY_MATERIAL);
+    const GLuint multiDrawBuffers[] = {
+      multiDraw.vbo, multiDraw.ebo, multiDraw.drawIdBuffer, multiDraw.objectBuffer,
+      multiDraw.commandBuffer, multiDraw.countBuffer
+    };
+    for (size_t i = 0; i < sizeof(multiDrawBuffers) / sizeof(multiDrawBuffers[0]); i++)
+      residencyTrackBuffer(&residency, multiDrawBuffers[i], RESIDENCY_GEOMETRY);
+    residencyTrackBuffer(&residency, frameRing.buffer, RESIDENCY_STREAMING);
+    printf("Multi-draw indirect: %d materials in one call, %s culling\n",
+           (int) materialTable.materials.size(), gpuCulling ? "GPU" : "CPU");
+  }
 
   // Uniforms
+  startupPhase(&startupProfile, "uniforms + light data");
   
-  // - Model matrix
-  model_location = glGetUniformLocation(shader_program, "model");
-  
-  // - View matrix
-  view_location = glGetUniformLocation(shader_program, "view");
+  shader_uniforms = findSceneUniforms(shader_program);
+  depth_uniforms = findSceneUniforms(depth_program);
+
+  // - Light data texture (light, light2 and extra lights)
+  light_data_texture = createLightData(extraLights, &light_count);
+  residencyTrackTexture(&residency, GL_TEXTURE_2D, light_data_texture, RESIDENCY_OTHER);
+  printf("Lights: %d (%s shading)\n", light_count, deferredShading ? "deferred" : "forward");
+
+  glsUseProgram(shader_program);
+  setUniform(findUniform<int>(shader_program, "light_data"), 2);
+  setUniform(findUniform<int>(shader_program, "light_count"), light_count);
+  setUniform(findUniform<int>(shader_program, "material_maps"), 0);
+  setShadowUniforms(shader_program, 3);
+
+  if (virtualTextureImage) {
+    // - Virtual texture: Phong with the streamed diffuse map, and feedback
+    vt_uniforms = findSceneUniforms(vt_program);
+    vt_feedback_uniforms = findSceneUniforms(vt_feedback_program);
+
+    glsUseProgram(vt_program);
+    setUniform(findUniform<int>(vt_program, "light_data"), 2);
+    setUniform(findUniform<int>(vt_program, "light_count"), light_count);
+    setShadowUniforms(vt_program, 3);
+    setVirtualTextureUniforms(&virtualTexture, vt_program, 0, VT_CACHE_UNIT);
+
+    glsUseProgram(vt_feedback_program);
+    setVirtualTextureUniforms(&virtualTexture, vt_feedback_program, 0, VT_CACHE_UNIT);
+  }
+
+  if (deferredShading) {
+    // - G-buffer pass: same transformation and material uniforms as forward
+    gbuffer_uniforms = findSceneUniforms(gbuffer_program);
+
+    glsUseProgram(gbuffer_program);
+    setUniform(gbuffer_uniforms.materialDiffuse, 0);
+    setUniform(gbuffer_uniforms.materialSpecular, 1);
+    setUniform(findUniform<int>(gbuffer_program, "material_maps"), 0);
+
+    // - Lighting pass: G-buffer targets on units 0-3, light data on unit 4
+    lighting_uniforms = findSceneUniforms(lighting_program);
+
+    glsUseProgram(lighting_program);
+    setUniform(findUniform<int>(lighting_program, "g_position"), GBUFFER_POSITION);
+    setUniform(findUniform<int>(lighting_program, "g_normal"), GBUFFER_NORMAL);
+    setUniform(findUniform<int>(lighting_program, "g_albedo"), GBUFFER_ALBEDO);
+    setUniform(findUniform<int>(lighting_program, "g_specular"), GBUFFER_SPECULAR);
+    setUniform(findUniform<int>(lighting_program, "light_data"), GBUFFER_TARGETS);
+    setUniform(findUniform<int>(lighting_program, "light_count"), light_count);
+    setShadowUniforms(lighting_program, GBUFFER_TARGETS + 1);
+  }
+  glsUseProgram(0);
 
-  // - Projection matrix
-  proj_location = glGetUniformLocation(shader_program, "projection");
+  // Forward shading variants of the scene materials (the multi-draw and
+  // multi-view paths draw every material with one program)
+  if (!deferredShading && !multiDrawEnabled && viewCount == 1)
+    requestMaterialPermutations();
 
-  // - Normal matrix: normal vectors from local to world coordinates
-  normal_location = glGetUniformLocation(shader_program, "normal_to_world");
-  
-  // - Camera position
-  camera_pos_location = glGetUniformLocation(shader_program, "view_pos");
-
-  // - Light data (light1)
-  light_position_location = glGetUniformLocation(shader_program, "light.position"); 
-  light_ambient_location = glGetUniformLocation(shader_program, "light.ambient"); 
-  light_diffuse_location = glGetUniformLocation(shader_program, "light.diffuse"); 
-  light_specular_location = glGetUniformLocation(shader_program, "light.specular");
-  
-  // - Light data (light2)
-  light2_position_location = glGetUniformLocation(shader_program, "light2.position");
-  light2_ambient_location = glGetUniformLocation(shader_program, "light2.ambient");
-  light2_diffuse_location = glGetUniformLocation(shader_program, "light2.diffuse");
-  light_specular_location = glGetUniformLocation(shader_program, "light2.specular");
-
-  // - Material data
-  material_ambient_location = glGetUniformLocation(shader_program, "material.ambient"); 
-  material_diffuse_location = glGetUniformLocation(shader_program, "material.diffuse"); 
-  material_specular_location = glGetUniformLocation(shader_program, "material.specular"); 
-  material_shininess_location = glGetUniformLocation(shader_program, "material.shininess");
+  // Occlusion queries to count the fragments reaching each pass
+  glGenQueries(2, prepass_queries);
+  glGenQueries(2, shading_queries);
+
+  // Per-frame arenas; they grow on their own if a frame ever overflows
+  initFrameArena(&renderArena, 256 * 1024);
+
+  reportResidency(&residency);
+
+  startupPhase(&startupProfile, "first frame");
 
 // Render loop
-  while(!glfwWindowShouldClose(window)) {
+  if (threadedPipeline) {
+    runThreaded(window);
+  } else {
+    FramePacket frame;
 
-    processInput(window);
+    while(!glfwWindowShouldClose(window)) {
+      TRACE_SCOPE("frame");
+
+      processInput(window);
 
-    render(glfwGetTime(), 
-           &cubeVao,
-           &tetrahedronVao,
-           tetrahedronScaleFactor,
-           cubeDiffuseMap, 
-           tetrahedronDiffuseMap,
-           cubeSpecularMap,
-           tetrahedronSpecularMap,
-           activeCameraIndex);
+      simulate(glfwGetTime(), &frame);
+      render(frame);
 
-    glfwSwapBuffers(window);
+      updateOverdrawStats(frame);
 
-    glfwPollEvents();
+      paceFrame(&framePacer);
+      {
+        TRACE_SCOPE("glfwSwapBuffers");
+        glfwSwapBuffers(window);
+      }
+      endStartupProfile(&startupProfile);
+
+      glfwPollEvents();
+    }
+  }
+
+  if (benchmarkConfig.objects > 0) {
+    reportBenchmark(&benchmark);
+    destroyBenchmark(&benchmark);
+  }
+  destroyFrameArena(&renderArena);
+  if (deferredShading)
+    destroyGBuffer(&gbuffer);
+  if (shadowsEnabled)
+    destroyShadowAtlas(&shadowAtlas);
+  if (multiDrawEnabled) {
+    destroyMultiDraw(&multiDraw);
+    destroyMaterialTable(&materialTable);
+    destroyRingBuffer(&frameRing);
   }
+  if (atlasEnabled)
+    destroyTextureAtlas(&textureAtlas);
+  if (virtualTextureImage)
+    destroyVirtualTexture(&virtualTexture);
+  for (size_t i = 0; i < meshletMeshes.size(); i++)
+    destroyMeshletMesh(&meshletMeshes[i]);
+  destroyResidency(&residency);
+
+  if (shaderPermutations.generic)
+    destroyShaderPermutations(&shaderPermutations);
 
   glfwTerminate();
 
-  return 0;
+  // Kept until now for the shader variants compiled after startup
+  for (size_t i = 0; i < shaderFiles.size(); i++)
+    free(shaderFiles[i].source);
+  shaderFiles.clear();
+
+  delete jobSystem;
+
+  if (traceFile)
+    writeTrace(traceFile);
+
+  return (captureFile && !captureOk) ? 1 : 0;
 }
 
-void render(double currentTime,
-            GLuint *cubeVao,
-            GLuint *tetrahedronVao,
-            const float tetrahedronScaleFactor,
-            unsigned int cubeDiffuseMap,
-            unsigned int tetrahedronDiffuseMap,
-            unsigned int cubeSpecularMap,
-            unsigned int tetrahedronSpecularMap,
-            int activeCameraIndex) {
+// Simulation: everything a frame needs that doesn't touch GL (object
+// transforms, cameras, frustum culling), written into an immutable packet
+void simulate(double wallTime, FramePacket *frame) {
+  TRACE_SCOPE("simulate");
+  double currentTime = advanceClock(&simClock, wallTime);
+
+  frame->time = wallTime;
+  frame->simTime = currentTime;
+  frame->width = gl_width;
+  frame->height = gl_height;
+  frame->cameraIndex = activeCameraIndex;
+  frame->depthPrepass = depthPrepass;
+
+  // Cameras only rebuild their matrices when they move or the aspect ratio
+  // changes (camera.h). With several views, every viewport has the size of
+  // the first
+  float aspect = (float) frame->width / (float) frame->height;
+  glm::vec4 viewports[MAX_VIEWS];
+  if (viewCount > 1) {
+    layoutViews(viewCount, frame->width, frame->height, viewports);
+    aspect = viewports[0].z / viewports[0].w;
+  }
+
+  Camera *camera = &camera1;
+  if (benchmarkConfig.objects > 0) {
+    // Benchmark flythrough, driven by the (deterministic) animation time
+    glm::vec3 position, target;
+    sampleCameraPath(benchmark.path, currentTime, &position, &target);
+    setCameraLookAt(&pathCamera, position, target);
+    camera = &pathCamera;
+  } else if (frame->cameraIndex == 1 && viewCount == 1) {
+    // (with several views camera 2 has its own)
+    camera = &camera2;
+  }
+
+  // Multi-view: the camera above is view 0, camera 2 view 1, the orbiting
+  // cameras the rest
+  Camera *viewCameras[MAX_VIEWS] = { camera };
+  for (int v = 1; v < viewCount; v++)
+    viewCameras[v] = v == 1 ? &camera2 : &orbitCameras[v];
+  for (int v = 0; v < viewCount; v++) {
+    setCameraAspect(viewCameras[v], aspect);
+    updateCamera(viewCameras[v], &cameraStats);
+  }
 
-  float f = (float)currentTime * 0.3f;
+  frame->view = camera->view;
+  frame->proj = camera->proj;
+  frame->cameraPos = camera->position;
+  frame->frustum = camera->frustum;
+
+  frame->views.resize(viewCount > 1 ? viewCount : 0);
+  frame->projs.resize(frame->views.size());
+  frame->viewPositions.resize(frame->views.size());
+  frame->viewports.resize(frame->views.size());
+  for (size_t v = 0; v < frame->views.size(); v++) {
+    frame->views[v] = viewCameras[v]->view;
+    frame->projs[v] = viewCameras[v]->proj;
+    frame->viewPositions[v] = viewCameras[v]->position;
+    frame->viewports[v] = viewports[v];
+  }
+  int viewHeight = viewCount > 1 ? (int) viewports[0].w : frame->height;
+
+  // Object transforms + view frustum culling (visible: in any view's
+  // frustum), spread over the job system
+  frame->models.resize(objects.size());
+  frame->visible.resize(objects.size());
+  frame->lodMeshes.resize(objects.size());
+  objectLods.resize(objects.size());
+  float pixelScale = lodPixelScale(frame->proj, viewHeight);
+
+  jobSystem->parallelFor(objects.size(), 256, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const SceneObject &object = objects[i];
+      frame->models[i] = objectModelMatrix(object, currentTime);
+      glm::vec3 center(frame->models[i][3]);
+      float radius = meshes[object.mesh].radius * object.scale;
+      frame->visible[i] = false;
+      for (int f = 0; f < viewCount && !frame->visible[i]; f++)
+        frame->visible[i] = sphereInFrustum(viewCameras[f]->frustum, center, radius);
+
+      // Level of detail by projected error, from the nearest point of the
+      // bounding sphere (to the nearest camera)
+      frame->lodMeshes[i] = object.mesh;
+      if (lodEnabled && frame->visible[i]) {
+        float distance = glm::length(center - frame->cameraPos);
+        for (size_t v = 1; v < frame->viewPositions.size(); v++)
+          distance = glm::min(distance, glm::length(center - frame->viewPositions[v]));
+        distance = glm::max(distance - radius, 0.1f);
+        frame->lodMeshes[i] = selectLod(meshes, object.mesh, pixelScale * object.scale / distance,
+                                        lodThreshold, &objectLods[i]);
+      }
+    }
+  });
+}
+
+// GPU-side per-frame data comes from the next ring segment, which is fenced
+// once every command reading it has been submitted
+void render(const FramePacket &frame) {
+  TRACE_SCOPE("render");
+  Arena *arena = beginFrameArena(&renderArena);
+
+  if (benchmarkConfig.objects > 0)
+    beginBenchmarkFrame(&benchmark);
+  if (multiDrawEnabled)
+    beginRingFrame(&frameRing);
+  if (shaderPermutations.generic)
+    updateShadingVariants();
+  if (virtualTextureImage)
+    updateVirtualTexture(&virtualTexture, VT_UPLOADS_PER_FRAME);
+  updateResidency(&residency);
+
+  unsigned long long draws = renderQueue.stats.draws + multiDraw.commandsSubmitted;
+  unsigned long long indirectCalls = multiDraw.indirectCalls;
+  unsigned long long ringBytes = frameRing.bytesAllocated;
+
+  renderScene(frame, arena);
+
+  if (multiDrawEnabled)
+    endRingFrame(&frameRing);
+
+  // This frame's share of the stats, as trace counters
+  // GPU culling compacts the commands on the GPU: only the calls are known
+  if (multiDrawEnabled && gpuCulling)
+    TRACE_COUNTER("indirect calls", (double) (multiDraw.indirectCalls - indirectCalls));
+  else
+    TRACE_COUNTER("draws", (double) (renderQueue.stats.draws + multiDraw.commandsSubmitted - draws));
+  if (multiDrawEnabled)
+    TRACE_COUNTER("ring KB", (frameRing.bytesAllocated - ringBytes) / 1024.0);
+  if (traceEnabled.load(std::memory_order_relaxed))
+    traceJobCounters();
+
+  // End of the camera path: close the window, main prints the report
+  if (benchmarkConfig.objects > 0 && endBenchmarkFrame(&benchmark, frame))
+    glfwSetWindowShouldClose(glfwGetCurrentContext(), 1);
+
+  // Capture frame: read back before the swap, then quit
+  if (captureFile && !captureDone && frame.simTime >= captureTime) {
+    captureOk = captureFramebuffer(captureFile, frame.width, frame.height);
+    captureDone = true;
+    if (captureOk)
+      printf("Captured t = %.4f s to %s\n", frame.simTime, captureFile);
+    glfwSetWindowShouldClose(glfwGetCurrentContext(), 1);
+  }
+}
+
+void renderScene(const FramePacket &frame, Arena *arena) {
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  glViewport(0, 0, gl_width, gl_height);
+  glViewport(0, 0, frame.width, frame.height);
+
+  GLuint prepass_query = prepass_queries[query_frame];
+  GLuint shading_query = shading_queries[query_frame];
+
+  // Shadow atlas: only lights whose casters (or themselves) moved are redrawn.
+  // Every object casts, visible or not
+  if (shadowsEnabled) {
+    TRACE_SCOPE("shadow atlas");
+    ArenaVector<ShadowCaster> casters(objects.size(), ShadowCaster(),
+                                      ArenaAllocator<ShadowCaster>(arena));
+    ShadowLight shadowLights[2] = {
+      { light_pos, SHADOW_RANGE },
+      { light2_pos, SHADOW_RANGE }
+    };
+
+    for (size_t i = 0; i < objects.size(); i++) {
+      const Mesh &mesh = meshes[objects[i].mesh];
+      casters[i] = { mesh.vao, mesh.vertexCount, frame.models[i],
+                     glm::vec3(frame.models[i][3]), mesh.radius * objects[i].scale,
+                     objects[i].isStatic };
+    }
+
+    updateShadowAtlas(&shadowAtlas, shadowLights, 2, casters.data(), (int) casters.size());
+    glViewport(0, 0, frame.width, frame.height);
+  }
+
+  // Draw items of every pass, sorted to share programs, VAOs and textures
+  // (or, with multi-draw, the per-draw buffers and indirect commands)
+  {
+    TRACE_SCOPE("build draws");
+    if (multiDrawEnabled)
+      updateMultiDraw(&multiDraw, frame, objects, meshes, &frameRing, jobSystem);
+    else
+      buildRenderQueue(frame, &renderQueue, arena);
+  }
 
-  glUseProgram(shader_program);
-  glBindVertexArray(*cubeVao);
+  // Deferred shading: geometry pass into the G-buffer, then one Phong
+  // evaluation per visible pixel in a full-screen lighting pass
+  if (deferredShading) {
+    TRACE_SCOPE("deferred passes");
+    if (gbuffer.width != frame.width || gbuffer.height != frame.height) {
+      trackGBuffer(false);
+      createGBuffer(&gbuffer, frame.width, frame.height);
+      trackGBuffer(true);
+    }
 
-  glm::mat4 model_matrix, view1_matrix, proj1_matrix, view2_matrix, proj2_matrix;
-  glm::mat3 normal_matrix;
+    glsBindFramebuffer(GL_FRAMEBUFFER, gbuffer.fbo);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glBeginQuery(GL_SAMPLES_PASSED, shading_query);
 
-  model_matrix = glm::mat4(1.f);
+    glsUseProgram(gbuffer_program);
+    setUniform(gbuffer_uniforms.view, frame.view);
+    setUniform(gbuffer_uniforms.projection, frame.proj);
+    setUniform(gbuffer_uniforms.materialShininess, material_shininess);
 
-  model_matrix = glm::rotate(model_matrix,
-                             glm::radians((float)currentTime * 30.0f),
-                             glm::vec3(0.0f, 1.0f, 0.0f));
+    drawScene(RENDER_PASS_GBUFFER);
 
-  model_matrix = glm::rotate(model_matrix,
-                             glm::radians((float)currentTime * 81.0f),
-                             glm::vec3(1.0f, 0.0f, 0.0f));
+    glEndQuery(GL_SAMPLES_PASSED);
+    queries_issued[query_frame] |= SHADING_QUERY_ISSUED;
+    glsBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-  // Camera1 PoV
-  view1_matrix = glm::lookAt(camera1_pos,                  // pos
-                             glm::vec3(0.0f, 0.0f, 0.0f),  // target
-                             glm::vec3(0.0f, 1.0f, 0.0f)); // up
+    // Lighting pass over the whole screen, background pixels are discarded
+    glsDisable(GL_DEPTH_TEST);
+    glsUseProgram(lighting_program);
+    setUniform(lighting_uniforms.viewPos, frame.cameraPos);
 
-  // Projection 1
-  proj1_matrix = glm::perspective(glm::radians(50.0f),
-                                 (float) gl_width / (float) gl_height,
-                                 0.1f, 1000.0f);
+    if (shadowsEnabled) {
+      uploadShadowMatrices(lighting_uniforms);
+      glsBindTexture(GBUFFER_TARGETS + 1, GL_TEXTURE_2D, shadowAtlas.texture);
+    }
 
-  // Camera1 PoV
-  view2_matrix = glm::lookAt(camera2_pos,                  // pos
-                             glm::vec3(0.7f, 0.0f, 0.0f),  // target
-                             glm::vec3(0.0f, 1.0f, 0.0f)); // up
+    bindGBufferTextures(&gbuffer, 0);
+    glsBindTexture(GBUFFER_TARGETS, GL_TEXTURE_2D, light_data_texture);
 
-  // Projection 2
-  proj2_matrix = glm::perspective(glm::radians(50.0f),
-                                 (float) gl_width / (float) gl_height,
-                                 0.1f, 1000.0f);
+    glsBindVertexArray(fullscreenVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glsEnable(GL_DEPTH_TEST);
 
-  if (activeCameraIndex == 0) {
-    glUniformMatrix4fv(view_location, 1, GL_FALSE, glm::value_ptr(view1_matrix));
-    glUniformMatrix4fv(proj_location, 1, GL_FALSE, glm::value_ptr(proj1_matrix));
-    glUniform3fv(camera_pos_location, 1, glm::value_ptr(camera1_pos));
-  } else if (activeCameraIndex == 1) {
-    glUniformMatrix4fv(view_location, 1, GL_FALSE, glm::value_ptr(view2_matrix));
-    glUniformMatrix4fv(proj_location, 1, GL_FALSE, glm::value_ptr(proj2_matrix));
-    glUniform3fv(camera_pos_location, 1, glm::value_ptr(camera2_pos));
+    return;
   }
 
-  glUniformMatrix4fv(model_location, 1, GL_FALSE, glm::value_ptr(model_matrix));
-  
-  // Normal matrix: normal vectors to world coordinates
-  normal_matrix = glm::inverseTranspose(glm::mat3(model_matrix));
-  glUniformMatrix3fv(normal_location, 1, GL_FALSE, glm::value_ptr(normal_matrix));
+  // Depth prepass: same geometry and transforms, no colour writes
+  if (frame.depthPrepass) {
+    TRACE_SCOPE("depth prepass");
+    glsUseProgram(depth_program);
+    glsColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glBeginQuery(GL_SAMPLES_PASSED, prepass_query);
+
+    setUniform(depth_uniforms.view, frame.view);
+    setUniform(depth_uniforms.projection, frame.proj);
+    if (instancedViews) {
+      setUniform(depth_uniforms.views, frame.views.data(), (int) frame.views.size());
+      setUniform(depth_uniforms.projections, frame.projs.data(), (int) frame.projs.size());
+    }
 
-  glUniform3fv(light_position_location, 1, glm::value_ptr(light_pos));
-  glUniform3fv(light_ambient_location, 1, glm::value_ptr(light_ambient));
-  glUniform3fv(light_diffuse_location, 1, glm::value_ptr(light_diffuse));
-  glUniform3fv(light_specular_location, 1, glm::value_ptr(light_specular));
+    drawViews(frame, RENDER_PASS_DEPTH, depth_program, depth_uniforms);
 
-  glUniform3fv(light2_position_location, 1, glm::value_ptr(light2_pos));
-  glUniform3fv(light2_ambient_location, 1, glm::value_ptr(light2_ambient));
-  glUniform3fv(light2_diffuse_location, 1, glm::value_ptr(light2_diffuse));
-  glUniform3fv(light2_specular_location, 1, glm::value_ptr(light2_specular));
+    glEndQuery(GL_SAMPLES_PASSED);
+    queries_issued[query_frame] |= PREPASS_QUERY_ISSUED;
+    glsColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-  glUniform3fv(material_ambient_location, 1, glm::value_ptr(material_ambient));
-  glUniform1f(material_diffuse_location, material_diffuse);
-  glUniform1f(material_specular_location, material_specular);
-  glUniform1f(material_shininess_location, material_shininess);
+    // Shading pass only touches fragments matching the stored depth
+    glsDepthFunc(GL_LEQUAL);
+    glsDepthMask(GL_FALSE);
+  }
 
-  // bind diffuse map
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, cubeDiffuseMap);
+  TRACE_SCOPE("shading pass");
+  glBeginQuery(GL_SAMPLES_PASSED, shading_query);
 
-  // bind specular map
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, cubeSpecularMap);
+  // Same frame uniforms for the generic program and every linked variant
+  for (size_t v = 0; v < shadingVariants.size(); v++) {
+    if (shadingVariants[v].program) {
+      glsUseProgram(shadingVariants[v].program);
+      setShadingUniforms(shadingVariants[v].uniforms, frame);
+    }
+  }
+  glsUseProgram(shader_program);
+  setShadingUniforms(shader_uniforms, frame);
 
-  glDrawArrays(GL_TRIANGLES, 0, 36);
-  glBindVertexArray(0);
+  if (virtualTextureImage) {
+    glsUseProgram(vt_program);
+    setShadingUniforms(vt_uniforms, frame);
+    bindVirtualTextureCache(&virtualTexture, VT_CACHE_UNIT);
+  }
 
-  // Draw the tetrahedron
-  glBindVertexArray(*tetrahedronVao);
-  model_matrix = glm::mat4(1.f);
-  glm::vec3 tetrahedron_pos(0.7f,0.0f,0.0f);
+  // bind light data (extra lights)
+  glsBindTexture(2, GL_TEXTURE_2D, light_data_texture);
 
-  model_matrix = glm::rotate(model_matrix,
-                             glm::radians((float)currentTime * 30.0f),
-                             glm::vec3(0.0f, 1.0f, 0.0f));
+  // bind shadow atlas
+  if (shadowsEnabled)
+    glsBindTexture(3, GL_TEXTURE_2D, shadowAtlas.texture);
 
-  model_matrix = glm::rotate(model_matrix,
-                             glm::radians((float)currentTime * 40.0f),
-                             glm::vec3(1.0f, 0.0f, 0.0f));
+  drawViews(frame, RENDER_PASS_OPAQUE, shader_program, shader_uniforms);
 
-  model_matrix = glm::translate(model_matrix, tetrahedron_pos);
-  model_matrix = glm::scale(model_matrix, glm::vec3(tetrahedronScaleFactor));
+  glEndQuery(GL_SAMPLES_PASSED);
+  queries_issued[query_frame] |= SHADING_QUERY_ISSUED;
 
-  glUniformMatrix4fv(model_location, 1, GL_FALSE, glm::value_ptr(model_matrix));
-  
-  // Normal matrix: normal vectors to world coordinates
-  normal_matrix = glm::inverseTranspose(glm::mat3(model_matrix));
-  glUniformMatrix3fv(normal_location, 1, GL_FALSE, glm::value_ptr(normal_matrix));
+  if (frame.depthPrepass) {
+    glsDepthMask(GL_TRUE);
+    glsDepthFunc(GL_LESS);
+  }
+
+  // Tiles the streamed objects need, read back by a later updateVirtualTexture
+  if (virtualTextureImage) {
+    TRACE_SCOPE("virtual texture feedback");
+    beginVirtualTextureFeedback(&virtualTexture, frame.width, frame.height);
+    glsUseProgram(vt_feedback_program);
+    setUniform(vt_feedback_uniforms.view, frame.view);
+    setUniform(vt_feedback_uniforms.projection, frame.proj);
+
+    drawScene(RENDER_PASS_VT_FEEDBACK);
+
+    endVirtualTextureFeedback(&virtualTexture);
+    glViewport(0, 0, frame.width, frame.height);
+  }
+}
+
+// One draw item per visible object and pass. Keys put the depth prepass
+// first and sort each pass by program, then material, then front to back
+void buildRenderQueue(const FramePacket &frame, RenderQueue *queue, Arena *arena) {
+  clearRenderQueue(queue, arena, objects.size() * 2);
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (!frame.visible[i])
+      continue;
+
+    const SceneObject &object = objects[i];
+    const Mesh &mesh = meshes[frame.lodMeshes[i]];
+    float depth = -(frame.view * frame.models[i][3]).z;
+    if (lodEnabled) {
+      stats_lod_triangles += mesh.vertexCount / 3;
+      stats_full_triangles += meshes[object.mesh].vertexCount / 3;
+    }
+
+    DrawItem item;
+    item.vao = mesh.vao;
+    item.vertexCount = mesh.vertexCount;
+    item.model = &frame.models[i];
+
+    // Meshlets: only the index ranges of the clusters that survive culling
+    if (meshletsEnabled && frame.lodMeshes[i] < (int) meshletMeshes.size()) {
+      const MeshletMesh &clusters = meshletMeshes[frame.lodMeshes[i]];
+      size_t n = clusters.meshlets.size();
+      GLsizei *counts = (GLsizei *) arenaAlloc(arena, n * sizeof(GLsizei), alignof(GLsizei));
+      const void **offsets = (const void **) arenaAlloc(arena, n * sizeof(void *), alignof(void *));
+      item.rangeCount = cullMeshlets(clusters, frame.models[i], frame.frustum, frame.cameraPos,
+                                     counts, offsets, &meshletStats);
+      if (item.rangeCount == 0)
+        continue;
+      item.vao = clusters.vao;
+      item.rangeCounts = counts;
+      item.rangeOffsets = offsets;
+    }
+
+    residencyTouch(&residency, object.diffuseMap);
+    residencyTouch(&residency, object.specularMap);
+
+    if (deferredShading) {
+      item.program = gbuffer_program;
+      item.model_uniform = gbuffer_uniforms.model;
+      item.normal_uniform = gbuffer_uniforms.normalToWorld;
+      item.diffuseMap = object.diffuseMap;
+      item.specularMap = object.specularMap;
+      item.key = makeSortKey(RENDER_PASS_GBUFFER, item.program,
+                             item.diffuseMap, item.specularMap, depth);
+      pushDrawItem(queue, item);
+      continue;
+    }
+
+    if (frame.depthPrepass) {
+      item.program = depth_program;
+      item.model_uniform = depth_uniforms.model;
+      item.normal_uniform = Uniform<glm::mat3>();
+      item.diffuseMap = item.specularMap = 0;
+      item.key = makeSortKey(RENDER_PASS_DEPTH, item.program, 0, 0, depth);
+      pushDrawItem(queue, item);
+    }
+
+    item.program = shader_program;
+    item.model_uniform = shader_uniforms.model;
+    item.normal_uniform = shader_uniforms.normalToWorld;
+    item.diffuseMap = object.diffuseMap;
+    item.specularMap = object.specularMap;
+
+    // Streamed diffuse map: its own program (page table on the diffuse
+    // unit), and a draw in the feedback pass
+    if (virtualTextureImage && object.diffuseMap == virtualTexture.pageTable) {
+      item.program = vt_program;
+      item.model_uniform = vt_uniforms.model;
+      item.normal_uniform = vt_uniforms.normalToWorld;
+      item.key = makeSortKey(RENDER_PASS_OPAQUE, item.program,
+                             item.diffuseMap, item.specularMap, depth);
+      pushDrawItem(queue, item);
+
+      item.program = vt_feedback_program;
+      item.model_uniform = vt_feedback_uniforms.model;
+      item.normal_uniform = Uniform<glm::mat3>();
+      item.diffuseMap = item.specularMap = 0;
+      item.key = makeSortKey(RENDER_PASS_VT_FEEDBACK, item.program, 0, 0, depth);
+      pushDrawItem(queue, item);
+      continue;
+    }
+
+    // The material's variant once linked; it leaves unused maps unbound
+    int variant = objectVariants.empty() ? -1 : objectVariants[i];
+    if (variant >= 0 && shadingVariants[variant].program) {
+      unsigned int key = shaderPermutations.variants[variant].key;
+      item.program = shadingVariants[variant].program;
+      item.model_uniform = shadingVariants[variant].uniforms.model;
+      item.normal_uniform = shadingVariants[variant].uniforms.normalToWorld;
+      if (!(key & PERMUTATION_HAS_TEXTURE))
+        item.diffuseMap = 0;
+      if (!(key & PERMUTATION_HAS_SPECULAR_MAP))
+        item.specularMap = 0;
+      stats_variant_draws++;
+    } else {
+      stats_generic_draws++;
+    }
+
+    item.key = makeSortKey(RENDER_PASS_OPAQUE, item.program,
+                           item.diffuseMap, item.specularMap, depth);
+    pushDrawItem(queue, item);
+  }
+
+  sortRenderQueue(queue);
+}
+
+// Draws the visible objects of one pass with the current pass uniforms
+void drawScene(RenderPass pass, int instances) {
+  if (multiDrawEnabled) {
+    bindMaterialTable(&materialTable, 0);
+    submitMultiDraw(&multiDraw);
+  } else {
+    submitRenderQueue(&renderQueue, pass, instances);
+  }
+}
+
+// Draws a pass in every view (--views): one instanced submission when the
+// vertex shader can pick the viewport, otherwise one submission per view
+// with that view's camera in program's single-view uniforms
+void drawViews(const FramePacket &frame, RenderPass pass, GLuint program,
+               const SceneUniforms &uniforms) {
+  int views = (int) frame.views.size();
+  if (views == 0) {
+    drawScene(pass);
+    return;
+  }
+
+  if (instancedViews) {
+    setViewports(frame.viewports.data(), views);
+    drawScene(pass, views);
+  } else {
+    for (int v = 0; v < views; v++) {
+      const glm::vec4 &viewport = frame.viewports[v];
+      glViewport((GLint) viewport.x, (GLint) viewport.y, (GLsizei) viewport.z, (GLsizei) viewport.w);
+      glsUseProgram(program);
+      setUniform(uniforms.view, frame.views[v]);
+      setUniform(uniforms.projection, frame.projs[v]);
+      setUniform(uniforms.viewPos, frame.viewPositions[v]);
+      drawScene(pass);
+    }
+  }
+  // (sets every viewport of the array)
+  glViewport(0, 0, frame.width, frame.height);
+}
 
-  glUniform1i(material_diffuse_location, material_diffuse);
-  glUniform1i(material_specular_location, material_specular);
+// Threaded frame pipeline (--threaded): the main thread only handles window
+// events and input, a simulation thread builds frame N+1 while the render
+// thread (which owns the GL context) submits frame N and swaps
+void runThreaded(GLFWwindow *window) {
+  static TripleBuffer<FramePacket> framePackets;
+  std::atomic<bool> running(true);
+
+  glfwMakeContextCurrent(NULL);
+
+  std::thread renderThread([&] {
+    traceThreadName("render");
+    glfwMakeContextCurrent(window);
+
+    while (framePackets.waitAndAcquire(running)) {
+      TRACE_SCOPE("frame");
+      const FramePacket &frame = framePackets.readBuffer();
+      render(frame);
+      updateOverdrawStats(frame);
+      paceFrame(&framePacer);
+      TRACE_SCOPE("glfwSwapBuffers");
+      glfwSwapBuffers(window);
+      endStartupProfile(&startupProfile);
+    }
 
-  // bind diffuse map
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, tetrahedronDiffuseMap);
+    glfwMakeContextCurrent(NULL);
+  });
 
-  // bind diffuse map
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, tetrahedronSpecularMap);
+  std::thread simulationThread([&] {
+    traceThreadName("simulation");
+    do {
+      simulate(glfwGetTime(), &framePackets.writeBuffer());
+      framePackets.publish();
+    } while (framePackets.waitUntilConsumed(running));
+  });
 
-  glDrawArrays(GL_TRIANGLES, 0, 12);
-  glBindVertexArray(0);
+  while (!glfwWindowShouldClose(window)) {
+    {
+      TRACE_SCOPE("glfwWaitEvents");
+      glfwWaitEventsTimeout(0.004);
+    }
+    processInput(window);
+  }
+
+  running = false;
+  framePackets.wake();
+  simulationThread.join();
+  renderThread.join();
+
+  glfwMakeContextCurrent(window);
 }
 
 void processInput(GLFWwindow *window) {
+  TRACE_SCOPE("processInput");
   if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
     glfwSetWindowShouldClose(window, 1);
   
@@ -632,6 +1771,438 @@ void processInput(GLFWwindow *window) {
   
   if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
     activeCameraIndex = 1;
+
+  // P toggles the depth prepass (on key press, not while held)
+  if (keyPressed(window, GLFW_KEY_P)) {
+    depthPrepass = !depthPrepass;
+    printf("Depth prepass: %s\n", depthPrepass ? "ON" : "OFF");
+  }
+
+  // Animation clock
+  if (keyPressed(window, GLFW_KEY_SPACE)) {
+    simClock.paused = !simClock.paused;
+    printf("Animation: %s\n", simClock.paused ? "PAUSED" : "RUNNING");
+  }
+  if (keyPressed(window, GLFW_KEY_PERIOD) && simClock.paused)
+    simClock.stepRequests++;
+  if (keyPressed(window, GLFW_KEY_EQUAL) || keyPressed(window, GLFW_KEY_KP_ADD)) {
+    simClock.speed = simClock.speed * 2.0;
+    printf("Animation speed: x%g\n", simClock.speed.load());
+  }
+  if (keyPressed(window, GLFW_KEY_MINUS) || keyPressed(window, GLFW_KEY_KP_SUBTRACT)) {
+    simClock.speed = simClock.speed * 0.5;
+    printf("Animation speed: x%g\n", simClock.speed.load());
+  }
+}
+
+// True on the frame a key goes down, not while it is held
+static bool keyPressed(GLFWwindow *window, int key) {
+  static int previous[GLFW_KEY_LAST + 1];
+  int state = glfwGetKey(window, key);
+  bool pressed = state == GLFW_PRESS && previous[key] != GLFW_PRESS;
+  previous[key] = state;
+  return pressed;
+}
+
+// Fills the light data texture: rows 0 and 1 are light and light2, then
+// extraLightCount dimmer lights spread on a ring around the scene so heavy
+// light counts can be benchmarked without washing out the image
+GLuint createLightData(int extraLightCount, int *lightCount) {
+  if (extraLightCount < 0)
+    extraLightCount = 0;
+  if (extraLightCount > MAX_LIGHTS - 2)
+    extraLightCount = MAX_LIGHTS - 2;
+
+  int count = 2 + extraLightCount;
+  glm::vec3 *data = new glm::vec3[count * 4];
+
+  data[0] = light_pos;  data[1] = light_ambient;  data[2] = light_diffuse;  data[3] = light_specular;
+  data[4] = light2_pos; data[5] = light2_ambient; data[6] = light2_diffuse; data[7] = light2_specular;
+
+  for (int i = 0; i < extraLightCount; i++) {
+    float angle = 2.0f * 3.14159265f * (float) i / (float) extraLightCount;
+    float intensity = 1.0f / (float) extraLightCount;
+    glm::vec3 colour(0.5f + 0.5f * cosf(angle),
+                     0.5f + 0.5f * cosf(angle + 2.094f),
+                     0.5f + 0.5f * cosf(angle + 4.189f));
+
+    glm::vec3 *row = &data[(2 + i) * 4];
+    row[0] = glm::vec3(lightRingRadius * cosf(angle), 0.5f * sinf(3.0f * angle),
+                       lightRingRadius * sinf(angle));
+    row[1] = glm::vec3(0.0f);
+    row[2] = colour * intensity;
+    row[3] = colour * intensity;
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glsBindTexture(0, GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 4, count, 0, GL_RGB, GL_FLOAT, data);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glsBindTexture(0, GL_TEXTURE_2D, 0);
+
+  delete[] data;
+
+  *lightCount = count;
+  return texture;
+}
+
+// Handles of every scene uniform the program has
+SceneUniforms findSceneUniforms(GLuint program) {
+  SceneUniforms u;
+  u.model = findUniform<glm::mat4>(program, "model");
+  u.view = findUniform<glm::mat4>(program, "view");
+  u.projection = findUniform<glm::mat4>(program, "projection");
+  u.normalToWorld = findUniform<glm::mat3>(program, "normal_to_world");
+  u.viewPos = findUniform<glm::vec3>(program, "view_pos");
+  u.views = findUniform<glm::mat4>(program, "views");
+  u.projections = findUniform<glm::mat4>(program, "projections");
+  u.viewPositions = findUniform<glm::vec3>(program, "view_positions");
+
+  LightUniforms *lights[2] = { &u.light, &u.light2 };
+  const char *lightNames[2] = { "light", "light2" };
+  for (int i = 0; i < 2; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s.position", lightNames[i]);
+    lights[i]->position = findUniform<glm::vec3>(program, name);
+    snprintf(name, sizeof(name), "%s.ambient", lightNames[i]);
+    lights[i]->ambient = findUniform<glm::vec3>(program, name);
+    snprintf(name, sizeof(name), "%s.diffuse", lightNames[i]);
+    lights[i]->diffuse = findUniform<glm::vec3>(program, name);
+    snprintf(name, sizeof(name), "%s.specular", lightNames[i]);
+    lights[i]->specular = findUniform<glm::vec3>(program, name);
+  }
+
+  u.materialAmbient = findUniform<glm::vec3>(program, "material.ambient");
+  u.materialDiffuse = findUniform<int>(program, "material.diffuse");
+  u.materialSpecular = findUniform<int>(program, "material.specular");
+  u.materialShininess = findUniform<float>(program, "material.shininess");
+  u.shadowMatrices = findUniform<glm::mat4>(program, "shadow_matrices");
+  u.shadowRanges = findUniform<float>(program, "shadow_ranges");
+  return u;
+}
+
+// Per-frame uniforms of a forward shading program (current program)
+void setShadingUniforms(const SceneUniforms &uniforms, const FramePacket &frame) {
+  setUniform(uniforms.view, frame.view);
+  setUniform(uniforms.projection, frame.proj);
+  setUniform(uniforms.viewPos, frame.cameraPos);
+  if (instancedViews) {
+    int views = (int) frame.views.size();
+    setUniform(uniforms.views, frame.views.data(), views);
+    setUniform(uniforms.projections, frame.projs.data(), views);
+    setUniform(uniforms.viewPositions, frame.viewPositions.data(), views);
+  }
+
+  setUniform(uniforms.light.position, light_pos);
+  setUniform(uniforms.light.ambient, light_ambient);
+  setUniform(uniforms.light.diffuse, light_diffuse);
+  setUniform(uniforms.light.specular, light_specular);
+
+  setUniform(uniforms.light2.position, light2_pos);
+  setUniform(uniforms.light2.ambient, light2_ambient);
+  setUniform(uniforms.light2.diffuse, light2_diffuse);
+  setUniform(uniforms.light2.specular, light2_specular);
+
+  // Material: diffuse/specular maps on texture units 0 and 1
+  setUniform(uniforms.materialAmbient, material_ambient);
+  setUniform(uniforms.materialDiffuse, (int) material_diffuse);
+  setUniform(uniforms.materialSpecular, (int) material_specular);
+  setUniform(uniforms.materialShininess, material_shininess);
+
+  if (shadowsEnabled)
+    uploadShadowMatrices(uniforms);
+}
+
+// One variant per material in the scene. Black specular maps count as no
+// map (their specular term is zero), and the light count is a constant
+void requestMaterialPermutations() {
+  initShaderPermutations(&shaderPermutations, vertexFileName, fragmentFileName, shader_program);
+  objectVariants.resize(objects.size());
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    const SceneObject &object = objects[i];
+    if (virtualTextureImage && object.diffuseMap == virtualTexture.pageTable) {
+      objectVariants[i] = -1;   // drawn with vt_program
+      continue;
+    }
+    bool hasSpecularMap = object.specularMap && !isBlackTexture(object.specularMap);
+    unsigned int key = permutationKey(light_count, hasSpecularMap, object.diffuseMap != 0);
+
+    // The generic program samples both maps, so it can only stand in for
+    // objects that have them bound
+    objectVariants[i] = requestPermutation(&shaderPermutations, key,
+                                           object.diffuseMap && object.specularMap);
+  }
+
+  shadingVariants.resize(shaderPermutations.variants.size(), ShadingVariant());
+  printf("Shader permutations: %d variants for %d objects\n",
+         (int) shaderPermutations.variants.size(), (int) objects.size());
+  updateShadingVariants();
+}
+
+// Sets up the variants linked since the last call: uniform handles and the
+// uniforms that never change (light_count is a constant in them)
+void updateShadingVariants() {
+  updateShaderPermutations(&shaderPermutations);
+
+  for (size_t v = 0; v < shaderPermutations.variants.size(); v++) {
+    GLuint program = shaderPermutations.variants[v].program;
+    if (!program || shadingVariants[v].program == program)
+      continue;
+
+    shadingVariants[v].program = program;
+    shadingVariants[v].uniforms = findSceneUniforms(program);
+    glsUseProgram(program);
+    setUniform(findUniform<int>(program, "light_data"), 2);
+    setShadowUniforms(program, 3);
+  }
+}
+
+bool isBlackTexture(unsigned int texture) {
+  for (size_t i = 0; i < blackTextures.size(); i++)
+    if (blackTextures[i] == texture)
+      return true;
+  return false;
+}
+
+// Points the objects whose material is in the atlas at its pages, through a
+// copy of their mesh per material whose UVs land in the material's rectangle
+// (positions and normals are shared with the original). A page's specular
+// texture counts as black when all its specular maps are
+void applyTextureAtlas(const MeshSource *sources) {
+  std::vector<int> meshVariants;   // (mesh, entry) pairs, then the new mesh
+  size_t baseMeshes = meshes.size();
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    SceneObject &object = objects[i];
+    const AtlasEntry *entry = findAtlasEntry(&textureAtlas, object.diffuseMap, object.specularMap);
+    if (!entry || object.mesh >= (int) baseMeshes)
+      continue;
+
+    int entryIndex = (int) (entry - textureAtlas.entries.data());
+    size_t v = 0;
+    while (v < meshVariants.size() &&
+           (meshVariants[v] != object.mesh || meshVariants[v + 1] != entryIndex))
+      v += 3;
+
+    if (v == meshVariants.size()) {
+      const Mesh &mesh = meshes[object.mesh];
+      const MeshSource &source = sources[object.mesh];
+      std::vector<GLfloat> texCoords(mesh.vertexCount * 2);
+      remapAtlasUVs(*entry, source.texCoords, mesh.vertexCount, texCoords.data());
+
+      GLuint vao = 0, texCoordsBuffer = 0;
+      glGenVertexArrays(1, &vao);
+      glsBindVertexArray(vao);
+      glsBindBuffer(GL_ARRAY_BUFFER, source.positions);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+      glEnableVertexAttribArray(0);
+      glsBindBuffer(GL_ARRAY_BUFFER, source.normals);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+      glEnableVertexAttribArray(1);
+      glGenBuffers(1, &texCoordsBuffer);
+      glsBindBuffer(GL_ARRAY_BUFFER, texCoordsBuffer);
+      glBufferData(GL_ARRAY_BUFFER, texCoords.size() * sizeof(GLfloat), texCoords.data(),
+                   GL_STATIC_DRAW);
+      residencyTrackBuffer(&residency, texCoordsBuffer, RESIDENCY_GEOMETRY);
+      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+      glEnableVertexAttribArray(2);
+      glsBindBuffer(GL_ARRAY_BUFFER, 0);
+      glsBindVertexArray(0);
+
+      meshVariants.push_back(object.mesh);
+      meshVariants.push_back(entryIndex);
+      meshVariants.push_back((int) meshes.size());
+      meshes.push_back({ vao, mesh.vertexCount, mesh.radius });
+    }
+
+    object.mesh = meshVariants[v + 2];
+    object.diffuseMap = textureAtlas.pages[entry->page].diffuse;
+    object.specularMap = textureAtlas.pages[entry->page].specular;
+  }
+
+  for (size_t p = 0; p < textureAtlas.pages.size(); p++) {
+    bool black = true;
+    for (size_t i = 0; i < textureAtlas.entries.size(); i++)
+      if (textureAtlas.entries[i].page == (int) p && !isBlackTexture(textureAtlas.entries[i].specularMap))
+        black = false;
+    if (black)
+      blackTextures.push_back(textureAtlas.pages[p].specular);
+  }
+}
+
+// Registers the G-buffer targets with the residency manager, or forgets
+// them before they are re-created at another size
+void trackGBuffer(bool tracked) {
+  for (int i = 0; i < GBUFFER_TARGETS; i++) {
+    if (tracked)
+      residencyTrackTexture(&residency, GL_TEXTURE_2D, gbuffer.textures[i], RESIDENCY_RENDER_TARGET);
+    else
+      residencyForget(&residency, GL_TEXTURE, gbuffer.textures[i]);
+  }
+  if (tracked)
+    residencyTrackRenderbuffer(&residency, gbuffer.depth, RESIDENCY_RENDER_TARGET);
+  else
+    residencyForget(&residency, GL_RENDERBUFFER, gbuffer.depth);
+}
+
+// Constant shadow uniforms of a shading program (current program)
+void setShadowUniforms(GLuint program, int atlasUnit) {
+  setUniform(findUniform<int>(program, "shadow_light_count"),
+             shadowsEnabled ? shadowAtlas.maxLights : 0);
+  setUniform(findUniform<int>(program, "shadow_atlas"), atlasUnit);
+  setUniform(findUniform<float>(program, "shadow_tile_size"), (float) SHADOW_TILE_SIZE);
+}
+
+// Cube face matrices and range of every shadowed light (current program)
+void uploadShadowMatrices(const SceneUniforms &uniforms) {
+  setUniform(uniforms.shadowMatrices, shadowAtlas.matrices, shadowAtlas.maxLights * SHADOW_FACES);
+  setUniform(uniforms.shadowRanges, shadowAtlas.ranges, shadowAtlas.maxLights);
+}
+
+// Jobs run and stolen since the last call, over every thread
+void traceJobCounters() {
+  static std::vector<JobStats> stats;
+  jobSystem->getStats(stats);
+  jobSystem->resetStats();
+
+  unsigned long long executed = 0, stolen = 0;
+  for (const JobStats &thread : stats) {
+    executed += thread.executed;
+    stolen += thread.stolen;
+  }
+  TRACE_COUNTER("jobs", (double) executed);
+  TRACE_COUNTER("jobs stolen", (double) stolen);
+}
+
+// Accumulate the fragment counts of the previous frame and print them once
+// per second, so prepass ON/OFF can be compared on the same scene
+void updateOverdrawStats(const FramePacket &frame) {
+  TRACE_SCOPE("stats");
+  double currentTime = frame.time;
+  int previous = query_frame ^ 1;
+  GLint available = 0;
+
+  if (queries_issued[previous])
+    glGetQueryObjectiv(shading_queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (available) {
+    GLuint64 samples = 0;
+    glGetQueryObjectui64v(shading_queries[previous], GL_QUERY_RESULT, &samples);
+    shading_samples += samples;
+
+    if (queries_issued[previous] & PREPASS_QUERY_ISSUED) {
+      glGetQueryObjectui64v(prepass_queries[previous], GL_QUERY_RESULT, &samples);
+      prepass_samples += samples;
+    }
+    stats_frames++;
+  }
+  queries_issued[previous] = 0;
+  query_frame = previous;
+
+  if (currentTime - stats_start_time >= 1.0 && stats_frames > 0) {
+    printf("Depth prepass %s: %llu shaded fragments/frame, %llu depth-only fragments/frame\n",
+           depthPrepass ? "ON" : "OFF",
+           (unsigned long long) (shading_samples / stats_frames),
+           (unsigned long long) (prepass_samples / stats_frames));
+    if (shadowsEnabled) {
+      printf("Shadow atlas: %u static / %u dynamic light redraws, %u cached lights in %u frames\n",
+             shadowAtlas.staticLightRenders, shadowAtlas.dynamicLightRenders,
+             shadowAtlas.cachedLightHits, stats_frames);
+      shadowAtlas.staticLightRenders = shadowAtlas.dynamicLightRenders = 0;
+      shadowAtlas.cachedLightHits = 0;
+    }
+
+    const GlStateStats &gls = glsStats();
+    printf("GL state cache: binds %llu skipped / %llu issued, state %llu / %llu, "
+           "uniforms %llu / %llu per frame\n",
+           gls.bindHits / stats_frames, gls.bindMisses / stats_frames,
+           gls.stateHits / stats_frames, gls.stateMisses / stats_frames,
+           gls.uniformHits / stats_frames, gls.uniformMisses / stats_frames);
+    glsResetStats();
+
+    if (multiDrawEnabled) {
+      if (gpuCulling)
+        printf("Multi-draw: %llu indirect calls per frame, commands culled on the GPU\n",
+               multiDraw.indirectCalls / stats_frames);
+      else
+        printf("Multi-draw: %llu indirect calls, %llu commands per frame\n",
+               multiDraw.indirectCalls / stats_frames, multiDraw.commandsSubmitted / stats_frames);
+      multiDraw.indirectCalls = multiDraw.commandsSubmitted = 0;
+
+      printf("Frame ring (%s): %llu KB per frame, %u fence waits, %u overflows\n",
+             frameRing.persistent ? "persistent" : "glBufferSubData",
+             frameRing.bytesAllocated / stats_frames / 1024, frameRing.fenceWaits, frameRing.overflows);
+      frameRing.bytesAllocated = 0;
+      frameRing.fenceWaits = frameRing.overflows = 0;
+    } else {
+      RenderQueueStats &rq = renderQueue.stats;
+      printf("Render queue: %llu draws, %llu program / %llu VAO / %llu texture changes per frame\n",
+             rq.draws / stats_frames, rq.programChanges / stats_frames,
+             rq.vaoChanges / stats_frames, rq.textureChanges / stats_frames);
+      rq = RenderQueueStats();
+    }
+
+    if (lodEnabled) {
+      printf("LOD: %llu of %llu triangles per frame (%.0f%%)\n",
+             stats_lod_triangles / stats_frames, stats_full_triangles / stats_frames,
+             stats_full_triangles ? 100.0 * stats_lod_triangles / stats_full_triangles : 100.0);
+      stats_lod_triangles = stats_full_triangles = 0;
+    }
+
+    printf("Cameras: %.2f view / %.2f projection / %.2f frustum rebuilds per frame (%llu updates)\n",
+           (double) cameraStats.views.exchange(0) / stats_frames,
+           (double) cameraStats.projections.exchange(0) / stats_frames,
+           (double) cameraStats.frustums.exchange(0) / stats_frames,
+           cameraStats.updates.exchange(0) / stats_frames);
+
+    if (meshletsEnabled) {
+      MeshletStats &ms = meshletStats;
+      printf("Meshlets: %llu of %llu drawn per frame (%llu off-screen, %llu backfacing) in %llu ranges\n",
+             (ms.tested - ms.frustumCulled - ms.backfaceCulled) / stats_frames, ms.tested / stats_frames,
+             ms.frustumCulled / stats_frames, ms.backfaceCulled / stats_frames, ms.ranges / stats_frames);
+      ms = MeshletStats();
+    }
+
+    if (shaderPermutations.generic) {
+      printf("Shader permutations: %d variants (%d compiling), %llu variant / %llu generic draws per frame\n",
+             (int) shaderPermutations.variants.size(), pendingPermutations(&shaderPermutations),
+             stats_variant_draws / stats_frames, stats_generic_draws / stats_frames);
+      stats_variant_draws = stats_generic_draws = 0;
+    }
+
+    if (virtualTextureImage) {
+      VtStats &vts = virtualTexture.stats;
+      printf("Virtual texture: %d / %d pages resident, %llu tiles requested, %llu uploaded, "
+             "%llu evicted, %llu dropped, %llu feedback reads in %u frames\n",
+             (int) virtualTexture.resident.size(), (int) virtualTexture.slots.size(),
+             vts.tilesRequested, vts.tilesUploaded, vts.tilesEvicted, vts.tilesDropped,
+             vts.feedbackReads, stats_frames);
+      vts = VtStats();
+    }
+
+    reportResidency(&residency);
+    residency.stats = ResidencyStats();
+
+    printf("Clock: t = %.3f s (%.2f ms steps), speed x%g%s, %llu dropped steps",
+           frame.simTime, simClock.step * 1000.0, simClock.speed.load(),
+           simClock.deterministic ? " (deterministic)" : simClock.paused ? " (paused)" : "",
+           simClock.droppedSteps.load());
+    if (framePacer.interval > 0.0)
+      printf(", paced at %.0f fps with %llu late frames", 1.0 / framePacer.interval, framePacer.lateFrames);
+    printf("\n");
+    framePacer.lateFrames = 0;
+
+    unsigned long long heapNow = heapAllocations();
+    printf("Frame arena: %zu KB high water, %llu heap allocations per frame\n",
+           renderArena.highWater / 1024, (heapNow - stats_heap_allocations) / stats_frames);
+    stats_heap_allocations = heapNow;
+
+    shading_samples = prepass_samples = 0;
+    stats_frames = 0;
+    stats_start_time = currentTime;
+  }
 }
 
 // Callback function to track window size and update viewport
@@ -666,23 +2237,60 @@ void obtenerNormales(GLfloat * normales, const GLfloat vertices[]){
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
 unsigned int loadTexture(char const * path){
+    Image image;
+    decodeImage(path, &image);
+    return uploadTexture(&image);
+}
+
+// CPU half of loadTexture: thread-safe, no GL calls
+// ---------------------------------------------------
+bool decodeImage(char const * path, Image *image){
+    TRACE_SCOPE("decodeImage");
+    image->path = path;
+    image->data = stbi_load(path, &image->width, &image->height, &image->components, 0);
+    if (!image->data)
+    {
+        fprintf(stderr, "Texture failed to load at path: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// true when no texel has any colour (alpha aside), so sampling it always
+// gives black
+// ---------------------------------------------------
+static bool imageIsBlack(const Image *image){
+    int colourChannels = image->components == 4 ? 3 : image->components == 2 ? 1 : image->components;
+    size_t texels = (size_t) image->width * image->height;
+    for (size_t t = 0; t < texels; t++)
+        for (int c = 0; c < colourChannels; c++)
+            if (image->data[t * image->components + c])
+                return false;
+    return true;
+}
+
+// GL half of loadTexture: uploads and frees the decoded image
+// ---------------------------------------------------
+unsigned int uploadTexture(Image *image){
+    TRACE_SCOPE("uploadTexture");
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+
+    if (image->data)
     {
-        GLenum format;
-        if (nrComponents == 1)
+        GLenum format = GL_RGB;
+        if (image->components == 1)
             format = GL_RED;
-        else if (nrComponents == 3)
+        else if (image->components == 3)
             format = GL_RGB;
-        else if (nrComponents == 4)
+        else if (image->components == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        if (imageIsBlack(image))
+            blackTextures.push_back(textureID);
+
+        glsBindTexture(0, GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image->width, image->height, 0, format, GL_UNSIGNED_BYTE, image->data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -690,13 +2298,10 @@ unsigned int loadTexture(char const * path){
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        stbi_image_free(data);
-    }
-    else
-    {
-        fprintf(stderr, "Texture failed to load at path: " );
-        stbi_image_free(data);
+        stbi_image_free(image->data);
+        image->data = NULL;
     }
 
+    residencyTrackTexture(&residency, GL_TEXTURE_2D, textureID, RESIDENCY_MATERIAL, image->path);
     return textureID;
 }
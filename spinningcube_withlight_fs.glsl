@@ -1,8 +1,18 @@
 #version 130
 
+// Permutation defines (shader_program.h). Without them this is the generic
+// shader: both maps sampled, light count from the light_count uniform
+#ifndef HAS_TEXTURE
+#define HAS_TEXTURE 1
+#endif
+#ifndef HAS_SPECULAR_MAP
+#define HAS_SPECULAR_MAP 1
+#endif
+
 struct Material {
   sampler2D diffuse;
   sampler2D specular;
+  vec3 ambient;        // colour of untextured materials
   float shininess;
 };
 
@@ -20,42 +30,166 @@ in vec3 vs_normal;
 in vec2 vs_tex_coord;
 
 uniform Material material;
+
+#ifdef MATERIAL_ARRAY
+// Multi-draw: every map in one texture array, the layers and shininess of
+// the draw's material come from the vertex shader (material.h)
+uniform sampler2DArray material_maps;
+flat in ivec2 vs_material_layers;
+flat in float vs_shininess;
+#define SHININESS vs_shininess
+
+vec3 sampleMap(int layer) {
+  return layer < 0 ? vec3(0.0) : vec3(texture(material_maps, vec3(vs_tex_coord, float(layer))));
+}
+#define DIFFUSE_MAP sampleMap(vs_material_layers.x)
+#define SPECULAR_MAP sampleMap(vs_material_layers.y)
+#elif defined(VIRTUAL_TEXTURE)
+// Virtual texture (virtual_texture.h): the diffuse map is found through the
+// page table (bound as the diffuse map) in the tile cache
+uniform usampler2D vt_page_table;
+uniform sampler2D vt_cache;
+uniform vec4 vt_layout;        // virtual width, height, tile size, border
+uniform vec4 vt_cache_layout;  // cache width, height, coarsest level, feedback bias
+
+vec3 sampleVirtual(vec2 uv) {
+  // Same level as vt_feedback_fs.glsl asks for
+  vec2 texel = uv * vt_layout.xy;
+  vec2 dx = dFdx(texel), dy = dFdy(texel);
+  float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+  int level = int(clamp(floor(lod), 0.0, vt_cache_layout.z));
+
+  vec2 wrapped = fract(uv);
+  vec2 level_size = max(floor(vt_layout.xy / exp2(float(level))), vec2(1.0));
+  uvec4 entry = texelFetch(vt_page_table, ivec2(wrapped * level_size / vt_layout.z), level);
+
+  // The entry may be an ancestor: position within the tile at its level
+  vec2 resident_size = max(floor(vt_layout.xy / exp2(float(entry.z))), vec2(1.0));
+  vec2 in_tile = mod(wrapped * resident_size, vt_layout.z);
+  vec2 cache_texel = vec2(entry.xy) * (vt_layout.z + 2.0 * vt_layout.w) + vt_layout.w + in_tile;
+  return vec3(textureLod(vt_cache, cache_texel / vt_cache_layout.xy, 0.0));
+}
+#define SHININESS material.shininess
+#define DIFFUSE_MAP sampleVirtual(vs_tex_coord)
+#define SPECULAR_MAP vec3(texture(material.specular, vs_tex_coord))
+#else
+#define SHININESS material.shininess
+#define DIFFUSE_MAP vec3(texture(material.diffuse, vs_tex_coord))
+#define SPECULAR_MAP vec3(texture(material.specular, vs_tex_coord))
+#endif
 uniform Light light;
 uniform Light light2;
+#ifdef MULTI_VIEW
+// Camera of this fragment's viewport (multiview_vs.glsl)
+uniform vec3 view_positions[MULTI_VIEW];
+flat in int vs_view;
+#define VIEW_POS view_positions[vs_view]
+#else
 uniform vec3 view_pos;
+#define VIEW_POS view_pos
+#endif
 
-void main() {
+// All lights, one row per light (position, ambient, diffuse, specular).
+// Rows 0 and 1 hold light and light2, rows 2.. the extra lights
+uniform sampler2D light_data;
+#ifdef LIGHT_COUNT
+const int light_count = LIGHT_COUNT;
+#define FIXED_LIGHTS LIGHT_COUNT
+#else
+uniform int light_count;
+#define FIXED_LIGHTS 2
+#endif
 
-  // Ambiente -> light1
-  vec3 ambient = light.ambient * vec3(texture(material.diffuse, vs_tex_coord));
-  
-  // Ambiente -> light2
-  vec3 ambient2 = light2.ambient * vec3(texture(material.diffuse, vs_tex_coord));
+Light fetchLight(int i) {
+  Light l;
+  l.position = texelFetch(light_data, ivec2(0, i), 0).rgb;
+  l.ambient = texelFetch(light_data, ivec2(1, i), 0).rgb;
+  l.diffuse = texelFetch(light_data, ivec2(2, i), 0).rgb;
+  l.specular = texelFetch(light_data, ivec2(3, i), 0).rgb;
+  return l;
+}
 
-  // Difusión -> light1
-  vec3 light_dir = normalize(light.position - frag_3Dpos);
-  float diff = max(dot(vs_normal, light_dir), 0.0);
-  vec3 diffuse = light.diffuse * diff *
-                 vec3(texture(material.diffuse, vs_tex_coord));
+// Omnidirectional shadows (shadow_atlas.h): a row of six cube face tiles per
+// shadowed light, storing distance to the light / that light's range
+#define SHADOW_MAX_LIGHTS 4
+uniform int shadow_light_count;
+uniform sampler2D shadow_atlas;
+uniform mat4 shadow_matrices[SHADOW_MAX_LIGHTS * 6];
+uniform float shadow_ranges[SHADOW_MAX_LIGHTS];
+uniform float shadow_tile_size;
+
+float shadowFactor(int i, vec3 pos, vec3 light_pos) {
+  if (i >= shadow_light_count)
+    return 1.0;
 
-  // Difusión -> light2
-  vec3 light2_dir = normalize(light2.position - frag_3Dpos);
-  float diff2 = max(dot(vs_normal, light2_dir), 0.0);
-  vec3 diffuse2 = light2.diffuse * diff2 *
-                  vec3(texture(material.diffuse, vs_tex_coord));
+  // Cube face from the major axis, same order as the atlas tiles
+  vec3 d = pos - light_pos;
+  vec3 a = abs(d);
+  int face;
+  if (a.x >= a.y && a.x >= a.z)
+    face = d.x > 0.0 ? 0 : 1;
+  else if (a.y >= a.z)
+    face = d.y > 0.0 ? 2 : 3;
+  else
+    face = d.z > 0.0 ? 4 : 5;
 
-  vec3 view_dir = normalize(view_pos - frag_3Dpos);
+  vec4 clip = shadow_matrices[i * 6 + face] * vec4(pos, 1.0);
+  float border = 0.5 / shadow_tile_size;
+  vec2 uv = clamp(clip.xy / clip.w * 0.5 + 0.5, border, 1.0 - border);
+  vec2 atlas_uv = (vec2(face, i) + uv) / vec2(6.0, shadow_light_count);
 
-  // Especular -> light1
+  float closest = texture(shadow_atlas, atlas_uv).r;
+  float current = length(d) / shadow_ranges[i];
+  return current - 0.01 > closest ? 0.0 : 1.0;
+}
+
+// Phong terms of one light, diffuse and specular scaled by its shadow
+vec3 shade(Light l, vec3 albedo, vec3 specular_map, vec3 view_dir, float shadow) {
+  // Ambiente
+  vec3 result = l.ambient * albedo;
+
+  // Difusión
+  vec3 light_dir = normalize(l.position - frag_3Dpos);
+  float diff = max(dot(vs_normal, light_dir), 0.0);
+  result += shadow * l.diffuse * diff * albedo;
+
+#if HAS_SPECULAR_MAP
+  // Especular
   vec3 reflect_dir = reflect(-light_dir, vs_normal);
-  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), material.shininess);
-  vec3 specular = light.specular * (spec * vec3(texture(material.specular, vs_tex_coord)));
+  float spec = pow(max(dot(view_dir, reflect_dir), 0.0), SHININESS);
+  result += shadow * l.specular * (spec * specular_map);
+#endif
+
+  return result;
+}
+
+void main() {
+#if HAS_TEXTURE
+  vec3 albedo = DIFFUSE_MAP;
+#else
+  vec3 albedo = material.ambient;
+#endif
+
+#if HAS_SPECULAR_MAP
+  vec3 specular_map = SPECULAR_MAP;
+#else
+  vec3 specular_map = vec3(0.0);
+#endif
+
+  vec3 view_dir = normalize(VIEW_POS - frag_3Dpos);
+  vec3 result = vec3(0.0);
+
+  // light, light2 (with shadows)
+#if FIXED_LIGHTS > 0
+  result += shade(light, albedo, specular_map, view_dir, shadowFactor(0, frag_3Dpos, light.position));
+#endif
+#if FIXED_LIGHTS > 1
+  result += shade(light2, albedo, specular_map, view_dir, shadowFactor(1, frag_3Dpos, light2.position));
+#endif
 
-  // Especular -> light2
-  vec3 reflect2_dir = reflect(-light2_dir, vs_normal);
-  float spec2 = pow(max(dot(view_dir, reflect2_dir), 0.0), material.shininess);
-  vec3 specular2 = light2.specular * (spec2 * vec3(texture(material.specular, vs_tex_coord)));
+  // Extra lights (--lights N), same Phong terms
+  for (int i = 2; i < light_count; i++)
+    result += shade(fetchLight(i), albedo, specular_map, view_dir, 1.0);
 
-  vec3 result = ambient + ambient2 + diffuse + diffuse2 + specular + specular2;
   frag_col = vec4(result, 1.0);
 }
@@ -8,6 +8,9 @@ out vec3 frag_3Dpos;
 out vec3 vs_normal;
 out vec2 vs_tex_coord;
 
+// Same depth as depth_prepass_vs.glsl
+invariant gl_Position;
+
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
@@ -0,0 +1,46 @@
+// startup_profile.cpp: measured startup phases and time to first frame
+
+#include "startup_profile.h"
+
+#include <stdio.h>
+
+#include "trace.h"
+
+static void closePhase(StartupProfile *profile, uint64_t now) {
+  if (profile->phases.empty())
+    return;
+
+  StartupPhase &phase = profile->phases.back();
+  phase.end = now;
+  if (traceEnabled)
+    traceComplete(phase.name, phase.start, phase.end);
+}
+
+void startupPhase(StartupProfile *profile, const char *name) {
+  uint64_t now = traceNow();
+  closePhase(profile, now);
+  profile->phases.push_back({ name, now, now });
+}
+
+void endStartupProfile(StartupProfile *profile) {
+  if (profile->done)
+    return;
+  profile->done = true;
+
+  uint64_t now = traceNow();
+  closePhase(profile, now);
+  profile->timeToFirstFrame = now / 1.0e9;
+
+  printf("Startup phases (ms):\n");
+  uint64_t previousEnd = 0;
+  for (size_t i = 0; i < profile->phases.size(); i++) {
+    const StartupPhase &phase = profile->phases[i];
+    // Gap before the first phase: static initialisation, option parsing
+    if (phase.start > previousEnd + 100000)
+      printf("  %-28s %8.2f\n", "(unmeasured)", (phase.start - previousEnd) / 1.0e6);
+    printf("  %-28s %8.2f  %5.1f%%\n", phase.name, (phase.end - phase.start) / 1.0e6,
+           100.0 * (phase.end - phase.start) / (double) now);
+    previousEnd = phase.end;
+  }
+  printf("Time to first frame: %.2f ms\n", profile->timeToFirstFrame * 1000.0);
+}
@@ -0,0 +1,33 @@
+// startup_profile.h: measured startup phases and time to first frame
+//
+// main() marks where each startup phase begins; the previous one ends
+// there. After the first swap the phases are printed with their share of
+// the time to first frame, measured from process start (the trace clock
+// origin). With --trace every phase is also a trace event.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef STARTUP_PROFILE_H
+#define STARTUP_PROFILE_H
+
+#include <stdint.h>
+
+#include <vector>
+
+struct StartupPhase {
+  const char *name;
+  uint64_t start, end;   // traceNow() nanoseconds
+};
+
+struct StartupProfile {
+  std::vector<StartupPhase> phases;
+  bool done = false;
+  double timeToFirstFrame = 0.0;   // seconds
+};
+
+// Ends the current phase (if any) and starts the named one
+void startupPhase(StartupProfile *profile, const char *name);
+// Call after the first swap: ends the last phase and prints the report.
+// Later calls do nothing
+void endStartupProfile(StartupProfile *profile);
+
+#endif
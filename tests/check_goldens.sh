@@ -0,0 +1,60 @@
+#!/bin/sh
+# check_goldens.sh: renders every golden frame of tests/golden/goldens.txt
+# and compares it against the stored image
+#
+#   check_goldens.sh APP IMGDIFF [OUTDIR]
+#
+# Captures, and heatmaps of the ones that differ, go to OUTDIR (default
+# golden_out). TOLERANCE overrides imgdiff's per-channel tolerance (8).
+# Exit status: 0 every frame matches, 1 otherwise.
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 APP IMGDIFF [OUTDIR]" >&2
+  exit 2
+fi
+
+# Absolute paths: the app runs from the source tree (shaders, textures)
+absolute() {
+  case "$1" in
+    /*) echo "$1" ;;
+    *) echo "$(pwd)/$1" ;;
+  esac
+}
+app=$(absolute "$1")
+imgdiff=$(absolute "$2")
+out=$(absolute "${3:-golden_out}")
+tolerance=${TOLERANCE:-8}
+
+cd "$(dirname "$0")/.." || exit 2
+mkdir -p "$out" || exit 2
+
+failed=0
+total=0
+while read -r name time options; do
+  case "$name" in
+    ''|'#'*) continue ;;
+  esac
+  total=$((total + 1))
+  capture="$out/$name.ppm"
+  heatmap="$out/${name}_diff.ppm"
+  rm -f "$capture" "$heatmap"
+
+  # shellcheck disable=SC2086 # options are split on purpose
+  if ! "$app" $options --capture "$capture" --capture-time "$time" > "$out/$name.log" 2>&1; then
+    echo "FAIL $name: capture failed (see $out/$name.log)"
+    failed=$((failed + 1))
+    continue
+  fi
+
+  if "$imgdiff" "tests/golden/$name.png" "$capture" --tolerance "$tolerance" \
+       --heatmap "$heatmap" > "$out/${name}_diff.log" 2>&1; then
+    echo "ok   $name"
+    rm -f "$heatmap"
+  else
+    echo "FAIL $name: $(head -n 1 "$out/${name}_diff.log"), heatmap $heatmap"
+    failed=$((failed + 1))
+  fi
+done < tests/golden/goldens.txt
+
+echo "$((total - failed)) of $total golden frames match"
+[ "$failed" -eq 0 ]
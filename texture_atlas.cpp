@@ -0,0 +1,301 @@
+// texture_atlas.cpp: packs the scene's maps into a few atlas textures
+
+#include "texture_atlas.h"
+#include "gl_state.h"
+
+#include <limits.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+void initSkylinePacker(SkylinePacker *packer, int width, int height) {
+  packer->width = width;
+  packer->height = height;
+  packer->skyline.assign(1, SkylineNode{ 0, 0, width });
+  packer->usedWidth = packer->usedHeight = 0;
+}
+
+// Height a rectangle starting at node index rests at, -1 if it doesn't fit
+static int skylineFit(const SkylinePacker *packer, size_t index, int width, int height) {
+  int x = packer->skyline[index].x;
+  if (x + width > packer->width)
+    return -1;
+
+  int y = 0;
+  for (int remaining = width; remaining > 0; index++) {
+    const SkylineNode &node = packer->skyline[index];
+    if (node.y > y)
+      y = node.y;
+    if (y + height > packer->height)
+      return -1;
+    remaining -= node.width;
+  }
+  return y;
+}
+
+bool packSkyline(SkylinePacker *packer, int width, int height, int *x, int *y) {
+  int bestY = INT_MAX;
+  size_t best = 0;
+  for (size_t i = 0; i < packer->skyline.size(); i++) {
+    int fit = skylineFit(packer, i, width, height);
+    if (fit >= 0 && fit < bestY) {
+      bestY = fit;
+      best = i;
+    }
+  }
+  if (bestY == INT_MAX)
+    return false;
+
+  std::vector<SkylineNode> &skyline = packer->skyline;
+  SkylineNode node = { skyline[best].x, bestY + height, width };
+  skyline.insert(skyline.begin() + best, node);
+
+  // Nodes under the new one shrink or go
+  for (size_t i = best + 1; i < skyline.size(); ) {
+    int end = skyline[i - 1].x + skyline[i - 1].width;
+    if (skyline[i].x >= end)
+      break;
+    int overlap = end - skyline[i].x;
+    skyline[i].x += overlap;
+    skyline[i].width -= overlap;
+    if (skyline[i].width > 0)
+      break;
+    skyline.erase(skyline.begin() + i);
+  }
+
+  // Neighbours at the same height become one node
+  for (size_t i = 0; i + 1 < skyline.size(); ) {
+    if (skyline[i].y == skyline[i + 1].y) {
+      skyline[i].width += skyline[i + 1].width;
+      skyline.erase(skyline.begin() + i + 1);
+    } else {
+      i++;
+    }
+  }
+
+  *x = node.x;
+  *y = bestY;
+  packer->usedWidth = std::max(packer->usedWidth, node.x + width);
+  packer->usedHeight = std::max(packer->usedHeight, bestY + height);
+  return true;
+}
+
+// Map plus padding on both sides, rounded up to whole level-ATLAS_MIP_LEVELS texels
+static int cellSize(int size) {
+  return (size + 2 * ATLAS_PADDING + ATLAS_PADDING - 1) / ATLAS_PADDING * ATLAS_PADDING;
+}
+
+static void textureSize(unsigned int texture, int *width, int *height) {
+  glsBindTexture(0, GL_TEXTURE_2D, texture);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, width);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, height);
+}
+
+static GLuint createPageTexture(int width, int height) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glsBindTexture(0, GL_TEXTURE_2D, texture);
+  for (int level = 0; level <= ATLAS_MIP_LEVELS; level++) {
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, std::max(width >> level, 1),
+                 std::max(height >> level, 1), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, ATLAS_MIP_LEVELS);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return texture;
+}
+
+// Tiles source over the whole cell around the entry (scissored), so the
+// padding repeats the map the way GL_REPEAT would
+static void blitIntoCell(unsigned int source, GLuint page, const AtlasEntry &entry) {
+  int sourceWidth, sourceHeight;
+  textureSize(source, &sourceWidth, &sourceHeight);
+
+  glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, page, 0);
+
+  int cellWidth = cellSize(entry.width), cellHeight = cellSize(entry.height);
+  glScissor(entry.x - ATLAS_PADDING, entry.y - ATLAS_PADDING, cellWidth, cellHeight);
+
+  GLenum filter = sourceWidth == entry.width && sourceHeight == entry.height ? GL_NEAREST : GL_LINEAR;
+  int repeatX = (cellWidth - ATLAS_PADDING + entry.width - 1) / entry.width;
+  int repeatY = (cellHeight - ATLAS_PADDING + entry.height - 1) / entry.height;
+  for (int ty = -1; ty <= repeatY; ty++) {
+    for (int tx = -1; tx <= repeatX; tx++) {
+      int x = entry.x + tx * entry.width, y = entry.y + ty * entry.height;
+      glBlitFramebuffer(0, 0, sourceWidth, sourceHeight, x, y, x + entry.width, y + entry.height,
+                        GL_COLOR_BUFFER_BIT, filter);
+    }
+  }
+}
+
+bool buildTextureAtlas(TextureAtlas *atlas, const std::vector<SceneObject> &objects,
+                       int maxPageSize) {
+  GLint maxTextureSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  int pageSize = std::min(maxPageSize, (int) maxTextureSize) / ATLAS_PADDING * ATLAS_PADDING;
+
+  // Materials in order of first appearance, sized by their diffuse map
+  atlas->entries.clear();
+  for (size_t i = 0; i < objects.size(); i++) {
+    const SceneObject &object = objects[i];
+    if (!object.diffuseMap || !object.specularMap ||
+        findAtlasEntry(atlas, object.diffuseMap, object.specularMap))
+      continue;
+
+    AtlasEntry entry = {};
+    entry.diffuseMap = object.diffuseMap;
+    entry.specularMap = object.specularMap;
+    entry.page = -1;
+    textureSize(entry.diffuseMap, &entry.width, &entry.height);
+    atlas->entries.push_back(entry);
+  }
+
+  // Tallest cells first, each in the first page with room
+  std::vector<size_t> order(atlas->entries.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return atlas->entries[a].height > atlas->entries[b].height;
+  });
+
+  std::vector<SkylinePacker> packers;
+  for (size_t k = 0; k < order.size(); k++) {
+    AtlasEntry &entry = atlas->entries[order[k]];
+    int cellWidth = cellSize(entry.width), cellHeight = cellSize(entry.height);
+    if (cellWidth > pageSize || cellHeight > pageSize)
+      continue;
+
+    int x = 0, y = 0;
+    size_t p = 0;
+    while (p < packers.size() && !packSkyline(&packers[p], cellWidth, cellHeight, &x, &y))
+      p++;
+    if (p == packers.size()) {
+      packers.push_back(SkylinePacker());
+      initSkylinePacker(&packers.back(), pageSize, pageSize);
+      packSkyline(&packers.back(), cellWidth, cellHeight, &x, &y);
+    }
+
+    entry.page = (int) p;
+    entry.x = x + ATLAS_PADDING;
+    entry.y = y + ATLAS_PADDING;
+  }
+
+  // Pages trimmed to what they hold (cells keep it a multiple of the alignment)
+  atlas->pages.resize(packers.size());
+  for (size_t p = 0; p < packers.size(); p++) {
+    AtlasPage &page = atlas->pages[p];
+    page.width = packers[p].usedWidth;
+    page.height = packers[p].usedHeight;
+    page.diffuse = createPageTexture(page.width, page.height);
+    page.specular = createPageTexture(page.width, page.height);
+  }
+
+  for (size_t i = 0; i < atlas->entries.size(); i++) {
+    AtlasEntry &entry = atlas->entries[i];
+    if (entry.page < 0)
+      continue;
+    const AtlasPage &page = atlas->pages[entry.page];
+    entry.uvTransform = glm::vec4((float) entry.width / (float) page.width,
+                                  (float) entry.height / (float) page.height,
+                                  (float) entry.x / (float) page.width,
+                                  (float) entry.y / (float) page.height);
+  }
+
+  GLuint framebuffers[2];
+  glGenFramebuffers(2, framebuffers);
+  glsBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+  glsBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+  glsEnable(GL_SCISSOR_TEST);
+  for (size_t i = 0; i < atlas->entries.size(); i++) {
+    const AtlasEntry &entry = atlas->entries[i];
+    if (entry.page < 0)
+      continue;
+    blitIntoCell(entry.diffuseMap, atlas->pages[entry.page].diffuse, entry);
+    blitIntoCell(entry.specularMap, atlas->pages[entry.page].specular, entry);
+  }
+  glsDisable(GL_SCISSOR_TEST);
+  glsBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glsDeleteFramebuffers(2, framebuffers);
+
+  for (size_t p = 0; p < atlas->pages.size(); p++) {
+    GLuint textures[2] = { atlas->pages[p].diffuse, atlas->pages[p].specular };
+    for (int t = 0; t < 2; t++) {
+      glsBindTexture(0, GL_TEXTURE_2D, textures[t]);
+      glGenerateMipmap(GL_TEXTURE_2D);
+    }
+  }
+  glsBindTexture(0, GL_TEXTURE_2D, 0);
+
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR) {
+    fprintf(stderr, "ERROR: could not build the texture atlas (0x%x)\n", error);
+    return false;
+  }
+  return true;
+}
+
+void destroyTextureAtlas(TextureAtlas *atlas) {
+  for (size_t p = 0; p < atlas->pages.size(); p++) {
+    GLuint textures[2] = { atlas->pages[p].diffuse, atlas->pages[p].specular };
+    glsDeleteTextures(2, textures);
+  }
+  atlas->pages.clear();
+  atlas->entries.clear();
+}
+
+const AtlasEntry *findAtlasEntry(const TextureAtlas *atlas, unsigned int diffuseMap,
+                                 unsigned int specularMap) {
+  for (size_t i = 0; i < atlas->entries.size(); i++) {
+    const AtlasEntry &entry = atlas->entries[i];
+    if (entry.diffuseMap == diffuseMap && entry.specularMap == specularMap)
+      return entry.page >= 0 ? &entry : NULL;
+  }
+  return NULL;
+}
+
+void remapAtlasUVs(const AtlasEntry &entry, const GLfloat *uvs, int count, GLfloat *out) {
+  for (int i = 0; i < count; i++) {
+    out[i * 2] = uvs[i * 2] * entry.uvTransform.x + entry.uvTransform.z;
+    out[i * 2 + 1] = uvs[i * 2 + 1] * entry.uvTransform.y + entry.uvTransform.w;
+  }
+}
+
+void reportTextureAtlas(const TextureAtlas *atlas) {
+  size_t leftOut = 0;
+  unsigned long long totalArea = 0, totalTexels = 0, totalPadding = 0;
+
+  for (size_t p = 0; p < atlas->pages.size(); p++) {
+    const AtlasPage &page = atlas->pages[p];
+    unsigned long long area = (unsigned long long) page.width * page.height;
+    unsigned long long texels = 0, padding = 0;
+    int maps = 0;
+    for (size_t i = 0; i < atlas->entries.size(); i++) {
+      const AtlasEntry &entry = atlas->entries[i];
+      if (entry.page != (int) p)
+        continue;
+      unsigned long long mapArea = (unsigned long long) entry.width * entry.height;
+      texels += mapArea;
+      padding += (unsigned long long) cellSize(entry.width) * cellSize(entry.height) - mapArea;
+      maps++;
+    }
+
+    printf("  page %zu: %dx%d, %d materials, %.1f%% texels, %.1f%% padding, %.1f%% unused\n",
+           p, page.width, page.height, maps, 100.0 * texels / area, 100.0 * padding / area,
+           100.0 * (area - texels - padding) / area);
+    totalArea += area;
+    totalTexels += texels;
+    totalPadding += padding;
+  }
+  for (size_t i = 0; i < atlas->entries.size(); i++)
+    if (atlas->entries[i].page < 0)
+      leftOut++;
+
+  printf("Texture atlas: %zu materials in %zu page pairs (%zu too big, left out), "
+         "packing efficiency %.1f%% (%.1f%% with padding)\n",
+         atlas->entries.size() - leftOut, atlas->pages.size(), leftOut,
+         totalArea ? 100.0 * totalTexels / totalArea : 0.0,
+         totalArea ? 100.0 * (totalTexels + totalPadding) / totalArea : 0.0);
+}
@@ -0,0 +1,80 @@
+// texture_atlas.h: packs the scene's maps into a few atlas textures
+//
+// Each material (diffuse + specular map pair) gets one rectangle in an
+// atlas page. Pages come in pairs with the same layout, one for the
+// diffuse maps and one for the specular maps; a specular map is scaled to
+// its diffuse map's size. One UV transform therefore addresses both, and a
+// mesh whose UVs are rewritten with it needs no texture change between
+// objects on the same page.
+//
+// Rectangles are placed with a skyline bottom-left packer, tallest first.
+// Around each rectangle is a padding band that repeats the map (the
+// originals use GL_REPEAT), and cells are aligned to 2^ATLAS_MIP_LEVELS
+// texels. Mip levels up to ATLAS_MIP_LEVELS therefore never blend
+// neighbouring maps; pages stop there. Maps too big for a page are left out.
+// Copies are GPU blits from the existing textures, so the decoded images
+// don't have to be kept.
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#include "scene.h"
+
+#define ATLAS_MIP_LEVELS 4
+#define ATLAS_PADDING (1 << ATLAS_MIP_LEVELS)
+
+// Skyline bottom-left rectangle packer
+struct SkylineNode {
+  int x, y, width;
+};
+
+struct SkylinePacker {
+  int width, height;
+  std::vector<SkylineNode> skyline;
+  int usedWidth, usedHeight;           // extent of the placed rectangles
+};
+
+void initSkylinePacker(SkylinePacker *packer, int width, int height);
+// Lowest (then leftmost) position where width x height fits; false if none
+bool packSkyline(SkylinePacker *packer, int width, int height, int *x, int *y);
+
+struct AtlasEntry {
+  unsigned int diffuseMap, specularMap;   // source textures
+  int page;
+  int x, y, width, height;                // texels, padding excluded
+  glm::vec4 uvTransform;                  // uv * xy + zw
+};
+
+struct AtlasPage {
+  GLuint diffuse, specular;
+  int width, height;
+};
+
+struct TextureAtlas {
+  std::vector<AtlasPage> pages;
+  std::vector<AtlasEntry> entries;
+};
+
+// Packs the materials of the objects that have both maps into pages of at
+// most maxPageSize texels a side (and GL_MAX_TEXTURE_SIZE)
+bool buildTextureAtlas(TextureAtlas *atlas, const std::vector<SceneObject> &objects,
+                       int maxPageSize);
+void destroyTextureAtlas(TextureAtlas *atlas);
+
+// Entry of a material, NULL if it isn't in the atlas
+const AtlasEntry *findAtlasEntry(const TextureAtlas *atlas, unsigned int diffuseMap,
+                                 unsigned int specularMap);
+
+// UVs of a mesh drawn with entry's maps (in and out may be the same array)
+void remapAtlasUVs(const AtlasEntry &entry, const GLfloat *uvs, int count, GLfloat *out);
+
+// Pages, occupancy and padding overhead
+void reportTextureAtlas(const TextureAtlas *atlas);
+
+#endif
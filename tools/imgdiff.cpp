@@ -0,0 +1,194 @@
+// imgdiff.cpp: compares a captured frame against a golden image
+//
+//   imgdiff golden.png capture.ppm [--ssim MIN] [--tolerance N]
+//           [--max-outliers FRACTION] [--heatmap diff.ppm]
+//
+// Two metrics, both must pass:
+// - per-channel threshold: a pixel is an outlier when any channel differs by
+//   more than --tolerance (default 8 of 255); at most --max-outliers of the
+//   pixels (default 0.001) may be outliers. Catches small hard breaks.
+// - SSIM of the luminance over 8x8 windows (stride 4), averaged; must be at
+//   least --ssim (default 0.98). Catches broad changes in lighting or
+//   structure that stay under the per-pixel tolerance.
+//
+// The heatmap is the golden image darkened, with differences under the
+// tolerance in blue and outliers from red (just over) to yellow (255 off).
+// Exit status: 0 match, 1 mismatch, 2 bad arguments or unreadable images.
+//////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+
+#define SSIM_WINDOW 8
+#define SSIM_STRIDE 4
+
+struct Image {
+  unsigned char *data;   // RGB
+  int width, height;
+};
+
+static bool loadImage(const char *path, Image *image) {
+  int components;
+  image->data = stbi_load(path, &image->width, &image->height, &components, 3);
+  if (!image->data) {
+    fprintf(stderr, "ERROR: could not load %s (%s)\n", path, stbi_failure_reason());
+    return false;
+  }
+  return true;
+}
+
+static float luminance(const unsigned char *rgb) {
+  return 0.299f * rgb[0] + 0.587f * rgb[1] + 0.114f * rgb[2];
+}
+
+// Mean SSIM of the luminance
+static double meanSSIM(const Image &a, const Image &b) {
+  const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+  const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+  const int n = SSIM_WINDOW * SSIM_WINDOW;
+
+  double sum = 0.0;
+  int windows = 0;
+  for (int y = 0; y + SSIM_WINDOW <= a.height; y += SSIM_STRIDE) {
+    for (int x = 0; x + SSIM_WINDOW <= a.width; x += SSIM_STRIDE) {
+      double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+      for (int wy = 0; wy < SSIM_WINDOW; wy++) {
+        for (int wx = 0; wx < SSIM_WINDOW; wx++) {
+          size_t i = ((size_t) (y + wy) * a.width + (x + wx)) * 3;
+          double la = luminance(&a.data[i]), lb = luminance(&b.data[i]);
+          sa += la; sb += lb;
+          saa += la * la; sbb += lb * lb; sab += la * lb;
+        }
+      }
+      double ma = sa / n, mb = sb / n;
+      double va = saa / n - ma * ma, vb = sbb / n - mb * mb, cov = sab / n - ma * mb;
+      sum += ((2.0 * ma * mb + c1) * (2.0 * cov + c2)) /
+             ((ma * ma + mb * mb + c1) * (va + vb + c2));
+      windows++;
+    }
+  }
+  return windows ? sum / windows : 1.0;
+}
+
+static bool writePPM(const char *path, const unsigned char *rgb, int width, int height) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "ERROR: could not write %s\n", path);
+    return false;
+  }
+  fprintf(file, "P6\n%d %d\n255\n", width, height);
+  fwrite(rgb, 1, (size_t) width * height * 3, file);
+  fclose(file);
+  return true;
+}
+
+static int usage(const char *program) {
+  fprintf(stderr, "Usage: %s golden capture [--ssim MIN] [--tolerance N] "
+                  "[--max-outliers FRACTION] [--heatmap FILE]\n", program);
+  return 2;
+}
+
+int main(int argc, char **argv) {
+  const char *paths[2] = { NULL, NULL };
+  const char *heatmapPath = NULL;
+  double minSSIM = 0.98;
+  int tolerance = 8;
+  double maxOutliers = 0.001;
+
+  int pathCount = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ssim") == 0 && i + 1 < argc) {
+      minSSIM = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+      tolerance = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-outliers") == 0 && i + 1 < argc) {
+      maxOutliers = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+      heatmapPath = argv[++i];
+    } else if (argv[i][0] != '-' && pathCount < 2) {
+      paths[pathCount++] = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (pathCount != 2)
+    return usage(argv[0]);
+
+  Image golden, capture;
+  if (!loadImage(paths[0], &golden))
+    return 2;
+  if (!loadImage(paths[1], &capture)) {
+    stbi_image_free(golden.data);
+    return 2;
+  }
+  if (golden.width != capture.width || golden.height != capture.height) {
+    fprintf(stderr, "FAIL: size %dx%d, golden is %dx%d\n",
+            capture.width, capture.height, golden.width, golden.height);
+    stbi_image_free(golden.data);
+    stbi_image_free(capture.data);
+    return 1;
+  }
+
+  size_t pixels = (size_t) golden.width * golden.height;
+  unsigned char *heatmap = heatmapPath ? (unsigned char *) malloc(pixels * 3) : NULL;
+
+  int maxDiff[3] = { 0, 0, 0 };
+  double sumDiff[3] = { 0, 0, 0 };
+  size_t outliers = 0;
+
+  for (size_t p = 0; p < pixels; p++) {
+    const unsigned char *g = &golden.data[p * 3], *c = &capture.data[p * 3];
+    int worst = 0;
+    for (int k = 0; k < 3; k++) {
+      int d = abs((int) g[k] - (int) c[k]);
+      if (d > maxDiff[k])
+        maxDiff[k] = d;
+      sumDiff[k] += d;
+      if (d > worst)
+        worst = d;
+    }
+    if (worst > tolerance)
+      outliers++;
+
+    if (heatmap) {
+      unsigned char *h = &heatmap[p * 3];
+      if (worst > tolerance) {
+        float t = (float) (worst - tolerance) / (float) (255 - tolerance > 0 ? 255 - tolerance : 1);
+        h[0] = 255;
+        h[1] = (unsigned char) (255.0f * t);
+        h[2] = 0;
+      } else {
+        unsigned char base = (unsigned char) (luminance(g) * 0.25f);
+        h[0] = base;
+        h[1] = base;
+        h[2] = worst ? (unsigned char) (128 + 127 * worst / (tolerance > 0 ? tolerance : 1)) : base;
+      }
+    }
+  }
+
+  double ssim = meanSSIM(golden, capture);
+  double outlierFraction = (double) outliers / (double) pixels;
+  bool pass = ssim >= minSSIM && outlierFraction <= maxOutliers;
+
+  printf("%s: SSIM %.5f (min %.5f), outliers %zu = %.5f%% (max %.5f%%, tolerance %d)\n",
+         pass ? "PASS" : "FAIL", ssim, minSSIM, outliers,
+         100.0 * outlierFraction, 100.0 * maxOutliers, tolerance);
+  printf("  max diff R %d G %d B %d, mean diff R %.3f G %.3f B %.3f\n",
+         maxDiff[0], maxDiff[1], maxDiff[2],
+         sumDiff[0] / pixels, sumDiff[1] / pixels, sumDiff[2] / pixels);
+
+  if (heatmap) {
+    if (writePPM(heatmapPath, heatmap, golden.width, golden.height))
+      printf("  heatmap written to %s\n", heatmapPath);
+    free(heatmap);
+  }
+
+  stbi_image_free(golden.data);
+  stbi_image_free(capture.data);
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+// trace.cpp: scoped event tracing to Chrome trace JSON
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Per thread: up to 64 chunks of 16K events (32 MB), allocated as needed;
+// events past that are counted and dropped
+#define TRACE_CHUNK_EVENTS 16384
+#define TRACE_MAX_CHUNKS 64
+
+struct TraceEvent {
+  const char *name;
+  uint64_t start;
+  union {
+    uint64_t duration;   // 'X' events
+    double value;        // 'C' events
+  };
+  char phase;
+};
+
+// Written only by its thread; writeTrace reads the first count events
+struct TraceBuffer {
+  std::atomic<TraceEvent *> chunks[TRACE_MAX_CHUNKS];
+  std::atomic<size_t> count;
+  std::atomic<size_t> dropped;
+  int tid;
+  std::string name;
+};
+
+std::atomic<bool> traceEnabled(false);
+
+static const std::chrono::steady_clock::time_point traceOrigin = std::chrono::steady_clock::now();
+
+static std::mutex registryMutex;
+static std::vector<TraceBuffer *> registry;
+static thread_local TraceBuffer *tlsBuffer = NULL;
+
+uint64_t traceNow() {
+  // +1: a zero start means "not recording" to TraceScope
+  return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now() - traceOrigin).count() + 1;
+}
+
+static TraceBuffer *threadBuffer() {
+  if (tlsBuffer)
+    return tlsBuffer;
+
+  TraceBuffer *buffer = new TraceBuffer;
+  for (int i = 0; i < TRACE_MAX_CHUNKS; i++)
+    buffer->chunks[i].store(NULL, std::memory_order_relaxed);
+  buffer->count.store(0, std::memory_order_relaxed);
+  buffer->dropped.store(0, std::memory_order_relaxed);
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  buffer->tid = (int) registry.size() + 1;
+  registry.push_back(buffer);
+  tlsBuffer = buffer;
+  return buffer;
+}
+
+static void appendEvent(const TraceEvent &event) {
+  TraceBuffer *buffer = threadBuffer();
+  size_t index = buffer->count.load(std::memory_order_relaxed);
+  size_t chunkIndex = index / TRACE_CHUNK_EVENTS;
+  if (chunkIndex >= TRACE_MAX_CHUNKS) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  TraceEvent *chunk = buffer->chunks[chunkIndex].load(std::memory_order_relaxed);
+  if (!chunk) {
+    chunk = (TraceEvent *) malloc(sizeof(TraceEvent) * TRACE_CHUNK_EVENTS);
+    if (!chunk) {
+      buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    buffer->chunks[chunkIndex].store(chunk, std::memory_order_release);
+  }
+
+  chunk[index % TRACE_CHUNK_EVENTS] = event;
+  buffer->count.store(index + 1, std::memory_order_release); // publishes the event
+}
+
+void traceComplete(const char *name, uint64_t start, uint64_t end) {
+  TraceEvent event;
+  event.name = name;
+  event.start = start;
+  event.duration = end - start;
+  event.phase = 'X';
+  appendEvent(event);
+}
+
+void traceCounter(const char *name, double value) {
+  TraceEvent event;
+  event.name = name;
+  event.start = traceNow();
+  event.value = value;
+  event.phase = 'C';
+  appendEvent(event);
+}
+
+void traceThreadName(const char *name) {
+  if (!traceEnabled.load(std::memory_order_relaxed))
+    return;
+  TraceBuffer *buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(registryMutex);
+  buffer->name = name;
+}
+
+void startTrace() {
+  traceEnabled.store(true, std::memory_order_relaxed);
+}
+
+static void writeString(FILE *file, const char *s) {
+  fputc('"', file);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', file);
+    if ((unsigned char) *s >= 0x20)
+      fputc(*s, file);
+  }
+  fputc('"', file);
+}
+
+bool writeTrace(const char *fileName) {
+  traceEnabled.store(false, std::memory_order_relaxed);
+
+  FILE *file = fopen(fileName, "w");
+  if (!file) {
+    fprintf(stderr, "ERROR: could not write trace %s\n", fileName);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  size_t total = 0, dropped = 0;
+  bool first = true;
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t b = 0; b < registry.size(); b++) {
+    TraceBuffer *buffer = registry[b];
+
+    if (!buffer->name.empty()) {
+      fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+              first ? "" : ",\n", buffer->tid);
+      writeString(file, buffer->name.c_str());
+      fprintf(file, "}}");
+      first = false;
+    }
+
+    size_t count = buffer->count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+      const TraceEvent &event = buffer->chunks[i / TRACE_CHUNK_EVENTS].load(std::memory_order_acquire)
+                                [i % TRACE_CHUNK_EVENTS];
+      fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+      writeString(file, event.name);
+      if (event.phase == 'X')
+        fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                buffer->tid, event.start / 1000.0, event.duration / 1000.0);
+      else
+        fprintf(file, ",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                buffer->tid, event.start / 1000.0, event.value);
+      first = false;
+    }
+    total += count;
+    dropped += buffer->dropped.load(std::memory_order_relaxed);
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+
+  printf("Trace: %zu events from %zu threads written to %s", total, registry.size(), fileName);
+  if (dropped)
+    printf(" (%zu dropped, buffers full)", dropped);
+  printf("\n");
+  return true;
+}
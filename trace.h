@@ -0,0 +1,58 @@
+// trace.h: scoped event tracing to Chrome trace JSON
+//
+// TRACE_SCOPE("name") records a complete event from that line to the end of
+// the enclosing block; TRACE_COUNTER("name", value) a counter sample. Events
+// go into a buffer owned by the calling thread (no locks, no shared cache
+// lines), and writeTrace() turns every thread's events into a JSON file that
+// chrome://tracing and ui.perfetto.dev open as a timeline.
+//
+// Tracing starts off (--trace FILE turns it on): then a scope costs one
+// relaxed load and a branch. Building with -DNO_TRACING removes the macros
+// altogether. Names must be string literals (only the pointer is kept).
+//////////////////////////////////////////////////////////////////////
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+extern std::atomic<bool> traceEnabled;
+
+// Nanoseconds since the trace clock started
+uint64_t traceNow();
+void traceComplete(const char *name, uint64_t start, uint64_t end);
+void traceCounter(const char *name, double value);
+// Label of the calling thread in the viewer
+void traceThreadName(const char *name);
+
+void startTrace();
+// Stops recording and writes every thread's events; call once the traced
+// threads are done
+bool writeTrace(const char *fileName);
+
+struct TraceScope {
+  const char *name;
+  uint64_t start;
+
+  explicit TraceScope(const char *name)
+    : name(name), start(traceEnabled.load(std::memory_order_relaxed) ? traceNow() : 0) {}
+  ~TraceScope() {
+    if (start)
+      traceComplete(name, start, traceNow());
+  }
+};
+
+#ifndef NO_TRACING
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_COUNTER(name, value) \
+  do { if (traceEnabled.load(std::memory_order_relaxed)) traceCounter(name, value); } while (0)
+#else
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_COUNTER(name, value) do { (void) sizeof(value); } while (0)
+#endif
+
+#endif
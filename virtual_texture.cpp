@@ -0,0 +1,542 @@
+// virtual_texture.cpp: virtual texturing for textures too big to keep resident
+
+#include "virtual_texture.h"
+#include "gl_state.h"
+#include "program_reflection.h"
+#include "trace.h"
+#include "stb_image.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <string>
+
+#define VT_PAGE_BYTES (VT_PAGE_SIZE * VT_PAGE_SIZE * 4)
+#define VT_MAX_LOADED 64      // tiles read ahead of the uploads
+
+static int levelSize(int size, int level) {
+  return std::max(size >> level, 1);
+}
+
+static int tileCount(int size, int level) {
+  return (levelSize(size, level) + VT_TILE_SIZE - 1) / VT_TILE_SIZE;
+}
+
+static int nextPowerOfTwo(int n) {
+  int p = 1;
+  while (p < n)
+    p *= 2;
+  return p;
+}
+
+// Levels down to a single tile (the page table's mip chain)
+static int levelCount(int width, int height) {
+  int size = std::max(nextPowerOfTwo(tileCount(width, 0)), nextPowerOfTwo(tileCount(height, 0)));
+  int levels = 1;
+  while (size > 1) {
+    size /= 2;
+    levels++;
+  }
+  return levels;
+}
+
+bool buildVirtualTextureFile(const char *imagePath, const char *vtexPath) {
+  TRACE_SCOPE("buildVirtualTextureFile");
+  int width, height, components;
+  unsigned char *data = stbi_load(imagePath, &width, &height, &components, 4);
+  if (!data) {
+    fprintf(stderr, "ERROR: could not read %s\n", imagePath);
+    return false;
+  }
+  if (tileCount(width, 0) > VT_MAX_TILES || tileCount(height, 0) > VT_MAX_TILES) {
+    fprintf(stderr, "ERROR: %s is %dx%d, virtual textures go up to %d texels a side\n",
+            imagePath, width, height, VT_MAX_TILES * VT_TILE_SIZE);
+    stbi_image_free(data);
+    return false;
+  }
+
+  // Mip chain, 2x2 box filter (the last row or column of odd sizes is dropped)
+  int levels = levelCount(width, height);
+  std::vector<std::vector<unsigned char> > mips(levels);
+  mips[0].assign(data, data + (size_t) width * height * 4);
+  stbi_image_free(data);
+  for (int l = 1; l < levels; l++) {
+    int sw = levelSize(width, l - 1), sh = levelSize(height, l - 1);
+    int w = levelSize(width, l), h = levelSize(height, l);
+    const unsigned char *src = mips[l - 1].data();
+    mips[l].resize((size_t) w * h * 4);
+    for (int y = 0; y < h; y++) {
+      int y0 = std::min(y * 2, sh - 1), y1 = std::min(y * 2 + 1, sh - 1);
+      for (int x = 0; x < w; x++) {
+        int x0 = std::min(x * 2, sw - 1), x1 = std::min(x * 2 + 1, sw - 1);
+        for (int c = 0; c < 4; c++) {
+          int sum = src[((size_t) y0 * sw + x0) * 4 + c] + src[((size_t) y0 * sw + x1) * 4 + c] +
+                    src[((size_t) y1 * sw + x0) * 4 + c] + src[((size_t) y1 * sw + x1) * 4 + c];
+          mips[l][((size_t) y * w + x) * 4 + c] = (unsigned char) ((sum + 2) / 4);
+        }
+      }
+    }
+  }
+
+  // Written under a temporary name, so an interrupted build leaves no file
+  std::string tempPath = std::string(vtexPath) + ".tmp";
+  FILE *file = fopen(tempPath.c_str(), "wb");
+  if (!file) {
+    fprintf(stderr, "ERROR: could not create %s\n", tempPath.c_str());
+    return false;
+  }
+
+  VtFileHeader header = { { 'V', 'T', 'E', 'X' }, 1, (unsigned int) width, (unsigned int) height,
+                          VT_TILE_SIZE, VT_TILE_BORDER, (unsigned int) levels };
+  fwrite(&header, sizeof(header), 1, file);
+
+  // Tiles with their border, wrapping around the image edges like GL_REPEAT
+  std::vector<unsigned char> page(VT_PAGE_BYTES);
+  long tiles = 0;
+  for (int l = 0; l < levels; l++) {
+    int w = levelSize(width, l), h = levelSize(height, l);
+    const unsigned char *src = mips[l].data();
+    for (int ty = 0; ty < tileCount(height, l); ty++) {
+      for (int tx = 0; tx < tileCount(width, l); tx++) {
+        for (int py = 0; py < VT_PAGE_SIZE; py++) {
+          int sy = ((ty * VT_TILE_SIZE + py - VT_TILE_BORDER) % h + h) % h;
+          for (int px = 0; px < VT_PAGE_SIZE; px++) {
+            int sx = ((tx * VT_TILE_SIZE + px - VT_TILE_BORDER) % w + w) % w;
+            memcpy(&page[((size_t) py * VT_PAGE_SIZE + px) * 4], &src[((size_t) sy * w + sx) * 4], 4);
+          }
+        }
+        fwrite(page.data(), VT_PAGE_BYTES, 1, file);
+        tiles++;
+      }
+    }
+  }
+
+  bool ok = !ferror(file);
+  ok &= fclose(file) == 0;
+  if (!ok || rename(tempPath.c_str(), vtexPath) != 0) {
+    fprintf(stderr, "ERROR: could not write %s\n", vtexPath);
+    remove(tempPath.c_str());
+    return false;
+  }
+
+  printf("Virtual texture: wrote %s (%dx%d, %d levels, %ld tiles, %.1f MB)\n", vtexPath,
+         width, height, levels, tiles, tiles * (double) VT_PAGE_BYTES / (1024.0 * 1024.0));
+  return true;
+}
+
+bool virtualTextureFileCurrent(const char *imagePath, const char *vtexPath) {
+  struct stat image, vtex;
+  return stat(vtexPath, &vtex) == 0 &&
+         (stat(imagePath, &image) != 0 || vtex.st_mtime >= image.st_mtime);
+}
+
+static unsigned int tileLevel(unsigned int tile) { return tile >> 24; }
+static unsigned int tileX(unsigned int tile) { return tile & 0xFFF; }
+static unsigned int tileY(unsigned int tile) { return (tile >> 12) & 0xFFF; }
+
+static unsigned int parentTile(unsigned int tile) {
+  return VT_TILE(tileLevel(tile) + 1, tileX(tile) >> 1, tileY(tile) >> 1);
+}
+
+// Only the loader thread reads the file once createVirtualTexture returns
+static bool readTile(VirtualTexture *vt, unsigned int tile, unsigned char *texels) {
+  unsigned int level = tileLevel(tile);
+  off_t index = vt->levelFirstTile[level] + (off_t) tileY(tile) * vt->levelTilesX[level] + tileX(tile);
+  if (fseeko(vt->file, (off_t) sizeof(VtFileHeader) + index * VT_PAGE_BYTES, SEEK_SET) != 0 ||
+      fread(texels, VT_PAGE_BYTES, 1, vt->file) != 1) {
+    fprintf(stderr, "ERROR: could not read virtual texture tile %u (%u, %u)\n",
+            level, tileX(tile), tileY(tile));
+    return false;
+  }
+  return true;
+}
+
+static void loaderThread(VirtualTexture *vt) {
+  traceThreadName("vt loader");
+  std::unique_lock<std::mutex> lock(vt->mutex);
+  for (;;) {
+    vt->wake.wait(lock, [vt] {
+      return vt->quit || (!vt->loadQueue.empty() && vt->loaded.size() < VT_MAX_LOADED);
+    });
+    if (vt->quit)
+      return;
+
+    VtLoadedTile tile;
+    tile.tile = vt->loadQueue.back();
+    vt->loadQueue.pop_back();
+    lock.unlock();
+
+    tile.texels.resize(VT_PAGE_BYTES);
+    bool ok;
+    {
+      TRACE_SCOPE("vt tile read");
+      ok = readTile(vt, tile.tile, tile.texels.data());
+    }
+
+    lock.lock();
+    if (ok)
+      vt->loaded.push_back(std::move(tile));
+    else
+      vt->inFlight.erase(tile.tile);
+  }
+}
+
+static void uploadTile(VirtualTexture *vt, int slot, const unsigned char *texels) {
+  glsBindTexture(0, GL_TEXTURE_2D, vt->cache);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % vt->cacheTilesX) * VT_PAGE_SIZE,
+                  (slot / vt->cacheTilesX) * VT_PAGE_SIZE, VT_PAGE_SIZE, VT_PAGE_SIZE,
+                  GL_RGBA, GL_UNSIGNED_BYTE, texels);
+}
+
+// Every texel points at its own tile if resident, else at its parent's
+// choice; coarsest level first
+static void updatePageTable(VirtualTexture *vt) {
+  int levels = (int) vt->header.levels;
+  glsBindTexture(0, GL_TEXTURE_2D, vt->pageTable);
+  for (int l = levels - 1; l >= 0; l--) {
+    int w = levelSize(vt->pageTableWidth, l), h = levelSize(vt->pageTableHeight, l);
+    int pw = levelSize(vt->pageTableWidth, l + 1);
+    std::vector<unsigned char> &entries = vt->pageTableLevels[l];
+    for (int y = 0; y < h; y++) {
+      for (int x = 0; x < w; x++) {
+        unsigned char *entry = &entries[((size_t) y * w + x) * 4];
+        std::unordered_map<unsigned int, int>::const_iterator it = vt->resident.end();
+        if (x < vt->levelTilesX[l] && y < vt->levelTilesY[l])
+          it = vt->resident.find(VT_TILE(l, x, y));
+
+        if (it != vt->resident.end()) {
+          entry[0] = (unsigned char) (it->second % vt->cacheTilesX);
+          entry[1] = (unsigned char) (it->second / vt->cacheTilesX);
+          entry[2] = (unsigned char) l;
+          entry[3] = 1;
+        } else if (l + 1 < levels) {
+          memcpy(entry, &vt->pageTableLevels[l + 1][((size_t) (y >> 1) * pw + (x >> 1)) * 4], 4);
+        } else {
+          memset(entry, 0, 4);
+        }
+      }
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, w, h, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+  }
+  glsBindTexture(0, GL_TEXTURE_2D, 0);
+  vt->pageTableDirty = false;
+}
+
+bool createVirtualTexture(VirtualTexture *vt, const char *vtexPath, size_t cacheBytes) {
+  vt->file = fopen(vtexPath, "rb");
+  if (!vt->file) {
+    fprintf(stderr, "ERROR: could not open %s\n", vtexPath);
+    return false;
+  }
+
+  VtFileHeader &header = vt->header;
+  if (fread(&header, sizeof(header), 1, vt->file) != 1 || memcmp(header.magic, "VTEX", 4) != 0 ||
+      header.version != 1 || header.tileSize != VT_TILE_SIZE || header.border != VT_TILE_BORDER ||
+      (int) header.levels != levelCount((int) header.width, (int) header.height)) {
+    fprintf(stderr, "ERROR: %s is not a virtual texture of this version\n", vtexPath);
+    fclose(vt->file);
+    vt->file = NULL;
+    return false;
+  }
+
+  int levels = (int) header.levels;
+  long tiles = 0;
+  for (int l = 0; l < levels; l++) {
+    vt->levelTilesX.push_back(tileCount((int) header.width, l));
+    vt->levelTilesY.push_back(tileCount((int) header.height, l));
+    vt->levelFirstTile.push_back(tiles);
+    tiles += (long) vt->levelTilesX[l] * vt->levelTilesY[l];
+  }
+
+  // Page table: power-of-two tile counts, so each mip level has exactly the
+  // tiles of the next virtual level (rounded up)
+  vt->pageTableWidth = nextPowerOfTwo(vt->levelTilesX[0]);
+  vt->pageTableHeight = nextPowerOfTwo(vt->levelTilesY[0]);
+  vt->pageTableLevels.resize(levels);
+  glGenTextures(1, &vt->pageTable);
+  glsBindTexture(0, GL_TEXTURE_2D, vt->pageTable);
+  for (int l = 0; l < levels; l++) {
+    int w = levelSize(vt->pageTableWidth, l), h = levelSize(vt->pageTableHeight, l);
+    vt->pageTableLevels[l].assign((size_t) w * h * 4, 0);
+    glTexImage2D(GL_TEXTURE_2D, l, GL_RGBA8UI, w, h, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  // Physical cache: as many pages as the budget allows, close to square.
+  // Whole rows only, so the texture never goes over the budget
+  GLint maxTextureSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  int maxSide = std::min((int) maxTextureSize / VT_PAGE_SIZE, 256);   // slots fit a page table byte
+  int pages = std::max((int) (cacheBytes / VT_PAGE_BYTES), 2);
+  vt->cacheTilesX = std::min((int) ceil(sqrt((double) pages)), maxSide);
+  vt->cacheTilesY = std::min(pages / vt->cacheTilesX, maxSide);
+  vt->slots.assign(vt->cacheTilesX * vt->cacheTilesY, VtCacheSlot{ VT_NO_TILE, 0 });
+
+  glGenTextures(1, &vt->cache);
+  glsBindTexture(0, GL_TEXTURE_2D, vt->cache);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, vt->cacheTilesX * VT_PAGE_SIZE,
+               vt->cacheTilesY * VT_PAGE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  // Coarsest tile, pinned in slot 0: the fallback of every lookup
+  std::vector<unsigned char> texels(VT_PAGE_BYTES);
+  unsigned int root = VT_TILE(levels - 1, 0, 0);
+  if (!readTile(vt, root, texels.data())) {
+    destroyVirtualTexture(vt);
+    return false;
+  }
+  uploadTile(vt, 0, texels.data());
+  vt->slots[0].tile = root;
+  vt->slots[0].lastUsed = ~0ull;
+  vt->resident[root] = 0;
+  updatePageTable(vt);
+
+  glGenFramebuffers(1, &vt->feedbackFbo);
+  glGenBuffers(2, vt->feedbackPbos);
+
+  GLenum error = glGetError();
+  if (error != GL_NO_ERROR) {
+    fprintf(stderr, "ERROR: could not create the virtual texture (0x%x)\n", error);
+    destroyVirtualTexture(vt);
+    return false;
+  }
+
+  vt->loader = std::thread(loaderThread, vt);
+
+  printf("Virtual texture: %s, %ux%u, %d levels, %ld tiles; cache of %d pages (%.1f MB)\n",
+         vtexPath, header.width, header.height, levels, tiles, (int) vt->slots.size(),
+         vt->slots.size() * (double) VT_PAGE_BYTES / (1024.0 * 1024.0));
+  return true;
+}
+
+void destroyVirtualTexture(VirtualTexture *vt) {
+  if (vt->loader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(vt->mutex);
+      vt->quit = true;
+    }
+    vt->wake.notify_all();
+    vt->loader.join();
+  }
+  if (vt->file)
+    fclose(vt->file);
+  vt->file = NULL;
+
+  for (int i = 0; i < 2; i++)
+    if (vt->feedbackFences[i])
+      glDeleteSync(vt->feedbackFences[i]);
+  glsDeleteBuffers(2, vt->feedbackPbos);
+  glsDeleteFramebuffers(1, &vt->feedbackFbo);
+  glDeleteRenderbuffers(1, &vt->feedbackDepth);
+  GLuint textures[3] = { vt->pageTable, vt->cache, vt->feedbackColor };
+  glsDeleteTextures(3, textures);
+}
+
+void setVirtualTextureUniforms(const VirtualTexture *vt, GLuint program,
+                               GLint pageTableUnit, GLint cacheUnit) {
+  glm::vec4 layout((float) vt->header.width, (float) vt->header.height,
+                   (float) VT_TILE_SIZE, (float) VT_TILE_BORDER);
+  glm::vec4 cacheLayout((float) (vt->cacheTilesX * VT_PAGE_SIZE), (float) (vt->cacheTilesY * VT_PAGE_SIZE),
+                        (float) (vt->header.levels - 1), -log2f((float) VT_FEEDBACK_DIVISOR));
+  setUniform(findUniform<int>(program, "vt_page_table"), pageTableUnit);
+  setUniform(findUniform<int>(program, "vt_cache"), cacheUnit);
+  setUniform(findUniform<glm::vec4>(program, "vt_layout"), &layout, 1);
+  setUniform(findUniform<glm::vec4>(program, "vt_cache_layout"), &cacheLayout, 1);
+}
+
+void bindVirtualTextureCache(const VirtualTexture *vt, GLint cacheUnit) {
+  glsBindTexture(cacheUnit, GL_TEXTURE_2D, vt->cache);
+}
+
+void beginVirtualTextureFeedback(VirtualTexture *vt, int width, int height) {
+  int w = std::max(width / VT_FEEDBACK_DIVISOR, 1), h = std::max(height / VT_FEEDBACK_DIVISOR, 1);
+
+  if (w != vt->feedbackWidth || h != vt->feedbackHeight) {
+    if (!vt->feedbackColor) {
+      glGenTextures(1, &vt->feedbackColor);
+      glGenRenderbuffers(1, &vt->feedbackDepth);
+    }
+    glsBindTexture(0, GL_TEXTURE_2D, vt->feedbackColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, w, h, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindRenderbuffer(GL_RENDERBUFFER, vt->feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+
+    glsBindFramebuffer(GL_FRAMEBUFFER, vt->feedbackFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vt->feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, vt->feedbackDepth);
+
+    // Readbacks of the old size are dropped
+    for (int i = 0; i < 2; i++) {
+      if (vt->feedbackFences[i])
+        glDeleteSync(vt->feedbackFences[i]);
+      vt->feedbackFences[i] = 0;
+      glsBindBuffer(GL_PIXEL_PACK_BUFFER, vt->feedbackPbos[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) w * h * 4, NULL, GL_STREAM_READ);
+    }
+    glsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    vt->feedbackWidth = w;
+    vt->feedbackHeight = h;
+  }
+
+  glsBindFramebuffer(GL_FRAMEBUFFER, vt->feedbackFbo);
+  glViewport(0, 0, w, h);
+  const GLuint noTile[4] = { 0, 0, 0, 0 };
+  glClearBufferuiv(GL_COLOR, 0, noTile);
+  glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void endVirtualTextureFeedback(VirtualTexture *vt) {
+  // A readback nobody mapped yet is overwritten: its feedback is stale anyway
+  int i = vt->feedbackIndex;
+  if (vt->feedbackFences[i])
+    glDeleteSync(vt->feedbackFences[i]);
+
+  glsBindBuffer(GL_PIXEL_PACK_BUFFER, vt->feedbackPbos[i]);
+  glReadPixels(0, 0, vt->feedbackWidth, vt->feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+  glsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  vt->feedbackFences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  vt->feedbackIndex ^= 1;
+
+  glsBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Tiles named by a finished readback; false if none is ready
+static bool readFeedback(VirtualTexture *vt, std::vector<unsigned int> *tiles) {
+  // Oldest first: feedbackIndex is the next one to be written
+  for (int k = 0; k < 2; k++) {
+    int i = vt->feedbackIndex ^ k;
+    if (!vt->feedbackFences[i] ||
+        glClientWaitSync(vt->feedbackFences[i], 0, 0) == GL_TIMEOUT_EXPIRED)
+      continue;
+    glDeleteSync(vt->feedbackFences[i]);
+    vt->feedbackFences[i] = 0;
+
+    size_t pixels = (size_t) vt->feedbackWidth * vt->feedbackHeight;
+    glsBindBuffer(GL_PIXEL_PACK_BUFFER, vt->feedbackPbos[i]);
+    const unsigned char *data = (const unsigned char *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                                         pixels * 4, GL_MAP_READ_BIT);
+    if (data) {
+      for (size_t p = 0; p < pixels; p++) {
+        const unsigned char *texel = &data[p * 4];
+        if (texel[3] && texel[2] < vt->header.levels &&
+            texel[0] < vt->levelTilesX[texel[2]] && texel[1] < vt->levelTilesY[texel[2]])
+          tiles->push_back(VT_TILE(texel[2], texel[0], texel[1]));
+      }
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glsBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    vt->stats.feedbackReads++;
+    return true;
+  }
+  return false;
+}
+
+// Free slot, else the least recently used one not seen by the latest feedback
+static int findSlot(const VirtualTexture *vt) {
+  int best = -1;
+  for (size_t s = 0; s < vt->slots.size(); s++) {
+    const VtCacheSlot &slot = vt->slots[s];
+    if (slot.tile == VT_NO_TILE)
+      return (int) s;
+    if (slot.lastUsed < vt->frame && (best < 0 || slot.lastUsed < vt->slots[best].lastUsed))
+      best = (int) s;
+  }
+  return best;
+}
+
+void updateVirtualTexture(VirtualTexture *vt, int maxUploads) {
+  TRACE_SCOPE("updateVirtualTexture");
+  std::vector<unsigned int> tiles;
+
+  if (readFeedback(vt, &tiles)) {
+    vt->frame++;
+    std::sort(tiles.begin(), tiles.end());
+    tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+    // Touch what the pixels sample (the tile or its resident ancestor),
+    // and collect the missing tiles and ancestors
+    std::vector<unsigned int> missing;
+    for (size_t i = 0; i < tiles.size(); i++) {
+      unsigned int tile = tiles[i];
+      std::unordered_map<unsigned int, int>::const_iterator it;
+      while ((it = vt->resident.find(tile)) == vt->resident.end()) {
+        missing.push_back(tile);
+        tile = parentTile(tile);
+      }
+      if (vt->slots[it->second].lastUsed != ~0ull)
+        vt->slots[it->second].lastUsed = vt->frame;
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+    // The queue is replaced: tiles no longer visible aren't worth reading.
+    // Sorted by tile id, so the coarsest levels come out of the back first
+    std::lock_guard<std::mutex> lock(vt->mutex);
+    std::unordered_set<unsigned int> queued(vt->loadQueue.begin(), vt->loadQueue.end());
+    for (size_t i = 0; i < vt->loadQueue.size(); i++)
+      vt->inFlight.erase(vt->loadQueue[i]);
+    vt->loadQueue.clear();
+    for (size_t i = 0; i < missing.size(); i++) {
+      if (vt->inFlight.insert(missing[i]).second) {
+        vt->loadQueue.push_back(missing[i]);
+        if (!queued.count(missing[i]))
+          vt->stats.tilesRequested++;
+      }
+    }
+    vt->wake.notify_one();
+  }
+
+  // Loaded tiles into the cache, a few per frame to bound the upload cost
+  std::vector<VtLoadedTile> ready;
+  {
+    std::lock_guard<std::mutex> lock(vt->mutex);
+    size_t count = std::min(vt->loaded.size(), (size_t) maxUploads);
+    for (size_t i = 0; i < count; i++)
+      ready.push_back(std::move(vt->loaded[i]));
+    vt->loaded.erase(vt->loaded.begin(), vt->loaded.begin() + count);
+    if (count)
+      vt->wake.notify_one();
+  }
+
+  for (size_t i = 0; i < ready.size(); i++) {
+    int s = findSlot(vt);
+    if (s < 0) {
+      // Everything in the cache is in view: over budget, keep the fallback
+      vt->stats.tilesDropped++;
+      continue;
+    }
+
+    VtCacheSlot &slot = vt->slots[s];
+    if (slot.tile != VT_NO_TILE) {
+      vt->resident.erase(slot.tile);
+      vt->stats.tilesEvicted++;
+    }
+    uploadTile(vt, s, ready[i].texels.data());
+    slot.tile = ready[i].tile;
+    slot.lastUsed = vt->frame;
+    vt->resident[slot.tile] = s;
+    vt->stats.tilesUploaded++;
+    vt->pageTableDirty = true;
+  }
+  if (!ready.empty()) {
+    glsBindTexture(0, GL_TEXTURE_2D, 0);
+    std::lock_guard<std::mutex> lock(vt->mutex);
+    for (size_t i = 0; i < ready.size(); i++)
+      vt->inFlight.erase(ready[i].tile);
+  }
+
+  if (vt->pageTableDirty)
+    updatePageTable(vt);
+}
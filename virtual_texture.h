@@ -0,0 +1,140 @@
+// virtual_texture.h: virtual texturing for textures too big to keep resident
+//
+// The image is converted once into a tiled file (.vtex): its whole mip
+// chain cut into VT_TILE_SIZE tiles, each stored with a VT_TILE_BORDER band
+// of its neighbours so bilinear filtering never reads outside the tile.
+// Only the tiles the camera needs are loaded. They go into a physical
+// cache texture of fixed size (the memory budget), reused least recently
+// used first.
+//
+// Every frame:
+//  - A feedback pass draws the virtual textured objects into a small
+//    VT_FEEDBACK_DIVISOR-th resolution target. Each pixel holds the tile and
+//    mip level it samples.
+//  - The target is read back through a PBO. It is mapped a frame or more
+//    later, when its fence says the copy is done, so the CPU never waits.
+//  - Missing tiles go to a loader thread, coarsest level first. It reads
+//    them from the file while the frames go on.
+//  - At most maxUploads loaded tiles a frame are copied into the cache.
+//
+// The page table is a mipmapped RGBA8UI texture with one texel per
+// virtual tile: (cache slot x, y, level of the tile there, 1). A tile that
+// isn't resident points at its nearest resident ancestor. The coarsest
+// level is a single tile, loaded at startup and never evicted, so every
+// lookup finds something. The shader translates virtual UVs with one page
+// table fetch and then does one bilinear sample of the cache (no
+// trilinear between levels).
+//////////////////////////////////////////////////////////////////////
+
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <GL/glew.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define VT_TILE_SIZE 120                               // content texels a side
+#define VT_TILE_BORDER 4
+#define VT_PAGE_SIZE (VT_TILE_SIZE + 2 * VT_TILE_BORDER) // stored texels a side
+#define VT_MAX_TILES 256                               // per side at level 0
+#define VT_FEEDBACK_DIVISOR 8
+
+// .vtex header, followed by the tiles (VT_PAGE_SIZE^2 RGBA8 texels each),
+// level 0 first and row by row within a level
+struct VtFileHeader {
+  char magic[4];              // "VTEX"
+  unsigned int version;
+  unsigned int width, height; // level 0 texels
+  unsigned int tileSize, border;
+  unsigned int levels;
+};
+
+// Writes the tiled file for an image (stb_image formats). The whole mip
+// chain is built in memory, this is a one-off conversion
+bool buildVirtualTextureFile(const char *imagePath, const char *vtexPath);
+// Whether vtexPath exists and is newer than imagePath
+bool virtualTextureFileCurrent(const char *imagePath, const char *vtexPath);
+
+// Tile id: level << 24 | y << 12 | x
+#define VT_TILE(level, x, y) ((unsigned int) (level) << 24 | (unsigned int) (y) << 12 | (unsigned int) (x))
+
+struct VtCacheSlot {
+  unsigned int tile;          // VT_NO_TILE: free
+  unsigned long long lastUsed;
+};
+#define VT_NO_TILE 0xFFFFFFFFu
+
+struct VtLoadedTile {
+  unsigned int tile;
+  std::vector<unsigned char> texels;
+};
+
+struct VtStats {
+  unsigned long long tilesRequested, tilesUploaded, tilesEvicted, tilesDropped;
+  unsigned long long feedbackReads;
+};
+
+struct VirtualTexture {
+  FILE *file = NULL;
+  VtFileHeader header = {};
+  std::vector<int> levelTilesX, levelTilesY;
+  std::vector<long> levelFirstTile;   // index of each level's first tile in the file
+
+  // Page table: CPU copy of every level, uploaded when residency changes
+  GLuint pageTable = 0;
+  int pageTableWidth = 0, pageTableHeight = 0;
+  std::vector<std::vector<unsigned char> > pageTableLevels;
+  bool pageTableDirty = false;
+
+  // Physical cache, cacheTilesX x cacheTilesY slots
+  GLuint cache = 0;
+  int cacheTilesX = 0, cacheTilesY = 0;
+  std::vector<VtCacheSlot> slots;
+  std::unordered_map<unsigned int, int> resident;   // tile -> slot
+  unsigned long long frame = 0;
+
+  // Feedback target and its double-buffered readback
+  GLuint feedbackFbo = 0, feedbackColor = 0, feedbackDepth = 0;
+  int feedbackWidth = 0, feedbackHeight = 0;
+  GLuint feedbackPbos[2] = { 0, 0 };
+  GLsync feedbackFences[2] = { 0, 0 };
+  int feedbackIndex = 0;
+
+  // Loader thread: takes tiles from loadQueue, leaves them in loaded
+  std::thread loader;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<unsigned int> loadQueue;           // next tile last
+  std::vector<VtLoadedTile> loaded;
+  std::unordered_set<unsigned int> inFlight;     // queued, loading or loaded
+  bool quit = false;
+
+  VtStats stats = {};
+};
+
+// Opens a tiled file and creates the GL objects; cacheBytes bounds the
+// physical cache. The coarsest tile is loaded before returning
+bool createVirtualTexture(VirtualTexture *vt, const char *vtexPath, size_t cacheBytes);
+void destroyVirtualTexture(VirtualTexture *vt);
+
+// Constant uniforms of a program sampling vt (current program); the page
+// table is a per-draw texture, the cache stays on cacheUnit
+void setVirtualTextureUniforms(const VirtualTexture *vt, GLuint program,
+                               GLint pageTableUnit, GLint cacheUnit);
+void bindVirtualTextureCache(const VirtualTexture *vt, GLint cacheUnit);
+
+// Feedback pass around the caller's draws; the viewport is left at the
+// feedback size and the default framebuffer bound afterwards
+void beginVirtualTextureFeedback(VirtualTexture *vt, int width, int height);
+void endVirtualTextureFeedback(VirtualTexture *vt);
+
+// Reads finished feedback, queues loads and uploads up to maxUploads tiles
+void updateVirtualTexture(VirtualTexture *vt, int maxUploads);
+
+#endif
@@ -0,0 +1,23 @@
+#version 130
+
+// Virtual texture feedback (virtual_texture.h): the tile and level the
+// shading pass samples at each pixel, drawn at 1/VT_FEEDBACK_DIVISOR of its
+// resolution (the bias makes up for the larger derivatives)
+
+in vec2 vs_tex_coord;
+
+out uvec4 feedback;   // tile x, y, level, 1 (0: no virtual texture)
+
+uniform vec4 vt_layout;        // virtual width, height, tile size, border
+uniform vec4 vt_cache_layout;  // cache width, height, coarsest level, feedback bias
+
+void main() {
+  vec2 texel = vs_tex_coord * vt_layout.xy;
+  vec2 dx = dFdx(texel), dy = dFdy(texel);
+  float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vt_cache_layout.w;
+  int level = int(clamp(floor(lod), 0.0, vt_cache_layout.z));
+
+  vec2 level_size = max(floor(vt_layout.xy / exp2(float(level))), vec2(1.0));
+  uvec2 tile = uvec2(fract(vs_tex_coord) * level_size / vt_layout.z);
+  feedback = uvec4(tile, uint(level), 1u);
+}